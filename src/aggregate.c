@@ -0,0 +1,447 @@
+#include "dataset.h"
+#include "dataset_private.h"
+#include <gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+aggregates run in two passes over each block of rows:
+	pass 0 finds the count, sum, min and max of the non NaN values
+	pass 1 sums the squared deviations from the block mean
+Blocks are combined with the pairwise variance update so large columns can
+be split across threads without losing precision. Histograms of real columns
+skip whole zones outside the buckets and count zones that fall in a single
+bucket from their zone map.
+*/
+
+#define AGGREGATE_MIN_BLOCK_SIZE (1 << 20)
+#define AGGREGATE_FROZEN_BATCH 4096
+
+typedef struct aggregate_block_t {
+	column_t *Column;
+	size_t Start, Count;
+	size_t Total;
+	double Sum, Min, Max, M2;
+	double HistogramMin, HistogramScale;
+	uint64_t *Buckets;
+	int NumBuckets;
+} aggregate_block_t;
+
+static void aggregate_reals_scalar(aggregate_block_t *Block, const double *Values, size_t Count) {
+	size_t Total = 0;
+	double Sum = 0, Min = INFINITY, Max = -INFINITY;
+	for (size_t I = 0; I < Count; ++I) {
+		double Value = Values[I];
+		if (Value != Value) continue;
+		++Total;
+		Sum += Value;
+		if (Min > Value) Min = Value;
+		if (Max < Value) Max = Value;
+	}
+	Block->Total = Total;
+	Block->Sum = Sum;
+	Block->Min = Min;
+	Block->Max = Max;
+}
+
+static double deviations_reals_scalar(const double *Values, size_t Count, double Mean) {
+	double M2 = 0;
+	for (size_t I = 0; I < Count; ++I) {
+		double Value = Values[I];
+		if (Value != Value) continue;
+		M2 += (Value - Mean) * (Value - Mean);
+	}
+	return M2;
+}
+
+#if defined(__x86_64__)
+
+static void aggregate_reals_sse2(aggregate_block_t *Block, const double *Values, size_t Count) {
+	__m128d Sum = _mm_setzero_pd();
+	__m128d Min = _mm_set1_pd(INFINITY), Max = _mm_set1_pd(-INFINITY);
+	__m128i Total = _mm_setzero_si128();
+	size_t I = 0;
+	for (; I + 2 <= Count; I += 2) {
+		__m128d Value = _mm_loadu_pd(Values + I);
+		__m128d Valid = _mm_cmpord_pd(Value, Value);
+		Sum = _mm_add_pd(Sum, _mm_and_pd(Value, Valid));
+		// min/max return the second operand when the first is NaN
+		Min = _mm_min_pd(Value, Min);
+		Max = _mm_max_pd(Value, Max);
+		Total = _mm_sub_epi64(Total, _mm_castpd_si128(Valid));
+	}
+	double Sums[2], Mins[2], Maxs[2];
+	int64_t Totals[2];
+	_mm_storeu_pd(Sums, Sum);
+	_mm_storeu_pd(Mins, Min);
+	_mm_storeu_pd(Maxs, Max);
+	_mm_storeu_si128((__m128i *)Totals, Total);
+	aggregate_reals_scalar(Block, Values + I, Count - I);
+	Block->Total += Totals[0] + Totals[1];
+	Block->Sum += Sums[0] + Sums[1];
+	for (int J = 0; J < 2; ++J) {
+		if (Block->Min > Mins[J]) Block->Min = Mins[J];
+		if (Block->Max < Maxs[J]) Block->Max = Maxs[J];
+	}
+}
+
+static double deviations_reals_sse2(const double *Values, size_t Count, double Mean) {
+	__m128d M2 = _mm_setzero_pd(), Means = _mm_set1_pd(Mean);
+	size_t I = 0;
+	for (; I + 2 <= Count; I += 2) {
+		__m128d Value = _mm_loadu_pd(Values + I);
+		__m128d Valid = _mm_cmpord_pd(Value, Value);
+		__m128d Delta = _mm_and_pd(_mm_sub_pd(Value, Means), Valid);
+		M2 = _mm_add_pd(M2, _mm_mul_pd(Delta, Delta));
+	}
+	double M2s[2];
+	_mm_storeu_pd(M2s, M2);
+	return M2s[0] + M2s[1] + deviations_reals_scalar(Values + I, Count - I, Mean);
+}
+
+__attribute__((target("avx2")))
+static void aggregate_reals_avx2(aggregate_block_t *Block, const double *Values, size_t Count) {
+	__m256d Sum = _mm256_setzero_pd();
+	__m256d Min = _mm256_set1_pd(INFINITY), Max = _mm256_set1_pd(-INFINITY);
+	__m256i Total = _mm256_setzero_si256();
+	size_t I = 0;
+	for (; I + 4 <= Count; I += 4) {
+		__m256d Value = _mm256_loadu_pd(Values + I);
+		__m256d Valid = _mm256_cmp_pd(Value, Value, _CMP_ORD_Q);
+		Sum = _mm256_add_pd(Sum, _mm256_and_pd(Value, Valid));
+		Min = _mm256_min_pd(Value, Min);
+		Max = _mm256_max_pd(Value, Max);
+		Total = _mm256_sub_epi64(Total, _mm256_castpd_si256(Valid));
+	}
+	double Sums[4], Mins[4], Maxs[4];
+	int64_t Totals[4];
+	_mm256_storeu_pd(Sums, Sum);
+	_mm256_storeu_pd(Mins, Min);
+	_mm256_storeu_pd(Maxs, Max);
+	_mm256_storeu_si256((__m256i *)Totals, Total);
+	aggregate_reals_scalar(Block, Values + I, Count - I);
+	Block->Total += Totals[0] + Totals[1] + Totals[2] + Totals[3];
+	Block->Sum += (Sums[0] + Sums[1]) + (Sums[2] + Sums[3]);
+	for (int J = 0; J < 4; ++J) {
+		if (Block->Min > Mins[J]) Block->Min = Mins[J];
+		if (Block->Max < Maxs[J]) Block->Max = Maxs[J];
+	}
+}
+
+__attribute__((target("avx2")))
+static double deviations_reals_avx2(const double *Values, size_t Count, double Mean) {
+	__m256d M2 = _mm256_setzero_pd(), Means = _mm256_set1_pd(Mean);
+	size_t I = 0;
+	for (; I + 4 <= Count; I += 4) {
+		__m256d Value = _mm256_loadu_pd(Values + I);
+		__m256d Valid = _mm256_cmp_pd(Value, Value, _CMP_ORD_Q);
+		__m256d Delta = _mm256_and_pd(_mm256_sub_pd(Value, Means), Valid);
+		M2 = _mm256_add_pd(M2, _mm256_mul_pd(Delta, Delta));
+	}
+	double M2s[4];
+	_mm256_storeu_pd(M2s, M2);
+	return (M2s[0] + M2s[1]) + (M2s[2] + M2s[3]) + deviations_reals_scalar(Values + I, Count - I, Mean);
+}
+
+#endif
+
+static void (*aggregate_reals)(aggregate_block_t *Block, const double *Values, size_t Count) = aggregate_reals_scalar;
+static double (*deviations_reals)(const double *Values, size_t Count, double Mean) = deviations_reals_scalar;
+
+static pthread_once_t AggregateOnce = PTHREAD_ONCE_INIT;
+
+static void aggregate_init() {
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		aggregate_reals = aggregate_reals_avx2;
+		deviations_reals = deviations_reals_avx2;
+	} else {
+		aggregate_reals = aggregate_reals_sse2;
+		deviations_reals = deviations_reals_sse2;
+	}
+#endif
+}
+
+#define AGGREGATE_TYPED(TYPE, VALUES) { \
+	const TYPE *Values = (const TYPE *)(VALUES) + Block->Start; \
+	for (size_t I = 0; I < Count; ++I) { \
+		double Value = Values[I]; \
+		if (Value != Value) continue; \
+		++Total; \
+		Sum += Value; \
+		if (Min > Value) Min = Value; \
+		if (Max < Value) Max = Value; \
+	} \
+	break; \
+}
+
+#define DEVIATIONS_TYPED(TYPE, VALUES) { \
+	const TYPE *Values = (const TYPE *)(VALUES) + Block->Start; \
+	for (size_t I = 0; I < Count; ++I) { \
+		double Value = Values[I]; \
+		if (Value != Value) continue; \
+		M2 += (Value - Mean) * (Value - Mean); \
+	} \
+	break; \
+}
+
+static void aggregate_generic(aggregate_block_t *Block) {
+	column_t *Column = Block->Column;
+	size_t Count = Block->Count, Total = 0;
+	double Sum = 0, Min = INFINITY, Max = -INFINITY;
+	switch (Column->DataType) {
+	case COLUMN_INT32: AGGREGATE_TYPED(int32_t, Column->Int32s)
+	case COLUMN_INT64: AGGREGATE_TYPED(int64_t, Column->Int64s)
+	case COLUMN_FLOAT32: AGGREGATE_TYPED(float, Column->Float32s)
+	default: {
+		for (size_t I = Block->Start; I < Block->Start + Count; ++I) {
+			double Value = column_number_get(Column, I);
+			if (Value != Value) continue;
+			++Total;
+			Sum += Value;
+			if (Min > Value) Min = Value;
+			if (Max < Value) Max = Value;
+		}
+		break;
+	}
+	}
+	Block->Total = Total;
+	Block->Sum = Sum;
+	Block->Min = Min;
+	Block->Max = Max;
+	if (!Total) return;
+	double Mean = Sum / Total, M2 = 0;
+	switch (Column->DataType) {
+	case COLUMN_INT32: DEVIATIONS_TYPED(int32_t, Column->Int32s)
+	case COLUMN_INT64: DEVIATIONS_TYPED(int64_t, Column->Int64s)
+	case COLUMN_FLOAT32: DEVIATIONS_TYPED(float, Column->Float32s)
+	default: {
+		for (size_t I = Block->Start; I < Block->Start + Count; ++I) {
+			double Value = column_number_get(Column, I);
+			if (Value != Value) continue;
+			M2 += (Value - Mean) * (Value - Mean);
+		}
+		break;
+	}
+	}
+	Block->M2 = M2;
+}
+
+static inline void aggregate_bucket(aggregate_block_t *Block, double Value) {
+	int NumBuckets = Block->NumBuckets;
+	double Position = (Value - Block->HistogramMin) * Block->HistogramScale;
+	// also rejects NaN
+	if (!(Position >= 0 && Position <= NumBuckets)) return;
+	int Bucket = Position;
+	if (Bucket == NumBuckets) --Bucket;
+	++Block->Buckets[Bucket];
+}
+
+static inline double aggregate_position(aggregate_block_t *Block, double Value) {
+	return (Value - Block->HistogramMin) * Block->HistogramScale;
+}
+
+static void aggregate_zones(aggregate_block_t *Block) {
+	column_t *Column = Block->Column;
+	size_t Length = Column->Dataset->Length;
+	size_t Row = Block->Start, End = Block->Start + Block->Count;
+	while (Row < End) {
+		size_t ZoneStart = Row - Row % ZONE_SIZE;
+		size_t ZoneEnd = ZoneStart + ZONE_SIZE < Length ? ZoneStart + ZONE_SIZE : Length;
+		size_t Next = ZoneEnd < End ? ZoneEnd : End;
+		const zone_t *Zone = column_zone(Column, Row);
+		if (Zone && Row == ZoneStart && Next == ZoneEnd) {
+			// positions are monotonic in the value, so the zone bounds bound the buckets
+			if (Zone->Min > Zone->Max) goto skip;
+			double Low = aggregate_position(Block, Zone->Min), High = aggregate_position(Block, Zone->Max);
+			if (High < 0 || Low > Block->NumBuckets) goto skip;
+			if (Low >= 0 && High <= Block->NumBuckets) {
+				int First = Low, Last = High;
+				if (First == Block->NumBuckets) --First;
+				if (Last == Block->NumBuckets) --Last;
+				if (First == Last) {
+					Block->Buckets[First] += (ZoneEnd - ZoneStart) - Zone->Nulls;
+					goto skip;
+				}
+			}
+		}
+		for (size_t I = Row; I < Next; ++I) aggregate_bucket(Block, Column->Reals[I]);
+	skip:
+		Row = Next;
+	}
+}
+
+static void aggregate_fetch(column_t *Column, size_t Start, size_t Count, double *Values) {
+	union {
+		int32_t Int32s[AGGREGATE_FROZEN_BATCH];
+		int64_t Int64s[AGGREGATE_FROZEN_BATCH];
+		float Float32s[AGGREGATE_FROZEN_BATCH];
+	} Buffer;
+	switch (Column->DataType) {
+	case COLUMN_INT32:
+		column_int32_get_range(Column, Start, Count, Buffer.Int32s);
+		for (size_t I = 0; I < Count; ++I) Values[I] = Buffer.Int32s[I];
+		break;
+	case COLUMN_INT64:
+		column_int64_get_range(Column, Start, Count, Buffer.Int64s);
+		for (size_t I = 0; I < Count; ++I) Values[I] = Buffer.Int64s[I];
+		break;
+	case COLUMN_FLOAT32:
+		column_float32_get_range(Column, Start, Count, Buffer.Float32s);
+		for (size_t I = 0; I < Count; ++I) Values[I] = Buffer.Float32s[I];
+		break;
+	default:
+		column_real_get_range(Column, Start, Count, Values);
+		break;
+	}
+}
+
+static void aggregate_frozen(aggregate_block_t *Block) {
+	// frozen columns are decompressed through the getters a batch at a time
+	column_t *Column = Block->Column;
+	double Values[AGGREGATE_FROZEN_BATCH];
+	size_t End = Block->Start + Block->Count, Total = 0;
+	double Sum = 0, Min = INFINITY, Max = -INFINITY;
+	for (size_t Start = Block->Start; Start < End; Start += AGGREGATE_FROZEN_BATCH) {
+		size_t Count = End - Start < AGGREGATE_FROZEN_BATCH ? End - Start : AGGREGATE_FROZEN_BATCH;
+		aggregate_fetch(Column, Start, Count, Values);
+		for (size_t I = 0; I < Count; ++I) {
+			double Value = Values[I];
+			if (Block->Buckets) {
+				aggregate_bucket(Block, Value);
+				continue;
+			}
+			if (Value != Value) continue;
+			++Total;
+			Sum += Value;
+			if (Min > Value) Min = Value;
+			if (Max < Value) Max = Value;
+		}
+	}
+	if (Block->Buckets) return;
+	Block->Total = Total;
+	Block->Sum = Sum;
+	Block->Min = Min;
+	Block->Max = Max;
+	if (!Total) return;
+	double Mean = Sum / Total, M2 = 0;
+	for (size_t Start = Block->Start; Start < End; Start += AGGREGATE_FROZEN_BATCH) {
+		size_t Count = End - Start < AGGREGATE_FROZEN_BATCH ? End - Start : AGGREGATE_FROZEN_BATCH;
+		aggregate_fetch(Column, Start, Count, Values);
+		for (size_t I = 0; I < Count; ++I) {
+			double Value = Values[I];
+			if (Value != Value) continue;
+			M2 += (Value - Mean) * (Value - Mean);
+		}
+	}
+	Block->M2 = M2;
+}
+
+static void *aggregate_block(void *Data) {
+	aggregate_block_t *Block = (aggregate_block_t *)Data;
+	column_t *Column = Block->Column;
+	if (Column->Frozen) {
+		aggregate_frozen(Block);
+	} else if (Block->Buckets && Column->Zones) {
+		aggregate_zones(Block);
+	} else if (Block->Buckets) {
+		for (size_t I = Block->Start; I < Block->Start + Block->Count; ++I) {
+			aggregate_bucket(Block, (Column->DataType == COLUMN_REAL) ? Column->Reals[I] : column_number_get(Column, I));
+		}
+	} else if (Column->DataType == COLUMN_REAL) {
+		const double *Values = Column->Reals + Block->Start;
+		aggregate_reals(Block, Values, Block->Count);
+		Block->M2 = Block->Total ? deviations_reals(Values, Block->Count, Block->Sum / Block->Total) : 0;
+	} else {
+		aggregate_generic(Block);
+	}
+	return NULL;
+}
+
+static int aggregate_split(column_t *Column, size_t *Start, size_t *Count) {
+	size_t Length = Column->Dataset->Length;
+	if (*Start > Length) *Start = Length;
+	if (*Count > Length - *Start) *Count = Length - *Start;
+	// frozen columns share one small decompression cache, splitting would only thrash it
+	if (Column->Frozen) return 1;
+	long NumCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+	int NumBlocks = *Count / AGGREGATE_MIN_BLOCK_SIZE + 1;
+	if (NumBlocks > NumCPUs) NumBlocks = NumCPUs > 0 ? NumCPUs : 1;
+	return NumBlocks;
+}
+
+static void aggregate_run(aggregate_block_t *Blocks, int NumBlocks) {
+	pthread_t Threads[NumBlocks];
+	for (int I = 1; I < NumBlocks; ++I) pthread_create(&Threads[I], NULL, aggregate_block, Blocks + I);
+	aggregate_block(Blocks);
+	for (int I = 1; I < NumBlocks; ++I) pthread_join(Threads[I], NULL);
+}
+
+int column_aggregate(column_t *Column, size_t Start, size_t Count, column_stats_t *Stats) {
+	if (!column_is_numeric(Column)) return -1;
+	pthread_once(&AggregateOnce, aggregate_init);
+	int NumBlocks = aggregate_split(Column, &Start, &Count);
+	aggregate_block_t Blocks[NumBlocks];
+	memset(Blocks, 0, sizeof(Blocks));
+	size_t BlockSize = Count / NumBlocks;
+	for (int I = 0; I < NumBlocks; ++I) {
+		Blocks[I].Column = Column;
+		Blocks[I].Start = Start + I * BlockSize;
+		Blocks[I].Count = (I == NumBlocks - 1) ? Count - I * BlockSize : BlockSize;
+	}
+	aggregate_run(Blocks, NumBlocks);
+	size_t Total = 0;
+	double Sum = 0, Min = INFINITY, Max = -INFINITY, Mean = 0, M2 = 0;
+	for (int I = 0; I < NumBlocks; ++I) {
+		aggregate_block_t *Block = Blocks + I;
+		if (!Block->Total) continue;
+		double BlockMean = Block->Sum / Block->Total;
+		double Delta = BlockMean - Mean;
+		size_t Combined = Total + Block->Total;
+		M2 += Block->M2 + Delta * Delta * ((double)Total * Block->Total / Combined);
+		Mean += Delta * Block->Total / Combined;
+		Total = Combined;
+		Sum += Block->Sum;
+		if (Min > Block->Min) Min = Block->Min;
+		if (Max < Block->Max) Max = Block->Max;
+	}
+	Stats->Count = Total;
+	Stats->Sum = Sum;
+	Stats->Min = Total ? Min : NAN;
+	Stats->Max = Total ? Max : NAN;
+	Stats->Mean = Total ? Mean : NAN;
+	Stats->Variance = Total ? M2 / Total : NAN;
+	return 0;
+}
+
+int column_histogram(column_t *Column, size_t Start, size_t Count, double Min, double Max, int NumBuckets, uint64_t *Buckets) {
+	if (!column_is_numeric(Column) || NumBuckets <= 0 || !(Max > Min)) return -1;
+	int NumBlocks = aggregate_split(Column, &Start, &Count);
+	aggregate_block_t Blocks[NumBlocks];
+	memset(Blocks, 0, sizeof(Blocks));
+	size_t BlockSize = Count / NumBlocks;
+	for (int I = 0; I < NumBlocks; ++I) {
+		Blocks[I].Column = Column;
+		Blocks[I].Start = Start + I * BlockSize;
+		Blocks[I].Count = (I == NumBlocks - 1) ? Count - I * BlockSize : BlockSize;
+		Blocks[I].HistogramMin = Min;
+		Blocks[I].HistogramScale = NumBuckets / (Max - Min);
+		Blocks[I].NumBuckets = NumBuckets;
+		Blocks[I].Buckets = I ? calloc(NumBuckets, sizeof(uint64_t)) : Buckets;
+	}
+	memset(Buckets, 0, NumBuckets * sizeof(uint64_t));
+	aggregate_run(Blocks, NumBlocks);
+	for (int I = 1; I < NumBlocks; ++I) {
+		for (int J = 0; J < NumBuckets; ++J) Buckets[J] += Blocks[I].Buckets[J];
+		free(Blocks[I].Buckets);
+	}
+	return 0;
+}
@@ -0,0 +1,405 @@
+#include "minilang/minilang.h"
+#include "minilang/stringmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <czmq.h>
+#include <gc.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <jansson.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "whereami.h"
+#include "dataset.h"
+
+/*
+data-bench micro [-n rows] [-d datasets]
+	times the column and dataset primitives directly against a scratch directory
+data-bench macro [-p port] [-c clients] [-n requests] [-l rows] [-m mix] [-t threads] [-x]
+	starts a data-server (or connects to one with -x) and drives it over loopback,
+	with -x the server must already have a dataset 0 with a real column 0
+	mix is a list of name:weight pairs from read, binary, write, aggregate and query
+Every result is printed to stdout as one json object per line.
+*/
+
+static stringmap_t Globals[1] = {STRINGMAP_INIT};
+static const char *ScratchPath;
+static FILE *Output;
+
+static double bench_time() {
+	struct timespec Now[1];
+	clock_gettime(CLOCK_MONOTONIC, Now);
+	return Now->tv_sec + Now->tv_nsec / 1e9;
+}
+
+static void bench_report(json_t *Result) {
+	char *ResultString = json_dumps(Result, JSON_COMPACT);
+	fprintf(Output, "%s\n", ResultString);
+	fflush(Output);
+	free(ResultString);
+	json_decref(Result);
+}
+
+static void bench_result(const char *Name, size_t Count, double Seconds) {
+	bench_report(json_pack("{sssssIsfsf}",
+		"suite", "micro",
+		"name", Name,
+		"count", (json_int_t)Count,
+		"seconds", Seconds,
+		"rate", Seconds > 0 ? Count / Seconds : 0.0
+	));
+}
+
+static char *bench_path(const char *Format, int Index) {
+	char *Path;
+	asprintf(&Path, "%s/%s%d", ScratchPath, Format, Index);
+	return Path;
+}
+
+static void bench_strings(size_t Rows) {
+	dataset_t *Dataset = dataset_create(bench_path("strings", 0), "strings", Rows);
+	column_t *Column = dataset_column_open(Dataset, 0);
+	char Buffer[256];
+	memset(Buffer, 'x', sizeof(Buffer));
+	// growing values take nodes from the free list first and extend the mapping when it runs out
+	double Start = bench_time();
+	for (int Length = 4; Length <= 128; Length *= 2) {
+		for (size_t I = 0; I < Rows; ++I) column_string_set(Column, I, Buffer, Length);
+	}
+	bench_result("string_set_grow", 6 * Rows, bench_time() - Start);
+	Start = bench_time();
+	for (int Length = 128; Length >= 4; Length /= 2) {
+		for (size_t I = 0; I < Rows; ++I) column_string_set(Column, I, Buffer, Length);
+	}
+	bench_result("string_set_shrink", 6 * Rows, bench_time() - Start);
+	Start = bench_time();
+	for (size_t I = 0; I < Rows; ++I) column_string_set(Column, I, Buffer, (I * 7919) % 200);
+	bench_result("string_set_mixed", Rows, bench_time() - Start);
+	Start = bench_time();
+	for (size_t I = 0; I < Rows; ++I) column_string_get_value(Column, I, Buffer);
+	bench_result("string_get_value", Rows, bench_time() - Start);
+	column_compact(Column, STRING_PACKED);
+	Start = bench_time();
+	for (size_t I = 0; I < Rows; ++I) column_string_get_value(Column, I, Buffer);
+	bench_result("string_get_value_packed", Rows, bench_time() - Start);
+}
+
+static void bench_reals(size_t Rows) {
+	dataset_t *Dataset = dataset_create(bench_path("reals", 0), "reals", Rows);
+	column_t *Column = dataset_column_create(Dataset, "value", COLUMN_REAL);
+	double Start = bench_time();
+	for (size_t I = 0; I < Rows; ++I) column_real_set(Column, I, I * 0.5);
+	bench_result("real_set", Rows, bench_time() - Start);
+	volatile double Sum = 0;
+	Start = bench_time();
+	for (size_t I = 0; I < Rows; ++I) Sum += column_real_get(Column, I);
+	bench_result("real_get", Rows, bench_time() - Start);
+}
+
+static void bench_datasets(size_t Rows, int NumDatasets) {
+	double Start = bench_time();
+	dataset_create(bench_path("large", 0), "large", 16 * Rows);
+	bench_result("dataset_create", 16 * Rows, bench_time() - Start);
+	for (int I = 0; I < NumDatasets; ++I) {
+		dataset_t *Dataset = dataset_create(bench_path("open", I), "open", 1000);
+		dataset_column_create(Dataset, "value", COLUMN_REAL);
+		dataset_column_create(Dataset, "group", COLUMN_CATEGORY);
+	}
+	Start = bench_time();
+	for (int I = 0; I < NumDatasets; ++I) dataset_open(bench_path("open", I));
+	bench_result("dataset_open", NumDatasets, bench_time() - Start);
+	Start = bench_time();
+	for (int I = 0; I < NumDatasets; ++I) {
+		dataset_t *Dataset = dataset_open(bench_path("open", I));
+		for (int J = 0; J < 3; ++J) dataset_column_open(Dataset, J);
+	}
+	bench_result("dataset_open_columns", NumDatasets, bench_time() - Start);
+}
+
+static int bench_micro(int Argc, char **Argv) {
+	size_t Rows = 1000000;
+	int NumDatasets = 1000;
+	for (int I = 0; I < Argc; ++I) {
+		if (Argv[I][0] != '-') continue;
+		char Option = Argv[I][1];
+		const char *Value = Argv[I][2] ? Argv[I] + 2 : Argv[++I];
+		if (!Value) break;
+		if (Option == 'n') {
+			Rows = atol(Value);
+		} else if (Option == 'd') {
+			NumDatasets = atoi(Value);
+		}
+	}
+	dataset_init(Globals);
+	bench_strings(Rows);
+	bench_reals(Rows);
+	bench_datasets(Rows, NumDatasets);
+	return 0;
+}
+
+typedef enum {
+	REQUEST_READ,
+	REQUEST_BINARY,
+	REQUEST_WRITE,
+	REQUEST_AGGREGATE,
+	REQUEST_QUERY,
+	REQUEST_TYPES
+} request_type_t;
+
+static const char *RequestNames[REQUEST_TYPES] = {"read", "binary", "write", "aggregate", "query"};
+
+#define LATENCY_BUCKETS 40
+
+typedef struct bench_client_t {
+	const char *Endpoint;
+	int *Weights, TotalWeight, NumRequests;
+	size_t Rows;
+	uint64_t Counts[REQUEST_TYPES], Errors[REQUEST_TYPES], Max[REQUEST_TYPES];
+	uint64_t Latencies[REQUEST_TYPES][LATENCY_BUCKETS];
+	unsigned int Seed;
+} bench_client_t;
+
+static json_t *bench_call(zsock_t *Socket, const char *Method, json_t *Argument) {
+	static int Index = 0;
+	json_t *Request = json_pack("[iso]", __atomic_fetch_add(&Index, 1, __ATOMIC_RELAXED), Method, Argument);
+	char *RequestString = json_dumps(Request, JSON_COMPACT);
+	json_decref(Request);
+	zmsg_t *RequestMsg = zmsg_new();
+	zmsg_addstr(RequestMsg, RequestString);
+	free(RequestString);
+	zmsg_send(&RequestMsg, Socket);
+	zmsg_t *ResponseMsg = zmsg_recv(Socket);
+	if (!ResponseMsg) return NULL;
+	char *ResponseString = zmsg_popstr(ResponseMsg);
+	zmsg_destroy(&ResponseMsg);
+	json_t *Response = json_loads(ResponseString, 0, NULL);
+	free(ResponseString);
+	json_t *Result = json_incref(json_array_get(Response, 1));
+	json_decref(Response);
+	return Result;
+}
+
+static json_t *bench_request(bench_client_t *Client, request_type_t Type) {
+	size_t Start = rand_r(&Client->Seed) % Client->Rows;
+	switch (Type) {
+	case REQUEST_READ:
+		return json_pack("{sisisIsi}", "dataset", 0, "column", 0, "start", (json_int_t)Start, "count", 100);
+	case REQUEST_BINARY:
+		return json_pack("{sisisIsisb}", "dataset", 0, "column", 0, "start", (json_int_t)Start, "count", 10000, "binary", 1);
+	case REQUEST_WRITE: {
+		json_t *Values = json_array();
+		for (int I = 0; I < 10; ++I) json_array_append_new(Values, json_real(rand_r(&Client->Seed) % 1000));
+		if (Start + 10 > Client->Rows) Start = Client->Rows - 10;
+		return json_pack("{sisisIso}", "dataset", 0, "column", 0, "start", (json_int_t)Start, "values", Values);
+	}
+	case REQUEST_AGGREGATE:
+		return json_pack("{sisi}", "dataset", 0, "column", 0);
+	case REQUEST_QUERY:
+		return json_pack("{sis{sisssi}si}", "dataset", 0, "where", "column", 0, "op", "<", "value", rand_r(&Client->Seed) % 1000, "limit", 10);
+	default:
+		return NULL;
+	}
+}
+
+static const char *RequestMethods[REQUEST_TYPES] = {"column/read", "column/read", "column/write", "column/aggregate", "dataset/query"};
+
+static void *bench_client(void *Data) {
+	bench_client_t *Client = (bench_client_t *)Data;
+	zsock_t *Socket = zsock_new_dealer(Client->Endpoint);
+	for (int I = 0; I < Client->NumRequests; ++I) {
+		int Pick = rand_r(&Client->Seed) % Client->TotalWeight;
+		request_type_t Type = 0;
+		while (Pick >= Client->Weights[Type]) Pick -= Client->Weights[Type++];
+		json_t *Argument = bench_request(Client, Type);
+		int64_t Start = zclock_usecs();
+		json_t *Result = bench_call(Socket, RequestMethods[Type], Argument);
+		uint64_t Latency = zclock_usecs() - Start;
+		int Bucket = Latency ? 64 - __builtin_clzll(Latency) : 0;
+		if (Bucket >= LATENCY_BUCKETS) Bucket = LATENCY_BUCKETS - 1;
+		++Client->Counts[Type];
+		++Client->Latencies[Type][Bucket];
+		if (Client->Max[Type] < Latency) Client->Max[Type] = Latency;
+		if (!json_is_object(Result) || json_object_get(Result, "error")) ++Client->Errors[Type];
+		json_decref(Result);
+	}
+	zsock_destroy(&Socket);
+	return NULL;
+}
+
+static uint64_t bench_percentile(const uint64_t *Latencies, uint64_t Count, double Fraction) {
+	uint64_t Target = Count * Fraction, Seen = 0;
+	for (int I = 0; I < LATENCY_BUCKETS; ++I) {
+		Seen += Latencies[I];
+		if (Seen > Target) return (uint64_t)1 << I;
+	}
+	return (uint64_t)1 << (LATENCY_BUCKETS - 1);
+}
+
+static pid_t bench_spawn(int Port, int Threads) {
+	int Length = wai_getExecutablePath(NULL, 0, NULL);
+	char ServerPath[Length + 32];
+	int DirLength;
+	wai_getExecutablePath(ServerPath, Length, &DirLength);
+	strcpy(ServerPath + DirLength, "/data-server");
+	char PortString[16], ThreadsString[16];
+	sprintf(PortString, "%d", Port);
+	sprintf(ThreadsString, "%d", Threads);
+	char *DataPath = bench_path("server", 0);
+	mkdir(DataPath, 0777);
+	pid_t Pid = fork();
+	if (!Pid) {
+		execl(ServerPath, "data-server", "-p", PortString, "-t", ThreadsString, "-s", "manual", DataPath, NULL);
+		_exit(1);
+	}
+	return Pid;
+}
+
+static int bench_macro(int Argc, char **Argv) {
+	int Port = 9101, NumClients = 4, NumRequests = 10000, Threads = 4, Connect = 0;
+	size_t Rows = 1000000;
+	const char *Mix = "read:8,binary:1,write:2,aggregate:1,query:1";
+	for (int I = 0; I < Argc; ++I) {
+		if (Argv[I][0] != '-') continue;
+		char Option = Argv[I][1];
+		if (Option == 'x') {
+			Connect = 1;
+			continue;
+		}
+		const char *Value = Argv[I][2] ? Argv[I] + 2 : Argv[++I];
+		if (!Value) break;
+		switch (Option) {
+		case 'p': Port = atoi(Value); break;
+		case 'c': NumClients = atoi(Value); break;
+		case 'n': NumRequests = atoi(Value); break;
+		case 'l': Rows = atol(Value); break;
+		case 'm': Mix = Value; break;
+		case 't': Threads = atoi(Value); break;
+		}
+	}
+	int Weights[REQUEST_TYPES] = {0}, TotalWeight = 0;
+	char *MixCopy = strdup(Mix), *Save;
+	for (char *Item = strtok_r(MixCopy, ",", &Save); Item; Item = strtok_r(NULL, ",", &Save)) {
+		char *Colon = strchr(Item, ':');
+		int Weight = Colon ? atoi(Colon + 1) : 1;
+		if (Colon) *Colon = 0;
+		int Type = 0;
+		while (Type < REQUEST_TYPES && strcmp(Item, RequestNames[Type])) ++Type;
+		if (Type == REQUEST_TYPES) {
+			fprintf(stderr, "Error: unknown request type %s\n", Item);
+			return 1;
+		}
+		Weights[Type] = Weight;
+		TotalWeight += Weight;
+	}
+	free(MixCopy);
+	if (!TotalWeight) return 1;
+	char Endpoint[64];
+	sprintf(Endpoint, "tcp://127.0.0.1:%d", Port);
+	pid_t Pid = Connect ? 0 : bench_spawn(Port, Threads);
+	// a fresh socket for each attempt, so that late replies to earlier attempts are never read
+	json_t *Result = NULL;
+	for (int Retry = 0; Retry < 100 && !Result; ++Retry) {
+		zsock_t *Probe = zsock_new_dealer(Endpoint);
+		zsock_set_rcvtimeo(Probe, 100);
+		zsock_set_linger(Probe, 0);
+		Result = bench_call(Probe, "dataset/list", json_object());
+		zsock_destroy(&Probe);
+	}
+	if (!Result) {
+		fprintf(stderr, "Error: server not responding on %s\n", Endpoint);
+		if (Pid) kill(Pid, SIGTERM);
+		return 1;
+	}
+	json_decref(Result);
+	zsock_t *Socket = zsock_new_dealer(Endpoint);
+	if (!Connect) {
+		// the benchmark dataset is imported so that it has real, string and category columns
+		char *CsvPath = bench_path("import.csv", 0);
+		FILE *Csv = fopen(CsvPath, "w");
+		fprintf(Csv, "value,name,group\n");
+		for (size_t I = 0; I < Rows; ++I) fprintf(Csv, "%zu,name%zu,group%zu\n", (I * 7919) % 1000, I, I % 20);
+		fclose(Csv);
+		double Start = bench_time();
+		Result = bench_call(Socket, "dataset/import", json_pack("{sssss[iii]}", "name", "bench", "file", CsvPath, "types", COLUMN_REAL, COLUMN_STRING, COLUMN_CATEGORY));
+		bench_report(json_pack("{sssssIsfso}", "suite", "macro", "name", "import", "count", (json_int_t)Rows, "seconds", bench_time() - Start, "error", json_incref(json_object_get(Result, "error")) ?: json_null()));
+		json_decref(Result);
+	}
+	zsock_destroy(&Socket);
+	bench_client_t *Clients = calloc(NumClients, sizeof(bench_client_t));
+	pthread_t *ClientThreads = calloc(NumClients, sizeof(pthread_t));
+	double Start = bench_time();
+	for (int I = 0; I < NumClients; ++I) {
+		Clients[I].Endpoint = Endpoint;
+		Clients[I].Weights = Weights;
+		Clients[I].TotalWeight = TotalWeight;
+		Clients[I].NumRequests = NumRequests;
+		Clients[I].Rows = Rows;
+		Clients[I].Seed = I + 1;
+		pthread_create(ClientThreads + I, NULL, bench_client, Clients + I);
+	}
+	for (int I = 0; I < NumClients; ++I) pthread_join(ClientThreads[I], NULL);
+	double Seconds = bench_time() - Start;
+	uint64_t Total = 0;
+	for (int Type = 0; Type < REQUEST_TYPES; ++Type) {
+		uint64_t Count = 0, Errors = 0, Max = 0, Latencies[LATENCY_BUCKETS] = {0};
+		for (int I = 0; I < NumClients; ++I) {
+			Count += Clients[I].Counts[Type];
+			Errors += Clients[I].Errors[Type];
+			if (Max < Clients[I].Max[Type]) Max = Clients[I].Max[Type];
+			for (int J = 0; J < LATENCY_BUCKETS; ++J) Latencies[J] += Clients[I].Latencies[Type][J];
+		}
+		if (!Count) continue;
+		Total += Count;
+		bench_report(json_pack("{sssssIsIsIsIsI}",
+			"suite", "macro",
+			"name", RequestNames[Type],
+			"count", (json_int_t)Count,
+			"errors", (json_int_t)Errors,
+			"p50", (json_int_t)bench_percentile(Latencies, Count, 0.5),
+			"p99", (json_int_t)bench_percentile(Latencies, Count, 0.99),
+			"max", (json_int_t)Max
+		));
+	}
+	bench_report(json_pack("{sssssisIsfsf}",
+		"suite", "macro",
+		"name", "total",
+		"clients", NumClients,
+		"count", (json_int_t)Total,
+		"seconds", Seconds,
+		"rate", Seconds > 0 ? Total / Seconds : 0.0
+	));
+	if (Pid) {
+		kill(Pid, SIGTERM);
+		waitpid(Pid, NULL, 0);
+	}
+	return 0;
+}
+
+int main(int Argc, char **Argv) {
+	ml_init();
+	if (Argc < 2 || (strcmp(Argv[1], "micro") && strcmp(Argv[1], "macro"))) {
+		fprintf(stderr, "Usage: %s micro|macro [options]\n", Argv[0]);
+		return 1;
+	}
+	// results go to the original stdout, everything else printed there is discarded
+	Output = fdopen(dup(1), "w");
+	int Null = open("/dev/null", O_WRONLY);
+	dup2(Null, 1);
+	close(Null);
+	char Scratch[] = "/tmp/data-bench-XXXXXX";
+	ScratchPath = mkdtemp(Scratch);
+	if (!ScratchPath) {
+		fprintf(stderr, "Error: could not create scratch directory\n");
+		return 1;
+	}
+	int Status = strcmp(Argv[1], "micro") ? bench_macro(Argc - 2, Argv + 2) : bench_micro(Argc - 2, Argv + 2);
+	char *Command;
+	asprintf(&Command, "rm -rf %s", ScratchPath);
+	system(Command);
+	free(Command);
+	return Status;
+}
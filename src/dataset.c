@@ -1,62 +1,39 @@
 #include "dataset.h"
+#include "dataset_private.h"
 #include "minilang/minilang.h"
 #include "minilang/ml_macros.h"
 #include <gc.h>
-#include <stdint.h>
 #include <string.h>
+#include <math.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <dirent.h>
 
-/*
-string column structure (with N values):
-	header
-	entry * N
-	nodes * header->count
-*/
-
-typedef struct string_header_t {
-	int32_t FreeStart, FreeCount;
-} string_header_t;
-
-typedef struct string_entry_t {
-	int32_t Link, Length;
-} string_entry_t;
+static ml_type_t *DatasetT;
+static ml_type_t *ColumnT;
 
-typedef union string_node_t {
-	struct { int32_t Link; char Small[12]; };
-	char Large[16];
-} string_node_t;
+static sync_mode_t SyncMode = SYNC_WRITE;
+static int SyncInterval = 1000, SyncWrites = 10000;
+static size_t PageSize = 4096;
 
-struct column_t {
-	const ml_type_t *Type;
-	column_t *Next;
-	dataset_t *Dataset;
-	const char *Name;
-	union {
-		void *Map;
-		struct {
-			string_header_t Header;
-			string_entry_t Entries[];
-		} *Strings;
-		double *Reals;
-	};
-	size_t MapSize;
-	column_type_t DataType;
-	int Fd;
-};
+#define DATASET_MIN_CAPACITY 1024
 
-struct dataset_t {
-	const ml_type_t *Type;
-	const char *Path, *Name, *InfoFile;
-	column_t *Columns;
-	json_t *Info;
-	size_t Length;
-};
+void dataset_set_sync_mode(sync_mode_t Mode, int Interval, int Writes) {
+	SyncMode = Mode;
+	if (Interval > 0) SyncInterval = Interval;
+	if (Writes > 0) SyncWrites = Writes;
+}
 
-static ml_type_t *DatasetT;
-static ml_type_t *ColumnT;
+static int64_t sync_time() {
+	struct timespec Time[1];
+	clock_gettime(CLOCK_MONOTONIC_COARSE, Time);
+	return Time->tv_sec * 1000 + Time->tv_nsec / 1000000;
+}
 
 column_type_t column_get_type(column_t *Column) {
 	return Column->DataType;
@@ -66,13 +43,230 @@ size_t column_get_length(column_t *Column) {
 	return Column->Dataset->Length;
 }
 
+uint64_t column_get_version(column_t *Column) {
+	return __atomic_load_n(&Column->Version, __ATOMIC_ACQUIRE);
+}
+
+size_t column_get_index(column_t *Column) {
+	return Column->Index;
+}
+
+int column_is_frozen(column_t *Column) {
+	return Column->Frozen;
+}
+
+void column_get_counters(column_t *Column, column_counters_t *Counters) {
+	Counters->Reads = __atomic_load_n(&Column->Counters.Reads, __ATOMIC_RELAXED);
+	Counters->Writes = __atomic_load_n(&Column->Counters.Writes, __ATOMIC_RELAXED);
+	Counters->Remaps = __atomic_load_n(&Column->Counters.Remaps, __ATOMIC_RELAXED);
+	Counters->Syncs = __atomic_load_n(&Column->Counters.Syncs, __ATOMIC_RELAXED);
+}
+
+void column_lock_read(column_t *Column) {
+	pthread_rwlock_rdlock(Column->Lock);
+	column_count(&Column->Counters.Reads);
+}
+
+void column_lock_write(column_t *Column) {
+	pthread_rwlock_wrlock(Column->Lock);
+}
+
+void column_unlock(column_t *Column) {
+	pthread_rwlock_unlock(Column->Lock);
+}
+
+static column_t *column_new(dataset_t *Dataset) {
+	column_t *Column = new(column_t);
+	Column->Type = ColumnT;
+	Column->Dataset = Dataset;
+	pthread_rwlock_init(Column->Lock, NULL);
+	pthread_mutex_init(Column->SyncLock, NULL);
+	pthread_mutex_init(Column->PinLock, NULL);
+	return Column;
+}
+
+static void dirty_mark(dirty_t *Dirty, size_t MapSize, size_t Offset, size_t Size) {
+	size_t First = Offset / PageSize, Last = (Offset + Size - 1) / PageSize;
+	if (Last / 64 >= Dirty->Words) {
+		size_t Words = (MapSize + 64 * PageSize - 1) / (64 * PageSize);
+		if (Words <= Last / 64) Words = Last / 64 + 1;
+		Dirty->Bits = realloc(Dirty->Bits, Words * sizeof(uint64_t));
+		memset(Dirty->Bits + Dirty->Words, 0, (Words - Dirty->Words) * sizeof(uint64_t));
+		Dirty->Words = Words;
+	}
+	for (size_t Page = First; Page <= Last; ++Page) Dirty->Bits[Page / 64] |= 1ULL << (Page % 64);
+}
+
+static void dirty_sync(dirty_t *Dirty, void *Map, size_t MapSize, int Flags) {
+	uint64_t *Bits = Dirty->Bits;
+	size_t Words = Dirty->Words;
+	if (!Words) return;
+	size_t NumPages = (MapSize + PageSize - 1) / PageSize;
+	size_t Word = 0;
+	for (;;) {
+		while (Word < Words && !Bits[Word]) ++Word;
+		if (Word >= Words) break;
+		size_t First = Word * 64 + __builtin_ctzll(Bits[Word]);
+		uint64_t Clean = ~Bits[Word] & (~0ULL << (First % 64));
+		while (!Clean && ++Word < Words) Clean = ~Bits[Word];
+		size_t Last = Clean ? Word * 64 + __builtin_ctzll(Clean) : Words * 64;
+		if (Last > NumPages) Last = NumPages;
+		if (First < Last) msync((char *)Map + First * PageSize, (Last - First) * PageSize, Flags);
+		for (size_t Page = First; Page < Last; ++Page) Bits[Page / 64] &= ~(1ULL << (Page % 64));
+		if (Last >= NumPages) break;
+	}
+	memset(Bits, 0, Words * sizeof(uint64_t));
+}
+
+void column_dirty(column_t *Column, const void *Address, size_t Size) {
+	if (!Size) return;
+	const char *Heap = Column->Heap;
+	const char *IndexMap = (const char *)Column->IndexMap;
+	if (Heap && (const char *)Address >= Heap && (const char *)Address < Heap + Column->HeapSize) {
+		dirty_mark(Column->HeapDirty, Column->HeapSize, (const char *)Address - Heap, Size);
+	} else if (IndexMap && (const char *)Address >= IndexMap && (const char *)Address < IndexMap + Column->IndexSize) {
+		dirty_mark(Column->IndexDirty, Column->IndexSize, (const char *)Address - IndexMap, Size);
+	} else {
+		dirty_mark(Column->Dirty, Column->MapSize, (const char *)Address - (const char *)Column->Map, Size);
+	}
+}
+
+static int ChangeFeed = 0;
+
+void dataset_set_change_feed(int Enabled) {
+	ChangeFeed = Enabled;
+}
+
+static void column_changed(column_t *Column, size_t Start, size_t Count) {
+	// called with the column write locked after the values are written, ranges are merged until the feed takes them
+	if (!Count) return;
+	__atomic_fetch_add(&Column->Version, 1, __ATOMIC_RELEASE);
+	if (!ChangeFeed) return;
+	size_t End = Start + Count;
+	column_change_t *Changes = Column->Changes;
+	for (int I = Column->NumChanges; --I >= 0;) {
+		column_change_t *Change = Changes + I;
+		size_t ChangeEnd = Change->Start + Change->Count;
+		if (Start <= ChangeEnd && End >= Change->Start) {
+			if (Change->Start > Start) Change->Start = Start;
+			if (ChangeEnd < End) ChangeEnd = End;
+			Change->Count = ChangeEnd - Change->Start;
+			return;
+		}
+	}
+	if (!Column->NumChanges) {
+		dataset_t *Dataset = Column->Dataset;
+		pthread_mutex_lock(Dataset->ChangeLock);
+		Column->NextChanged = Dataset->Changed;
+		Dataset->Changed = Column;
+		pthread_mutex_unlock(Dataset->ChangeLock);
+	} else if (Column->NumChanges == COLUMN_MAX_CHANGES) {
+		// too many separate ranges, fall back to a single covering range
+		size_t First = Start, Last = End;
+		for (int I = 0; I < COLUMN_MAX_CHANGES; ++I) {
+			if (First > Changes[I].Start) First = Changes[I].Start;
+			if (Last < Changes[I].Start + Changes[I].Count) Last = Changes[I].Start + Changes[I].Count;
+		}
+		Changes[0].Start = First;
+		Changes[0].Count = Last - First;
+		Column->NumChanges = 1;
+		return;
+	}
+	Changes[Column->NumChanges].Start = Start;
+	Changes[Column->NumChanges].Count = Count;
+	++Column->NumChanges;
+}
+
+column_t *dataset_take_changed(dataset_t *Dataset) {
+	pthread_mutex_lock(Dataset->ChangeLock);
+	column_t *Column = Dataset->Changed;
+	if (Column) Dataset->Changed = Column->NextChanged;
+	pthread_mutex_unlock(Dataset->ChangeLock);
+	return Column;
+}
+
+int column_take_changes(column_t *Column, column_change_t *Changes) {
+	int NumChanges = Column->NumChanges;
+	memcpy(Changes, Column->Changes, NumChanges * sizeof(column_change_t));
+	Column->NumChanges = 0;
+	return NumChanges;
+}
+
+static void column_sync(column_t *Column, int Flags) {
+	dirty_sync(Column->Dirty, Column->Map, Column->MapSize, Flags);
+	if (Column->Heap) dirty_sync(Column->HeapDirty, Column->Heap, Column->HeapSize, Flags);
+	if (Column->IndexMap) dirty_sync(Column->IndexDirty, Column->IndexMap, Column->IndexSize, Flags);
+	if (Column->Dictionary && Flags == MS_SYNC) fdatasync(Column->Dictionary->Fd);
+	if (Flags == MS_SYNC) column_zones_sync(Column);
+	Column->Writes = 0;
+	Column->SyncTime = sync_time();
+	column_count(&Column->Counters.Syncs);
+}
+
+void column_commit(column_t *Column) {
+	column_count(&Column->Counters.Writes);
+	switch (SyncMode) {
+	case SYNC_WRITE:
+		column_sync(Column, MS_ASYNC);
+		break;
+	case SYNC_PERIODIC:
+		if (++Column->Writes >= SyncWrites || sync_time() - Column->SyncTime >= SyncInterval) {
+			column_sync(Column, MS_SYNC);
+		}
+		break;
+	case SYNC_MANUAL:
+		break;
+	}
+}
+
+void column_flush(column_t *Column) {
+	if (!__atomic_load_n(&Column->Mapped, __ATOMIC_ACQUIRE)) return;
+	pthread_rwlock_rdlock(Column->Lock);
+	pthread_mutex_lock(Column->SyncLock);
+	column_sync(Column, MS_SYNC);
+	pthread_mutex_unlock(Column->SyncLock);
+	pthread_rwlock_unlock(Column->Lock);
+}
+
 size_t column_string_get_length(column_t *Column, size_t Index) {
 	if (Index >= Column->Dataset->Length) return 0;
+	if (Column->Frozen) return frozen_string_length(Column, Index);
+	if (Column->DataType == COLUMN_CATEGORY) return Column->Dictionary->Lengths[category_get(Column, Index)];
+	if (Column->Format == STRING_PACKED) return Column->Packed->Entries[Index].Length;
 	return Column->Strings->Entries[Index].Length;
 }
 
+string_format_t column_string_get_format(column_t *Column) {
+	return Column->Format;
+}
+
+const char *column_string_get_pointer(column_t *Column, size_t Index) {
+	if (Index >= Column->Dataset->Length) return NULL;
+	if (Column->DataType == COLUMN_CATEGORY) {
+		uint32_t Code = Column->Frozen ? frozen_code(Column, Index) : category_get(Column, Index);
+		return Column->Dictionary->Values[Code];
+	}
+	if (Column->Frozen) return NULL;
+	if (Column->Format != STRING_PACKED) return NULL;
+	return Column->Heap + Column->Packed->Entries[Index].Offset;
+}
+
 void column_string_get_value(column_t *Column, size_t Index, char *Buffer) {
 	if (Index >= Column->Dataset->Length) return;
+	if (Column->Frozen) {
+		frozen_string_value(Column, Index, Buffer);
+		return;
+	}
+	if (Column->DataType == COLUMN_CATEGORY) {
+		uint32_t Code = category_get(Column, Index);
+		memcpy(Buffer, Column->Dictionary->Values[Code], Column->Dictionary->Lengths[Code]);
+		return;
+	}
+	if (Column->Format == STRING_PACKED) {
+		packed_entry_t *Entry = Column->Packed->Entries + Index;
+		memcpy(Buffer, Column->Heap + Entry->Offset, Entry->Length);
+		return;
+	}
 	string_node_t *Nodes = (string_node_t *)(Column->Strings->Entries + Column->Dataset->Length);
 	int32_t Length = Column->Strings->Entries[Index].Length;
 	int32_t Link = Column->Strings->Entries[Index].Link;
@@ -86,11 +280,11 @@ void column_string_get_value(column_t *Column, size_t Index, char *Buffer) {
 	memcpy(Buffer, Node->Large, Length);
 }
 
-void column_string_set(column_t *Column, size_t Index, const char *Value, int Length) {
-	if (Index >= Column->Dataset->Length) return;
+static void column_linked_update(column_t *Column, size_t Index, const char *Value, int Length) {
 	string_node_t *Nodes = (string_node_t *)(Column->Strings->Entries + Column->Dataset->Length);
 	int OldLength = Column->Strings->Entries[Index].Length;
 	Column->Strings->Entries[Index].Length = Length;
+	column_dirty(Column, Column->Strings->Entries + Index, sizeof(string_entry_t));
 	int NumBlocksOld = 1 + (OldLength - 5) / 12;
 	if (NumBlocksOld < 1) NumBlocksOld = 1;
 	int NumBlocksNew = 1 + (Length - 5) / 12;
@@ -99,6 +293,7 @@ void column_string_set(column_t *Column, size_t Index, const char *Value, int Le
 		string_node_t *Node = Nodes + Column->Strings->Entries[Index].Link;
 		while (Length > 16) {
 			memcpy(Node->Small, Value, 12);
+			column_dirty(Column, Node, sizeof(string_node_t));
 			Value += 12;
 			Length -= 12;
 			Node = Nodes + Node->Link;
@@ -106,11 +301,14 @@ void column_string_set(column_t *Column, size_t Index, const char *Value, int Le
 		int32_t FreeStart = Node->Link;
 		string_node_t *FreeEnd = Nodes + FreeStart;
 		memcpy(Node->Large, Value, Length);
+		column_dirty(Column, Node, sizeof(string_node_t));
 		int FreeCount = NumBlocksOld - NumBlocksNew;
 		Column->Strings->Header.FreeCount += FreeCount;
 		while (--FreeCount > 0) FreeEnd = Nodes + FreeEnd->Link;
 		FreeEnd->Link = Column->Strings->Header.FreeStart;
+		column_dirty(Column, FreeEnd, sizeof(string_node_t));
 		Column->Strings->Header.FreeStart = FreeStart;
+		column_dirty(Column, &Column->Strings->Header, sizeof(string_header_t));
 	} else if (NumBlocksOld < NumBlocksNew) {
 		int UseCount = NumBlocksNew - NumBlocksOld;
 		int FreeCount = Column->Strings->Header.FreeCount;
@@ -119,16 +317,19 @@ void column_string_set(column_t *Column, size_t Index, const char *Value, int Le
 			size_t MapSize = Column->MapSize + Shortfall * sizeof(string_node_t);
 			ftruncate(Column->Fd, MapSize);
 			Column->Map = mremap(Column->Map, Column->MapSize, MapSize, MREMAP_MAYMOVE);
+			column_count(&Column->Counters.Remaps);
 			Nodes = (string_node_t *)(Column->Strings->Entries + Column->Dataset->Length);
 			int32_t FreeEnd;
 			if (FreeCount > 0) {
 				FreeEnd = Column->Strings->Header.FreeStart;
 				while (--FreeCount > 0) FreeEnd = Nodes[FreeEnd].Link;
+				column_dirty(Column, Nodes + FreeEnd, sizeof(string_node_t));
 				FreeEnd = Nodes[FreeEnd].Link = (Column->MapSize - sizeof(string_header_t) - Column->Dataset->Length * sizeof(string_entry_t)) / sizeof(string_node_t);
 			} else {
 				FreeEnd = (Column->MapSize - sizeof(string_header_t) - Column->Dataset->Length * sizeof(string_entry_t)) / sizeof(string_node_t);
 				Column->Strings->Header.FreeStart = FreeEnd;
 			}
+			column_dirty(Column, Nodes + FreeEnd, Shortfall * sizeof(string_node_t));
 			while (--Shortfall > 0) FreeEnd = Nodes[FreeEnd].Link = FreeEnd + 1;
 			Column->MapSize = MapSize;
 			Column->Strings->Header.FreeCount = 0;
@@ -138,6 +339,7 @@ void column_string_set(column_t *Column, size_t Index, const char *Value, int Le
 		string_node_t *Node = Nodes + Column->Strings->Entries[Index].Link;
 		while (--NumBlocksOld > 0) {
 			memcpy(Node->Small, Value, 12);
+			column_dirty(Column, Node, sizeof(string_node_t));
 			Value += 12;
 			Length -= 12;
 			Node = Nodes + Node->Link;
@@ -145,44 +347,566 @@ void column_string_set(column_t *Column, size_t Index, const char *Value, int Le
 		Node->Link = Column->Strings->Header.FreeStart;
 		while (Length > 16) {
 			memcpy(Node->Small, Value, 12);
+			column_dirty(Column, Node, sizeof(string_node_t));
 			Value += 12;
 			Length -= 12;
 			Node = Nodes + Node->Link;
 		}
 		Column->Strings->Header.FreeStart = Node->Link;
 		memcpy(Node->Large, Value, Length);
+		column_dirty(Column, Node, sizeof(string_node_t));
+		column_dirty(Column, &Column->Strings->Header, sizeof(string_header_t));
 	} else {
 		string_node_t *Node = Nodes + Column->Strings->Entries[Index].Link;
 		while (Length > 16) {
 			memcpy(Node->Small, Value, 12);
+			column_dirty(Column, Node, sizeof(string_node_t));
 			Value += 12;
 			Length -= 12;
 			Node = Nodes + Node->Link;
 		}
 		memcpy(Node->Large, Value, Length);
+		column_dirty(Column, Node, sizeof(string_node_t));
+	}
+}
+
+static void column_heap_reserve(column_t *Column, size_t Size) {
+	size_t Required = Column->Packed->Header.HeapUsed + Size;
+	if (Required <= Column->HeapSize) return;
+	size_t HeapSize = 2 * Column->HeapSize;
+	if (HeapSize < Required) HeapSize = Required;
+	ftruncate(Column->HeapFd, HeapSize);
+	Column->Heap = mremap(Column->Heap, Column->HeapSize, HeapSize, MREMAP_MAYMOVE);
+	Column->HeapSize = HeapSize;
+	column_count(&Column->Counters.Remaps);
+}
+
+static void column_packed_update(column_t *Column, size_t Index, const char *Value, int Length) {
+	packed_entry_t *Entry = Column->Packed->Entries + Index;
+	if (Length > Entry->Capacity) {
+		column_heap_reserve(Column, Length);
+		Column->Packed->Header.Garbage += Entry->Capacity;
+		Entry->Offset = Column->Packed->Header.HeapUsed;
+		Entry->Capacity = Length;
+		Column->Packed->Header.HeapUsed += Length;
+		column_dirty(Column, &Column->Packed->Header, sizeof(packed_header_t));
+	}
+	memcpy(Column->Heap + Entry->Offset, Value, Length);
+	column_dirty(Column, Column->Heap + Entry->Offset, Length);
+	Entry->Length = Length;
+	column_dirty(Column, Entry, sizeof(packed_entry_t));
+}
+
+static void column_string_update(column_t *Column, size_t Index, const char *Value, int Length) {
+	if (Column->DataType == COLUMN_CATEGORY) {
+		category_put(Column, Index, category_code(Column, Value, Length));
+		return;
+	}
+	uint32_t OldHash = (Column->IndexType == INDEX_HASH) ? hash_row(Column, Index) : 0;
+	zones_string_update(Column, Index, Value, Length);
+	if (Column->Format == STRING_PACKED) {
+		column_packed_update(Column, Index, Value, Length);
+	} else {
+		column_linked_update(Column, Index, Value, Length);
+	}
+	if (Column->IndexType == INDEX_HASH) hash_update(Column, Index, OldHash, Value, Length);
+}
+
+void column_string_set(column_t *Column, size_t Index, const char *Value, int Length) {
+	if (Index >= Column->Dataset->Length || Column->Frozen) return;
+	column_string_update(Column, Index, Value, Length);
+	column_changed(Column, Index, 1);
+	column_commit(Column);
+}
+
+void column_string_set_range(column_t *Column, size_t Start, size_t Count, const char **Values, const int *Lengths) {
+	size_t Length = Column->Dataset->Length;
+	if (Start >= Length || Column->Frozen) return;
+	if (Count > Length - Start) Count = Length - Start;
+	for (size_t I = 0; I < Count; ++I) column_string_update(Column, Start + I, Values[I], Lengths[I]);
+	column_changed(Column, Start, Count);
+	column_commit(Column);
+}
+
+void *column_map_file(const char *FileName, size_t Size, int *Fd) {
+	*Fd = open(FileName, O_RDWR | O_CREAT | O_TRUNC, 0777);
+	if (*Fd < 0) return NULL;
+	if (ftruncate(*Fd, Size)) {
+		close(*Fd);
+		return NULL;
+	}
+	void *Map = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, *Fd, 0);
+	if (Map == MAP_FAILED) {
+		close(*Fd);
+		return NULL;
+	}
+	return Map;
+}
+
+static int column_rewrite(column_t *Column, string_format_t Format) {
+	dataset_t *Dataset = Column->Dataset;
+	size_t Length = Dataset->Length, Total = 0, MaxLength = 0;
+	for (size_t I = 0; I < Length; ++I) {
+		size_t ValueLength = column_string_get_length(Column, I);
+		if (MaxLength < ValueLength) MaxLength = ValueLength;
+		Total += (Format == STRING_PACKED) ? ValueLength : string_block_count(ValueLength);
+	}
+	if (Format == STRING_LINKED && Total > INT32_MAX) return -1;
+	char FileName[strlen(Dataset->Path) + 32], TempName[strlen(Dataset->Path) + 32];
+	char HeapName[strlen(Dataset->Path) + 32], TempHeapName[strlen(Dataset->Path) + 32];
+	sprintf(FileName, "%s/%ld", Dataset->Path, Column->Index);
+	sprintf(TempName, "%s/%ld.tmp", Dataset->Path, Column->Index);
+	sprintf(HeapName, "%s/%ld.heap", Dataset->Path, Column->Index);
+	sprintf(TempHeapName, "%s/%ld.heap.tmp", Dataset->Path, Column->Index);
+	int Fd, HeapFd = -1;
+	void *Map;
+	char *Heap = NULL;
+	size_t MapSize, HeapSize = 0;
+	if (Format == STRING_PACKED) {
+		MapSize = sizeof(packed_header_t) + Dataset->Capacity * sizeof(packed_entry_t);
+		HeapSize = Total > PageSize ? Total : PageSize;
+		Heap = column_map_file(TempHeapName, HeapSize, &HeapFd);
+		if (!Heap) return -1;
+		Map = column_map_file(TempName, MapSize, &Fd);
+		if (!Map) {
+			munmap(Heap, HeapSize);
+			close(HeapFd);
+			unlink(TempHeapName);
+			return -1;
+		}
+		packed_header_t *Header = (packed_header_t *)Map;
+		packed_entry_t *Entries = (packed_entry_t *)(Header + 1);
+		size_t Offset = 0;
+		for (size_t I = 0; I < Length; ++I) {
+			size_t ValueLength = column_string_get_length(Column, I);
+			Entries[I].Offset = Offset;
+			Entries[I].Length = Entries[I].Capacity = ValueLength;
+			column_string_get_value(Column, I, Heap + Offset);
+			Offset += ValueLength;
+		}
+		Header->HeapUsed = Offset;
+		Header->Garbage = 0;
+		msync(Heap, HeapSize, MS_SYNC);
+	} else {
+		MapSize = sizeof(string_header_t) + Length * sizeof(string_entry_t) + Total * sizeof(string_node_t);
+		Map = column_map_file(TempName, MapSize, &Fd);
+		if (!Map) return -1;
+		string_header_t *Header = (string_header_t *)Map;
+		string_entry_t *Entries = (string_entry_t *)(Header + 1);
+		string_node_t *Nodes = (string_node_t *)(Entries + Length);
+		char *Buffer = malloc(MaxLength + 1);
+		size_t Next = 0;
+		for (size_t I = 0; I < Length; ++I) {
+			size_t ValueLength = column_string_get_length(Column, I);
+			column_string_get_value(Column, I, Buffer);
+			string_fill(Entries + I, Nodes, &Next, Buffer, ValueLength);
+		}
+		free(Buffer);
+		Header->FreeStart = Header->FreeCount = 0;
+	}
+	msync(Map, MapSize, MS_SYNC);
+	if (Format == STRING_PACKED) rename(TempHeapName, HeapName);
+	rename(TempName, FileName);
+	if (Format == STRING_LINKED) unlink(HeapName);
+	munmap(Column->Map, Column->MapSize);
+	close(Column->Fd);
+	if (Column->Heap) {
+		munmap(Column->Heap, Column->HeapSize);
+		close(Column->HeapFd);
+	}
+	Column->Map = Map;
+	Column->MapSize = MapSize;
+	Column->Fd = Fd;
+	Column->Heap = Heap;
+	Column->HeapSize = HeapSize;
+	Column->HeapFd = HeapFd;
+	Column->Format = Format;
+	Column->Dirty->Words = Column->HeapDirty->Words = 0;
+	column_count(&Column->Counters.Remaps);
+	column_advise(Column);
+	json_t *ColumnJson = json_array_get(json_object_get(Dataset->Info, "columns"), Column->Index);
+	json_object_set_new(ColumnJson, "format", json_integer(Format));
+	return 0;
+}
+
+int column_compact(column_t *Column, string_format_t Format) {
+	if (Column->DataType != COLUMN_STRING || Column->Frozen) return -1;
+	dataset_t *Dataset = Column->Dataset;
+	pthread_mutex_lock(Dataset->Lock);
+	int Status = column_rewrite(Column, Format);
+	if (!Status) json_dump_file(Dataset->Info, Dataset->InfoFile, 0);
+	pthread_mutex_unlock(Dataset->Lock);
+	return Status;
+}
+
+static void *codes_base(column_t *Column) {
+	return Column->Categories->Codes;
+}
+
+static inline uint32_t codes_get(const void *Codes, int Width, size_t Index) {
+	switch (Width) {
+	case 1: return ((const uint8_t *)Codes)[Index];
+	case 2: return ((const uint16_t *)Codes)[Index];
+	default: return ((const uint32_t *)Codes)[Index];
+	}
+}
+
+static inline void codes_put(void *Codes, int Width, size_t Index, uint32_t Code) {
+	switch (Width) {
+	case 1: ((uint8_t *)Codes)[Index] = Code; break;
+	case 2: ((uint16_t *)Codes)[Index] = Code; break;
+	default: ((uint32_t *)Codes)[Index] = Code; break;
+	}
+}
+
+void category_put(column_t *Column, size_t Index, uint32_t Code) {
+	int Width = Column->Categories->Header.Width;
+	codes_put(codes_base(Column), Width, Index, Code);
+	column_dirty(Column, Column->Categories->Codes + Index * Width, Width);
+}
+
+void category_resize(column_t *Column, int Width) {
+	int OldWidth = Column->Categories->Header.Width;
+	if (Width == OldWidth) return;
+	size_t Length = Column->Dataset->Capacity;
+	size_t MapSize = sizeof(category_header_t) + Length * Width;
+	if (Width > OldWidth) {
+		ftruncate(Column->Fd, MapSize);
+		Column->Map = mremap(Column->Map, Column->MapSize, MapSize, MREMAP_MAYMOVE);
+		void *Codes = codes_base(Column);
+		for (size_t I = Length; I-- > 0;) codes_put(Codes, Width, I, codes_get(Codes, OldWidth, I));
+	} else {
+		void *Codes = codes_base(Column);
+		for (size_t I = 0; I < Length; ++I) codes_put(Codes, Width, I, codes_get(Codes, OldWidth, I));
+		Column->Map = mremap(Column->Map, Column->MapSize, MapSize, MREMAP_MAYMOVE);
+		ftruncate(Column->Fd, MapSize);
+	}
+	Column->MapSize = MapSize;
+	column_count(&Column->Counters.Remaps);
+	Column->Categories->Header.Width = Width;
+	column_dirty(Column, Column->Map, MapSize);
+}
+
+static uint32_t *category_slot(category_t *Dictionary, const char *Value, uint32_t Length) {
+	size_t Mask = Dictionary->Mask;
+	for (size_t Index = hash_string(Value, Length) & Mask;; Index = (Index + 1) & Mask) {
+		uint32_t *Slot = Dictionary->Slots + Index;
+		if (!*Slot) return Slot;
+		uint32_t Code = *Slot - 1;
+		if (Dictionary->Lengths[Code] == Length && !memcmp(Dictionary->Values[Code], Value, Length)) return Slot;
+	}
+}
+
+static int64_t category_find(category_t *Dictionary, const char *Value, uint32_t Length) {
+	if (!Dictionary->Slots) return -1;
+	return (int64_t)*category_slot(Dictionary, Value, Length) - 1;
+}
+
+static void category_rehash(category_t *Dictionary) {
+	size_t Size = Dictionary->Slots ? 2 * (Dictionary->Mask + 1) : 128;
+	Dictionary->Slots = GC_malloc_atomic(Size * sizeof(uint32_t));
+	memset(Dictionary->Slots, 0, Size * sizeof(uint32_t));
+	Dictionary->Mask = Size - 1;
+	for (uint32_t Code = 0; Code < Dictionary->Count; ++Code) {
+		*category_slot(Dictionary, Dictionary->Values[Code], Dictionary->Lengths[Code]) = Code + 1;
+	}
+}
+
+static void category_add(category_t *Dictionary, const char *Value, uint32_t Length) {
+	if (2 * (Dictionary->Count + 1) > Dictionary->Mask + 1) category_rehash(Dictionary);
+	if (Dictionary->Count == Dictionary->Size) {
+		Dictionary->Size = Dictionary->Size ? 2 * Dictionary->Size : 64;
+		Dictionary->Values = GC_realloc(Dictionary->Values, Dictionary->Size * sizeof(const char *));
+		Dictionary->Lengths = GC_realloc(Dictionary->Lengths, Dictionary->Size * sizeof(uint32_t));
+	}
+	char *Copy = GC_malloc_atomic(Length + 1);
+	memcpy(Copy, Value, Length);
+	Copy[Length] = 0;
+	Dictionary->Values[Dictionary->Count] = Copy;
+	Dictionary->Lengths[Dictionary->Count] = Length;
+	*category_slot(Dictionary, Copy, Length) = Dictionary->Count + 1;
+	++Dictionary->Count;
+}
+
+static category_t *category_open(const char *FileName, size_t Count) {
+	category_t *Dictionary = new(category_t);
+	Dictionary->Fd = open(FileName, O_RDWR | O_CREAT | O_APPEND, 0777);
+	struct stat Stat[1];
+	fstat(Dictionary->Fd, Stat);
+	size_t Size = Stat->st_size, Offset = 0;
+	char *Buffer = malloc(Size);
+	pread(Dictionary->Fd, Buffer, Size, 0);
+	while (Dictionary->Count < Count && Offset + sizeof(uint32_t) <= Size) {
+		uint32_t Length;
+		memcpy(&Length, Buffer + Offset, sizeof(uint32_t));
+		if (Offset + sizeof(uint32_t) + Length > Size) break;
+		category_add(Dictionary, Buffer + Offset + sizeof(uint32_t), Length);
+		Offset += sizeof(uint32_t) + Length;
+	}
+	free(Buffer);
+	if (Offset < Size) ftruncate(Dictionary->Fd, Offset);
+	return Dictionary;
+}
+
+uint32_t category_code(column_t *Column, const char *Value, int Length) {
+	category_t *Dictionary = Column->Dictionary;
+	int64_t Existing = category_find(Dictionary, Value, Length);
+	if (Existing >= 0) return Existing;
+	uint32_t Code = Dictionary->Count;
+	int Width = Column->Categories->Header.Width;
+	if (Width < 4 && Code >= (1 << (8 * Width))) category_resize(Column, 2 * Width);
+	uint32_t Length32 = Length;
+	struct iovec Parts[2] = {{&Length32, sizeof(uint32_t)}, {(void *)Value, Length}};
+	writev(Dictionary->Fd, Parts, 2);
+	category_add(Dictionary, Value, Length);
+	Column->Categories->Header.Count = Dictionary->Count;
+	column_dirty(Column, &Column->Categories->Header, sizeof(category_header_t));
+	return Code;
+}
+
+size_t column_category_count(column_t *Column) {
+	return Column->Dictionary->Count;
+}
+
+const char *column_category_value(column_t *Column, uint32_t Code, size_t *Length) {
+	if (Code >= Column->Dictionary->Count) return NULL;
+	if (Length) *Length = Column->Dictionary->Lengths[Code];
+	return Column->Dictionary->Values[Code];
+}
+
+int64_t column_category_lookup(column_t *Column, const char *Value, int Length) {
+	return category_find(Column->Dictionary, Value, Length);
+}
+
+uint32_t column_category_get_code(column_t *Column, size_t Index) {
+	if (Column->Frozen) return frozen_code(Column, Index);
+	return category_get(Column, Index);
+}
+
+void column_category_counts(column_t *Column, size_t Start, size_t Count, uint64_t *Counts) {
+	size_t Length = Column->Dataset->Length;
+	if (Start >= Length) return;
+	if (Count > Length - Start) Count = Length - Start;
+	if (Column->Frozen) {
+		frozen_category_counts(Column, Start, Count, Counts);
+		return;
+	}
+	const void *Codes = codes_base(Column);
+	switch (Column->Categories->Header.Width) {
+	case 1:
+		for (size_t I = Start; I < Start + Count; ++I) ++Counts[((const uint8_t *)Codes)[I]];
+		break;
+	case 2:
+		for (size_t I = Start; I < Start + Count; ++I) ++Counts[((const uint16_t *)Codes)[I]];
+		break;
+	default:
+		for (size_t I = Start; I < Start + Count; ++I) ++Counts[((const uint32_t *)Codes)[I]];
+		break;
 	}
-	msync(Column->Map, Column->MapSize, MS_ASYNC);
 }
 
 double column_real_get(column_t *Column, size_t Index) {
+	if (Column->Frozen) {
+		double Value = NAN;
+		frozen_read(Column, Index, 1, &Value);
+		return Value;
+	}
 	return Column->Reals[Index];
 }
 
 void column_real_set(column_t *Column, size_t Index, double Value) {
-	Column->Reals[Index] = Value;
-	msync(Column->Map, Column->MapSize, MS_ASYNC);
+	if (Column->Frozen) return;
+	zones_real_update(Column, Index, 1, &Value);
+	if (Column->Sorted) sorted_update(Column, Index, Value); else Column->Reals[Index] = Value;
+	column_dirty(Column, Column->Reals + Index, sizeof(double));
+	column_changed(Column, Index, 1);
+	column_commit(Column);
 }
 
-dataset_t *dataset_create(const char *Path, const char *Name, size_t Length) {
-	printf("Creating dataset: %s with %d entries at %s\n", Name, Length, Path);
+size_t column_real_get_range(column_t *Column, size_t Start, size_t Count, double *Values) {
+	size_t Length = Column->Dataset->Length;
+	if (Start >= Length) return 0;
+	if (Count > Length - Start) Count = Length - Start;
+	if (Column->Frozen) return frozen_read(Column, Start, Count, Values);
+	memcpy(Values, Column->Reals + Start, Count * sizeof(double));
+	return Count;
+}
+
+size_t column_real_set_range(column_t *Column, size_t Start, size_t Count, const double *Values) {
+	size_t Length = Column->Dataset->Length;
+	if (Start >= Length || Column->Frozen) return 0;
+	if (Count > Length - Start) Count = Length - Start;
+	zones_real_update(Column, Start, Count, Values);
+	if (Column->Sorted) {
+		sorted_update_range(Column, Start, Count, Values);
+	} else {
+		memcpy(Column->Reals + Start, Values, Count * sizeof(double));
+	}
+	column_dirty(Column, Column->Reals + Start, Count * sizeof(double));
+	column_changed(Column, Start, Count);
+	column_commit(Column);
+	return Count;
+}
+
+#define NUMERIC_ACCESSORS(NAME, TYPE, FIELD) \
+TYPE column_ ## NAME ## _get(column_t *Column, size_t Index) { \
+	if (Column->Frozen) { \
+		TYPE Value = 0; \
+		frozen_read(Column, Index, 1, &Value); \
+		return Value; \
+	} \
+	return Column->FIELD[Index]; \
+} \
+\
+void column_ ## NAME ## _set(column_t *Column, size_t Index, TYPE Value) { \
+	if (Column->Frozen) return; \
+	Column->FIELD[Index] = Value; \
+	column_dirty(Column, Column->FIELD + Index, sizeof(TYPE)); \
+	column_changed(Column, Index, 1); \
+	column_commit(Column); \
+} \
+\
+size_t column_ ## NAME ## _get_range(column_t *Column, size_t Start, size_t Count, TYPE *Values) { \
+	size_t Length = Column->Dataset->Length; \
+	if (Start >= Length) return 0; \
+	if (Count > Length - Start) Count = Length - Start; \
+	if (Column->Frozen) return frozen_read(Column, Start, Count, Values); \
+	memcpy(Values, Column->FIELD + Start, Count * sizeof(TYPE)); \
+	return Count; \
+} \
+\
+size_t column_ ## NAME ## _set_range(column_t *Column, size_t Start, size_t Count, const TYPE *Values) { \
+	size_t Length = Column->Dataset->Length; \
+	if (Start >= Length || Column->Frozen) return 0; \
+	if (Count > Length - Start) Count = Length - Start; \
+	memcpy(Column->FIELD + Start, Values, Count * sizeof(TYPE)); \
+	column_dirty(Column, Column->FIELD + Start, Count * sizeof(TYPE)); \
+	column_changed(Column, Start, Count); \
+	column_commit(Column); \
+	return Count; \
+}
+
+NUMERIC_ACCESSORS(int32, int32_t, Int32s)
+NUMERIC_ACCESSORS(int64, int64_t, Int64s)
+NUMERIC_ACCESSORS(float32, float, Float32s)
+
+int column_bool_get(column_t *Column, size_t Index) {
+	return (Column->Bools[Index / 64] >> (Index % 64)) & 1;
+}
+
+void column_bool_set(column_t *Column, size_t Index, int Value) {
+	uint64_t *Word = Column->Bools + Index / 64;
+	uint64_t Bit = (uint64_t)1 << (Index % 64);
+	if (Value) *Word |= Bit; else *Word &= ~Bit;
+	column_dirty(Column, Word, sizeof(uint64_t));
+	column_changed(Column, Index, 1);
+	column_commit(Column);
+}
+
+size_t column_bool_get_range(column_t *Column, size_t Start, size_t Count, uint8_t *Values) {
+	size_t Length = Column->Dataset->Length;
+	if (Start >= Length) return 0;
+	if (Count > Length - Start) Count = Length - Start;
+	const uint64_t *Bools = Column->Bools;
+	for (size_t I = 0; I < Count; ++I) Values[I] = (Bools[(Start + I) / 64] >> ((Start + I) % 64)) & 1;
+	return Count;
+}
+
+size_t column_bool_set_range(column_t *Column, size_t Start, size_t Count, const uint8_t *Values) {
+	size_t Length = Column->Dataset->Length;
+	if (Start >= Length) return 0;
+	if (Count > Length - Start) Count = Length - Start;
+	if (!Count) return 0;
+	uint64_t *Bools = Column->Bools;
+	for (size_t I = 0; I < Count; ++I) {
+		uint64_t Bit = (uint64_t)1 << ((Start + I) % 64);
+		if (Values[I]) Bools[(Start + I) / 64] |= Bit; else Bools[(Start + I) / 64] &= ~Bit;
+	}
+	size_t First = Start / 64, Last = (Start + Count - 1) / 64;
+	column_dirty(Column, Bools + First, (Last + 1 - First) * sizeof(uint64_t));
+	column_changed(Column, Start, Count);
+	column_commit(Column);
+	return Count;
+}
+
+size_t column_bool_count(column_t *Column, size_t Start, size_t Count) {
+	size_t Length = Column->Dataset->Length;
+	if (Start >= Length || !Count) return 0;
+	if (Count > Length - Start) Count = Length - Start;
+	const uint64_t *Bools = Column->Bools;
+	size_t First = Start / 64, Last = (Start + Count - 1) / 64;
+	uint64_t FirstMask = ~(uint64_t)0 << (Start % 64);
+	uint64_t LastMask = ~(uint64_t)0 >> (63 - (Start + Count - 1) % 64);
+	if (First == Last) return __builtin_popcountll(Bools[First] & FirstMask & LastMask);
+	size_t Total = __builtin_popcountll(Bools[First] & FirstMask) + __builtin_popcountll(Bools[Last] & LastMask);
+	for (size_t I = First + 1; I < Last; ++I) Total += __builtin_popcountll(Bools[I]);
+	return Total;
+}
+
+int column_is_numeric(column_t *Column) {
+	switch (Column->DataType) {
+	case COLUMN_REAL: case COLUMN_INT32: case COLUMN_INT64: case COLUMN_FLOAT32: case COLUMN_BOOL: return 1;
+	default: return 0;
+	}
+}
+
+double column_number_get(column_t *Column, size_t Index) {
+	switch (Column->DataType) {
+	case COLUMN_REAL: return column_real_get(Column, Index);
+	case COLUMN_INT32: return column_int32_get(Column, Index);
+	case COLUMN_INT64: return column_int64_get(Column, Index);
+	case COLUMN_FLOAT32: return column_float32_get(Column, Index);
+	case COLUMN_BOOL: return column_bool_get(Column, Index);
+	default: return NAN;
+	}
+}
+
+static size_t column_numeric_size(column_type_t Type, size_t Length) {
+	switch (Type) {
+	case COLUMN_REAL: return Length * sizeof(double);
+	case COLUMN_INT32: return Length * sizeof(int32_t);
+	case COLUMN_INT64: return Length * sizeof(int64_t);
+	case COLUMN_FLOAT32: return Length * sizeof(float);
+	case COLUMN_BOOL: return column_bool_words(Length) * sizeof(uint64_t);
+	default: return 0;
+	}
+}
+
+static void dataset_column_add(dataset_t *Dataset, column_t *Column) {
+	size_t Index = Dataset->NumColumns;
+	column_t **Columns = Dataset->Columns;
+	if (Index == Dataset->MaxColumns) {
+		// readers index the array without the lock, so the old array is left to the collector
+		size_t MaxColumns = Index ? 2 * Index : 8;
+		Columns = anew(column_t *, MaxColumns);
+		if (Index) memcpy(Columns, Dataset->Columns, Index * sizeof(column_t *));
+		Dataset->MaxColumns = MaxColumns;
+	}
+	Columns[Index] = Column;
+	stringmap_insert(Dataset->ColumnIndex, Column->Name, (void *)(Index + 1));
+	__atomic_store_n(&Dataset->Columns, Columns, __ATOMIC_RELEASE);
+	__atomic_store_n(&Dataset->NumColumns, Index + 1, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&Dataset->Version, 1, __ATOMIC_RELEASE);
+}
+
+dataset_t *dataset_new(const char *Path, const char *Name, size_t Length) {
 	if (mkdir(Path, 0777)) return NULL;
 	dataset_t *Dataset = new(dataset_t);
 	Dataset->Type = DatasetT;
+	pthread_mutex_init(Dataset->Lock, NULL);
+	pthread_mutex_init(Dataset->ChangeLock, NULL);
 	Dataset->Path = Path;
-	Dataset->Name = Name;
-	Dataset->Length = Length;
+	Dataset->Length = Dataset->Capacity = Length;
 	asprintf((char **)&Dataset->InfoFile, "%s/info.json", Path);
-	Dataset->Info = json_pack("{sssis[]}", "name", Name, "length", Length, "columns");
+	Dataset->Info = json_pack("{sssIs[]}", "name", Name, "length", (json_int_t)Length, "columns");
+	Dataset->Name = json_string_value(json_object_get(Dataset->Info, "name"));
+	return Dataset;
+}
+
+dataset_t *dataset_create(const char *Path, const char *Name, size_t Length) {
+	printf("Creating dataset: %s with %d entries at %s\n", Name, Length, Path);
+	dataset_t *Dataset = dataset_new(Path, Name, Length);
+	if (!Dataset) return NULL;
 	dataset_column_create(Dataset, "image", COLUMN_STRING);
 	return Dataset;
 }
@@ -190,6 +914,8 @@ dataset_t *dataset_create(const char *Path, const char *Name, size_t Length) {
 dataset_t *dataset_open(const char *Path) {
 	dataset_t *Dataset = new(dataset_t);
 	Dataset->Type = DatasetT;
+	pthread_mutex_init(Dataset->Lock, NULL);
+	pthread_mutex_init(Dataset->ChangeLock, NULL);
 	Dataset->Path = Path;
 	asprintf((char **)&Dataset->InfoFile, "%s/info.json", Path);
 	json_error_t Error;
@@ -199,128 +925,594 @@ dataset_t *dataset_open(const char *Path) {
 		return NULL;
 	}
 	json_t *ColumnsJson;
-	json_unpack(Dataset->Info, "{sssiso}", "name", &Dataset->Name, "length", &Dataset->Length, "columns", &ColumnsJson);
-	column_t **Slot = &Dataset->Columns;
+	json_int_t Length, Capacity = -1;
+	json_unpack(Dataset->Info, "{sssIs?Iso}", "name", &Dataset->Name, "length", &Length, "capacity", &Capacity, "columns", &ColumnsJson);
+	Dataset->Length = Length;
+	Dataset->Capacity = Capacity < Length ? Length : Capacity;
+	// column files are only mapped by dataset_column_open
 	for (int I = 0; I < json_array_size(ColumnsJson); ++I) {
-		column_t *Column = Slot[0] = new(column_t);
-		Column->Type = ColumnT;
-		Column->Dataset = Dataset;
-		json_unpack(json_array_get(ColumnsJson, I), "{sssi}", "name", &Column->Name, "type", &Column->DataType);
-		Slot = &Column->Next;
+		column_t *Column = column_new(Dataset);
+		Column->Index = I;
+		column_policy_t *Policy = Column->Policy;
+		json_unpack(json_array_get(ColumnsJson, I), "{sssis?is?is?bs?is?is?bs?b}",
+			"name", &Column->Name, "type", &Column->DataType, "format", &Column->Format, "index", &Column->IndexType, "frozen", &Column->Frozen,
+			"access", &Policy->Access, "prefetch", &Policy->Prefetch, "lock", &Policy->Lock, "hugepages", &Policy->HugePages
+		);
+		dataset_column_add(Dataset, Column);
 	}
 	return Dataset;
 }
 
+const char *dataset_get_name(dataset_t *Dataset) {
+	return Dataset->Name;
+}
+
 json_t *dataset_get_info(dataset_t *Dataset) {
-	return Dataset->Info;
+	pthread_mutex_lock(Dataset->Lock);
+	json_t *Info = json_deep_copy(Dataset->Info);
+	pthread_mutex_unlock(Dataset->Lock);
+	return Info;
 }
 
 size_t dataset_get_length(dataset_t *Dataset) {
 	return Dataset->Length;
 }
 
+uint64_t dataset_get_version(dataset_t *Dataset) {
+	return __atomic_load_n(&Dataset->Version, __ATOMIC_ACQUIRE);
+}
+
 size_t dataset_get_column_count(dataset_t *Dataset) {
-	size_t Index = 0;
-	column_t **Slot = &Dataset->Columns;
-	while (Slot[0]) {
-		Slot = &Slot[0]->Next;
-		++Index;
-	}
-	return Index;
+	return __atomic_load_n(&Dataset->NumColumns, __ATOMIC_ACQUIRE);
 }
 
 column_type_t dataset_get_column_type(dataset_t *Dataset, size_t Index) {
-	column_t *Column = Dataset->Columns;
-	while (Index > 0) { --Index; Column = Column->Next; }
-	return Column->DataType;
+	return dataset_column(Dataset, Index)->DataType;
 }
 
 const char *dataset_get_column_name(dataset_t *Dataset, size_t Index) {
-	column_t *Column = Dataset->Columns;
-	while (Index > 0) { --Index; Column = Column->Next; }
-	return Column->Name;
+	return dataset_column(Dataset, Index)->Name;
 }
 
-column_t *dataset_column_create(dataset_t *Dataset, const char *Name, column_type_t Type) {
-	size_t Index = 0;
-	column_t **Slot = &Dataset->Columns;
-	while (Slot[0]) {
-		Slot = &Slot[0]->Next;
-		++Index;
-	}
-	column_t *Column = Slot[0] = new(column_t);
-	Column->Type = ColumnT;
-	Column->Dataset = Dataset;
-	char FileName[strlen(Dataset->Path) + 10];
+uint64_t dataset_get_column_version(dataset_t *Dataset, size_t Index) {
+	column_t *Column = dataset_column(Dataset, Index);
+	return Column ? column_get_version(Column) : 0;
+}
+
+int dataset_get_column_counters(dataset_t *Dataset, size_t Index, column_counters_t *Counters) {
+	column_t *Column = dataset_column(Dataset, Index);
+	if (!Column) return -1;
+	column_get_counters(Column, Counters);
+	return 0;
+}
+
+int dataset_get_column_index(dataset_t *Dataset, const char *Name) {
+	pthread_mutex_lock(Dataset->Lock);
+	size_t Index = (size_t)stringmap_search(Dataset->ColumnIndex, Name);
+	pthread_mutex_unlock(Dataset->Lock);
+	return (int)Index - 1;
+}
+
+column_t *dataset_column_alloc(dataset_t *Dataset, const char *Name, column_type_t Type, size_t NodeCount) {
+	pthread_mutex_lock(Dataset->Lock);
+	size_t Index = Dataset->NumColumns;
+	column_t *Column = column_new(Dataset);
+	Column->Index = Index;
+	char FileName[strlen(Dataset->Path) + 32];
 	sprintf(FileName, "%s/%d", Dataset->Path, Index);
 	Column->Fd = open(FileName, O_RDWR | O_CREAT, 0777);
-	Column->Name = Name;
+	Column->Name = GC_strdup(Name);
+	Column->Mapped = 1;
 	Column->DataType = Type;
 	switch (Type) {
 	case COLUMN_STRING: {
-		Column->MapSize = sizeof(string_header_t) + Dataset->Length * sizeof(string_entry_t) + Dataset->Length * sizeof(string_node_t);
+		Column->MapSize = sizeof(string_header_t) + Dataset->Length * sizeof(string_entry_t) + NodeCount * sizeof(string_node_t);
 		ftruncate(Column->Fd, Column->MapSize);
 		Column->Map = mmap(NULL, Column->MapSize, PROT_READ | PROT_WRITE, MAP_SHARED, Column->Fd, 0);
 		Column->Strings->Header.FreeCount = 0;
 		Column->Strings->Header.FreeStart = 0;
-		for (int I = 0; I < Dataset->Length; ++I) Column->Strings->Entries[I].Link = I;
 		break;
 	}
-	case COLUMN_REAL: {
-		Column->MapSize = Dataset->Length * sizeof(double);
+	case COLUMN_REAL:
+	case COLUMN_INT32:
+	case COLUMN_INT64:
+	case COLUMN_FLOAT32:
+	case COLUMN_BOOL: {
+		Column->MapSize = column_numeric_size(Type, Dataset->Capacity);
+		ftruncate(Column->Fd, Column->MapSize);
+		Column->Map = mmap(NULL, Column->MapSize, PROT_READ | PROT_WRITE, MAP_SHARED, Column->Fd, 0);
+		break;
+	}
+	case COLUMN_CATEGORY: {
+		Column->MapSize = sizeof(category_header_t) + Dataset->Capacity;
 		ftruncate(Column->Fd, Column->MapSize);
 		Column->Map = mmap(NULL, Column->MapSize, PROT_READ | PROT_WRITE, MAP_SHARED, Column->Fd, 0);
+		Column->Categories->Header.Width = 1;
+		strcat(FileName, ".dict");
+		unlink(FileName);
+		Column->Dictionary = category_open(FileName, 0);
+		category_code(Column, "", 0);
 		break;
 	}
 	}
 	json_t *ColumnsJson = json_object_get(Dataset->Info, "columns");
-	json_array_append(ColumnsJson, json_pack("{sssi}", "name", Name, "type", Type));
+	json_array_append_new(ColumnsJson, json_pack("{sssisi}", "name", Name, "type", Type, "format", STRING_LINKED));
 	json_dump_file(Dataset->Info, Dataset->InfoFile, 0);
-	msync(Column->Map, Column->MapSize, MS_ASYNC);
+	dataset_column_add(Dataset, Column);
+	pthread_mutex_unlock(Dataset->Lock);
+	return Column;
+}
+
+column_t *dataset_column_create(dataset_t *Dataset, const char *Name, column_type_t Type) {
+	column_t *Column = dataset_column_alloc(Dataset, Name, Type, Dataset->Length);
+	if (Type == COLUMN_STRING) {
+		for (int I = 0; I < Dataset->Length; ++I) Column->Strings->Entries[I].Link = I;
+	}
+	column_lock_write(Column);
+	column_zones_open(Column);
+	column_unlock(Column);
+	column_dirty(Column, Column->Map, Column->MapSize);
+	column_commit(Column);
 	return Column;
 }
 
 column_t *dataset_column_open(dataset_t *Dataset, size_t Index) {
-	column_t *Column = Dataset->Columns;
-	while (Index > 0) { --Index; Column = Column->Next; }
-	if (!Column->Map) {
-		char FileName[strlen(Dataset->Path) + 10];
+	column_t *Column = dataset_column(Dataset, Index);
+	if (!Column || __atomic_load_n(&Column->Mapped, __ATOMIC_ACQUIRE)) return Column;
+	pthread_mutex_lock(Dataset->Lock);
+	if (!Column->Mapped) {
+		char FileName[strlen(Dataset->Path) + 32];
 		sprintf(FileName, "%s/%d", Dataset->Path, Index);
 		struct stat Stat[1];
-		if (stat(FileName, Stat)) return NULL;
-		Column->Fd = open(FileName, O_RDWR, 0777);
-		Column->MapSize = Stat->st_size;
-		Column->Map = mmap(NULL, Column->MapSize, PROT_READ | PROT_WRITE, MAP_SHARED, Column->Fd, 0);
+		if (Column->Frozen) {
+			if (frozen_open(Column)) {
+				pthread_mutex_unlock(Dataset->Lock);
+				return NULL;
+			}
+		} else if (stat(FileName, Stat)) {
+			pthread_mutex_unlock(Dataset->Lock);
+			return NULL;
+		} else {
+			int Flags = Column->Policy->Prefetch == PREFETCH_POPULATE ? MAP_SHARED | MAP_POPULATE : MAP_SHARED;
+			Column->Fd = open(FileName, O_RDWR, 0777);
+			Column->MapSize = Stat->st_size;
+			Column->Map = mmap(NULL, Column->MapSize, PROT_READ | PROT_WRITE, Flags, Column->Fd, 0);
+		}
+		if (Column->Frozen) {
+			if (Column->DataType == COLUMN_CATEGORY) {
+				strcat(FileName, ".dict");
+				Column->Dictionary = category_open(FileName, Column->Compressed->Count);
+			}
+		} else if (Column->DataType == COLUMN_STRING && Column->Format == STRING_PACKED) {
+			strcat(FileName, ".heap");
+			stat(FileName, Stat);
+			Column->HeapFd = open(FileName, O_RDWR, 0777);
+			Column->HeapSize = Stat->st_size;
+			Column->Heap = mmap(NULL, Column->HeapSize, PROT_READ | PROT_WRITE, MAP_SHARED, Column->HeapFd, 0);
+		} else if (Column->DataType == COLUMN_CATEGORY) {
+			strcat(FileName, ".dict");
+			Column->Dictionary = category_open(FileName, Column->Categories->Header.Count);
+		}
+		if (Column->IndexType != INDEX_NONE) column_index_open(Column);
+		column_zones_open(Column);
+		column_advise(Column);
+		__atomic_store_n(&Column->Mapped, 1, __ATOMIC_RELEASE);
 	}
+	pthread_mutex_unlock(Dataset->Lock);
 	return Column;
 }
 
-static ml_value_t *ml_dataset_open(void *Data, int Count, ml_value_t **Args) {
-	ML_CHECK_ARG_COUNT(1);
-	ML_CHECK_ARG_TYPE(0, MLStringT);
-	dataset_t *Dataset = dataset_open(ml_string_value(Args[0]));
-	if (Dataset) {
-		return (ml_value_t *)Dataset;
-	} else {
-		return ml_error("LoadError", "Error opening dataset");
-	}
+void dataset_flush(dataset_t *Dataset) {
+	// column locks must be taken before the dataset lock, so the column array is read without it
+	size_t NumColumns = dataset_get_column_count(Dataset);
+	for (size_t I = 0; I < NumColumns; ++I) column_flush(dataset_column(Dataset, I));
 }
 
-static ml_value_t *ml_dataset_create(void *Data, int Count, ml_value_t **Args) {
-	ML_CHECK_ARG_COUNT(3);
-	ML_CHECK_ARG_TYPE(0, MLStringT);
-	ML_CHECK_ARG_TYPE(1, MLStringT);
-	ML_CHECK_ARG_TYPE(2, MLIntegerT);
-	dataset_t *Dataset = dataset_create(ml_string_value(Args[0]), ml_string_value(Args[1]), ml_integer_value(Args[2]));
-	if (Dataset) {
-		return (ml_value_t *)Dataset;
+void column_retire(column_t *Column) {
+	pthread_mutex_lock(Column->PinLock);
+	if (Column->Pins) {
+		column_mapping_t *Retired = malloc(sizeof(column_mapping_t));
+		Retired->Next = Column->Retired;
+		Retired->Map = Column->Map;
+		Retired->Size = Column->MapSize;
+		Column->Retired = Retired;
 	} else {
-		return ml_error("LoadError", "Error opening dataset");
+		munmap(Column->Map, Column->MapSize);
 	}
+	pthread_mutex_unlock(Column->PinLock);
 }
 
-static ml_value_t *ml_dataset_column_count(void *Data, int Count, ml_value_t **Args) {
-	dataset_t *Dataset = (dataset_t *)Args[0];
+/*
+access policies are applied to every fresh mapping of a column, mremap keeps
+the advice and locks of the region it moves. Transparent huge pages only help
+large numeric columns and need a filesystem that supports them for shared
+file mappings.
+*/
+
+#define HUGE_PAGE_MIN (2 << 20)
+
+static int column_advise_region(column_t *Column, void *Map, size_t Size, int Huge) {
+	if (!Map || Map == MAP_FAILED || !Size) return 0;
+	column_policy_t *Policy = Column->Policy;
+	switch (Policy->Access) {
+	case ACCESS_NORMAL: madvise(Map, Size, MADV_NORMAL); break;
+	case ACCESS_SEQUENTIAL: madvise(Map, Size, MADV_SEQUENTIAL); break;
+	case ACCESS_RANDOM: madvise(Map, Size, MADV_RANDOM); break;
+	}
+	if (Policy->Prefetch != PREFETCH_NONE) madvise(Map, Size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+	if (Huge) madvise(Map, Size, Policy->HugePages && Size >= HUGE_PAGE_MIN ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#endif
+	if (Policy->Lock) {
+		if (mlock(Map, Size)) {
+			fprintf(stderr, "Error: error locking column %s\n", Column->Name);
+			return -1;
+		}
+	} else {
+		munlock(Map, Size);
+	}
+	return 0;
+}
+
+int column_advise(column_t *Column) {
+	int Huge = !Column->Frozen && column_is_numeric(Column);
+	int Status = column_advise_region(Column, Column->Map, Column->MapSize, Huge);
+	if (column_advise_region(Column, Column->Heap, Column->HeapSize, 0)) Status = -1;
+	if (column_advise_region(Column, Column->IndexMap, Column->IndexSize, 0)) Status = -1;
+	return Status;
+}
+
+static void column_populate(const void *Map, size_t Size) {
+	// faults in every page, as MAP_POPULATE does for columns opened with the policy
+	if (!Map || !Size) return;
+#ifdef MADV_POPULATE_READ
+	if (!madvise((void *)Map, Size, MADV_POPULATE_READ)) return;
+#endif
+	volatile const char *Bytes = Map;
+	for (size_t Offset = 0; Offset < Size; Offset += PageSize) (void)Bytes[Offset];
+}
+
+void column_get_policy(column_t *Column, column_policy_t *Policy) {
+	*Policy = *Column->Policy;
+}
+
+int column_set_policy(column_t *Column, const column_policy_t *Policy) {
+	// called with the column write locked
+	column_policy_t Previous = *Column->Policy;
+	*Column->Policy = *Policy;
+	if (Column->Mapped) {
+		if (column_advise(Column)) {
+			// a policy that cannot be applied is not kept, or persisted to fail again on every open
+			*Column->Policy = Previous;
+			column_advise(Column);
+			return -1;
+		}
+		if (Policy->Prefetch == PREFETCH_POPULATE) {
+			column_populate(Column->Map, Column->MapSize);
+			column_populate(Column->Heap, Column->HeapSize);
+			column_populate(Column->IndexMap, Column->IndexSize);
+		}
+	}
+	dataset_t *Dataset = Column->Dataset;
+	pthread_mutex_lock(Dataset->Lock);
+	json_t *ColumnJson = json_array_get(json_object_get(Dataset->Info, "columns"), Column->Index);
+	json_object_del(ColumnJson, "access");
+	json_object_del(ColumnJson, "prefetch");
+	json_object_del(ColumnJson, "lock");
+	json_object_del(ColumnJson, "hugepages");
+	if (Policy->Access != ACCESS_NORMAL) json_object_set_new(ColumnJson, "access", json_integer(Policy->Access));
+	if (Policy->Prefetch != PREFETCH_NONE) json_object_set_new(ColumnJson, "prefetch", json_integer(Policy->Prefetch));
+	if (Policy->Lock) json_object_set_new(ColumnJson, "lock", json_true());
+	if (Policy->HugePages) json_object_set_new(ColumnJson, "hugepages", json_true());
+	json_dump_file(Dataset->Info, Dataset->InfoFile, 0);
+	pthread_mutex_unlock(Dataset->Lock);
+	return 0;
+}
+
+void dataset_prefetch(dataset_t *Dataset) {
+	// columns that should be resident are mapped up front instead of on first use
+	size_t NumColumns = dataset_get_column_count(Dataset);
+	for (size_t I = 0; I < NumColumns; ++I) {
+		column_t *Column = dataset_column(Dataset, I);
+		if (Column->Policy->Prefetch != PREFETCH_NONE || Column->Policy->Lock) dataset_column_open(Dataset, I);
+	}
+}
+
+static int column_grow(column_t *Column, size_t Capacity) {
+	size_t MapSize;
+	switch (Column->DataType) {
+	case COLUMN_STRING:
+		MapSize = sizeof(packed_header_t) + Capacity * sizeof(packed_entry_t);
+		break;
+	case COLUMN_CATEGORY:
+		MapSize = sizeof(category_header_t) + Capacity * Column->Categories->Header.Width;
+		break;
+	default:
+		MapSize = column_numeric_size(Column->DataType, Capacity);
+		break;
+	}
+	if (MapSize <= Column->MapSize) return 0;
+	if (ftruncate(Column->Fd, MapSize)) return -1;
+	// no new pins can be taken under the write lock
+	pthread_mutex_lock(Column->PinLock);
+	int Pinned = Column->Pins > 0;
+	pthread_mutex_unlock(Column->PinLock);
+	void *Map;
+	if (Pinned) {
+		// pinned slices must stay valid, so map the file again and keep the old region until they are released
+		Map = mmap(NULL, MapSize, PROT_READ | PROT_WRITE, MAP_SHARED, Column->Fd, 0);
+		if (Map != MAP_FAILED) column_retire(Column);
+	} else {
+		Map = mremap(Column->Map, Column->MapSize, MapSize, MREMAP_MAYMOVE);
+	}
+	if (Map == MAP_FAILED) return -1;
+	Column->Map = Map;
+	Column->MapSize = MapSize;
+	if (Pinned) column_advise(Column);
+	column_count(&Column->Counters.Remaps);
+	return 0;
+}
+
+const void *column_pin(column_t *Column, size_t Start, size_t *Width) {
+	switch (Column->DataType) {
+	case COLUMN_REAL: *Width = sizeof(double); break;
+	case COLUMN_INT32: *Width = sizeof(int32_t); break;
+	case COLUMN_INT64: *Width = sizeof(int64_t); break;
+	case COLUMN_FLOAT32: *Width = sizeof(float); break;
+	default: return NULL;
+	}
+	pthread_rwlock_rdlock(Column->Lock);
+	// frozen columns have no plain copy to pin, checked under the lock that freezing takes for writing
+	if (Column->Frozen) {
+		pthread_rwlock_unlock(Column->Lock);
+		return NULL;
+	}
+	pthread_mutex_lock(Column->PinLock);
+	++Column->Pins;
+	pthread_mutex_unlock(Column->PinLock);
+	const void *Slice = (const char *)Column->Map + Start * *Width;
+	pthread_rwlock_unlock(Column->Lock);
+	return Slice;
+}
+
+void column_unpin(column_t *Column) {
+	column_mapping_t *Retired = NULL;
+	pthread_mutex_lock(Column->PinLock);
+	if (!--Column->Pins) {
+		Retired = Column->Retired;
+		Column->Retired = NULL;
+	}
+	pthread_mutex_unlock(Column->PinLock);
+	while (Retired) {
+		column_mapping_t *Next = Retired->Next;
+		munmap(Retired->Map, Retired->Size);
+		free(Retired);
+		Retired = Next;
+	}
+}
+
+int dataset_append(dataset_t *Dataset, size_t Count, size_t *Start, void (*Fill)(size_t Start, void *Data), void *Data) {
+	size_t NumColumns;
+	column_t **Columns;
+	for (;;) {
+		NumColumns = dataset_get_column_count(Dataset);
+		for (size_t I = 0; I < NumColumns; ++I) if (!dataset_column_open(Dataset, I)) return -1;
+		Columns = __atomic_load_n(&Dataset->Columns, __ATOMIC_ACQUIRE);
+		for (size_t I = 0; I < NumColumns; ++I) column_lock_write(Columns[I]);
+		pthread_mutex_lock(Dataset->Lock);
+		if (Dataset->NumColumns == NumColumns) break;
+		// a column was added after the snapshot, start again so that it is locked too
+		pthread_mutex_unlock(Dataset->Lock);
+		for (size_t I = 0; I < NumColumns; ++I) column_unlock(Columns[I]);
+	}
+	int Status = 0, Rewritten = 0;
+	size_t Length = Dataset->Length + Count;
+	// frozen columns are read only and cannot grow
+	for (size_t I = 0; I < NumColumns; ++I) {
+		if (Columns[I]->Frozen) {
+			Status = -1;
+			goto done;
+		}
+	}
+	// the linked node region starts after the last entry, so rows can only be added to packed strings
+	for (size_t I = 0; I < NumColumns; ++I) {
+		column_t *Column = Columns[I];
+		if (Column->DataType == COLUMN_STRING && Column->Format == STRING_LINKED) {
+			if ((Status = column_rewrite(Column, STRING_PACKED))) goto done;
+			Rewritten = 1;
+		}
+	}
+	if (Length > Dataset->Capacity) {
+		size_t Capacity = Dataset->Capacity + Dataset->Capacity / 2;
+		if (Capacity < DATASET_MIN_CAPACITY) Capacity = DATASET_MIN_CAPACITY;
+		if (Capacity < Length) Capacity = Length;
+		for (size_t I = 0; I < NumColumns; ++I) {
+			if ((Status = column_grow(Columns[I], Capacity))) goto done;
+		}
+		Dataset->Capacity = Capacity;
+	}
+	*Start = Dataset->Length;
+	Dataset->Length = Length;
+	__atomic_fetch_add(&Dataset->Version, 1, __ATOMIC_RELEASE);
+	for (size_t I = 0; I < NumColumns; ++I) {
+		column_index_append(Columns[I], *Start, Count);
+		column_zones_append(Columns[I], *Start, Count);
+	}
+done:
+	// a failed append leaves the length alone but must still record any column it rewrote
+	if (!Status || Rewritten) {
+		json_object_set_new(Dataset->Info, "length", json_integer(Dataset->Length));
+		json_object_set_new(Dataset->Info, "capacity", json_integer(Dataset->Capacity));
+		json_dump_file(Dataset->Info, Dataset->InfoFile, 0);
+	}
+	pthread_mutex_unlock(Dataset->Lock);
+	// readers lock a column before reading its rows, so none sees the new rows before they are filled
+	if (!Status && Fill) Fill(*Start, Data);
+	for (size_t I = 0; I < NumColumns; ++I) {
+		column_commit(Columns[I]);
+		column_unlock(Columns[I]);
+	}
+	return Status;
+}
+
+static int dataset_copy_file(int FromDir, int ToDir, const char *Name) {
+	int From = openat(FromDir, Name, O_RDONLY);
+	if (From < 0) return -1;
+	int To = openat(ToDir, Name, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+	if (To < 0) {
+		close(From);
+		return -1;
+	}
+	// copy_file_range shares extents on filesystems with reflinks, otherwise it copies in the kernel
+	struct stat Stat[1];
+	fstat(From, Stat);
+	size_t Remaining = Stat->st_size;
+	while (Remaining > 0) {
+		ssize_t Copied = copy_file_range(From, NULL, To, NULL, Remaining, 0);
+		if (Copied <= 0) break;
+		Remaining -= Copied;
+	}
+	char Buffer[65536];
+	while (Remaining > 0) {
+		ssize_t Read = read(From, Buffer, Remaining < sizeof(Buffer) ? Remaining : sizeof(Buffer));
+		if (Read <= 0 || write(To, Buffer, Read) != Read) break;
+		Remaining -= Read;
+	}
+	close(From);
+	close(To);
+	return Remaining ? -1 : 0;
+}
+
+dataset_t *dataset_snapshot(dataset_t *Dataset, const char *Path) {
+	// writers are held off for the copy so that the files agree with each other and with info.json
+	size_t NumColumns;
+	column_t **Columns;
+	for (;;) {
+		NumColumns = dataset_get_column_count(Dataset);
+		Columns = __atomic_load_n(&Dataset->Columns, __ATOMIC_ACQUIRE);
+		for (size_t I = 0; I < NumColumns; ++I) column_lock_read(Columns[I]);
+		pthread_mutex_lock(Dataset->Lock);
+		if (Dataset->NumColumns == NumColumns) break;
+		pthread_mutex_unlock(Dataset->Lock);
+		for (size_t I = 0; I < NumColumns; ++I) column_unlock(Columns[I]);
+	}
+	int Status = -1;
+	DIR *Dir = NULL;
+	int ToDir = -1;
+	if (mkdir(Path, 0777)) goto done;
+	if (!(Dir = opendir(Dataset->Path))) goto done;
+	if ((ToDir = open(Path, O_RDONLY | O_DIRECTORY)) < 0) goto done;
+	struct dirent *Entry;
+	Status = 0;
+	while (!Status && (Entry = readdir(Dir))) {
+		if (Entry->d_type != DT_REG && Entry->d_type != DT_UNKNOWN) continue;
+		if (!strcmp(Entry->d_name, "info.json") || strstr(Entry->d_name, ".tmp")) continue;
+		struct stat Stat[1];
+		if (fstatat(dirfd(Dir), Entry->d_name, Stat, 0) || !S_ISREG(Stat->st_mode)) continue;
+		Status = dataset_copy_file(dirfd(Dir), ToDir, Entry->d_name);
+	}
+	if (!Status) {
+		char InfoFile[strlen(Path) + 16];
+		sprintf(InfoFile, "%s/info.json", Path);
+		Status = json_dump_file(Dataset->Info, InfoFile, 0);
+	}
+done:
+	if (ToDir >= 0) close(ToDir);
+	if (Dir) closedir(Dir);
+	pthread_mutex_unlock(Dataset->Lock);
+	for (size_t I = 0; I < NumColumns; ++I) column_unlock(Columns[I]);
+	return Status ? NULL : dataset_open(Path);
+}
+
+void dataset_close(dataset_t *Dataset) {
+	// the dataset must no longer be reachable, pinned slices are unmapped once released
+	size_t NumColumns = dataset_get_column_count(Dataset);
+	for (size_t I = 0; I < NumColumns; ++I) {
+		column_t *Column = dataset_column(Dataset, I);
+		if (!Column->Mapped) continue;
+		column_lock_write(Column);
+		if (Column->Frozen) {
+			frozen_close(Column);
+		} else {
+			column_retire(Column);
+			close(Column->Fd);
+		}
+		if (Column->Heap) {
+			munmap(Column->Heap, Column->HeapSize);
+			close(Column->HeapFd);
+		}
+		if (Column->IndexMap) {
+			munmap(Column->IndexMap, Column->IndexSize);
+			close(Column->IndexFd);
+		}
+		column_zones_close(Column);
+		if (Column->Dictionary) close(Column->Dictionary->Fd);
+		free(Column->Dirty->Bits);
+		free(Column->HeapDirty->Bits);
+		free(Column->IndexDirty->Bits);
+		Column->Mapped = 0;
+		column_unlock(Column);
+	}
+}
+
+static ml_value_t *ml_dataset_open(void *Data, int Count, ml_value_t **Args) {
+	ML_CHECK_ARG_COUNT(1);
+	ML_CHECK_ARG_TYPE(0, MLStringT);
+	dataset_t *Dataset = dataset_open(ml_string_value(Args[0]));
+	if (Dataset) {
+		return (ml_value_t *)Dataset;
+	} else {
+		return ml_error("LoadError", "Error opening dataset");
+	}
+}
+
+static ml_value_t *ml_dataset_create(void *Data, int Count, ml_value_t **Args) {
+	ML_CHECK_ARG_COUNT(3);
+	ML_CHECK_ARG_TYPE(0, MLStringT);
+	ML_CHECK_ARG_TYPE(1, MLStringT);
+	ML_CHECK_ARG_TYPE(2, MLIntegerT);
+	dataset_t *Dataset = dataset_create(ml_string_value(Args[0]), ml_string_value(Args[1]), ml_integer_value(Args[2]));
+	if (Dataset) {
+		return (ml_value_t *)Dataset;
+	} else {
+		return ml_error("LoadError", "Error opening dataset");
+	}
+}
+
+typedef struct ml_import_types_t {
+	column_type_t *Types;
+	int Count;
+} ml_import_types_t;
+
+static int ml_import_type(ml_value_t *Value, ml_import_types_t *Types) {
+	if (Value->Type != MLIntegerT) return 1;
+	long Type = ml_integer_value(Value);
+	if (Type < COLUMN_STRING || Type > COLUMN_BOOL) return 1;
+	Types->Types[Types->Count++] = Type;
+	return 0;
+}
+
+static ml_value_t *ml_dataset_import(void *Data, int Count, ml_value_t **Args) {
+	ML_CHECK_ARG_COUNT(3);
+	ML_CHECK_ARG_TYPE(0, MLStringT);
+	ML_CHECK_ARG_TYPE(1, MLStringT);
+	ML_CHECK_ARG_TYPE(2, MLStringT);
+	ml_import_types_t Types[1] = {{NULL, 0}};
+	if (Count > 3) {
+		ML_CHECK_ARG_TYPE(3, MLListT);
+		Types->Types = GC_malloc_atomic(ml_list_length(Args[3]) * sizeof(column_type_t));
+		if (ml_list_foreach(Args[3], Types, (void *)ml_import_type)) return ml_error("TypeError", "Expected list of column types");
+	}
+	dataset_t *Dataset = dataset_import(ml_string_value(Args[0]), ml_string_value(Args[1]), ml_string_value(Args[2]), Types->Count, Types->Types);
+	if (Dataset) {
+		return (ml_value_t *)Dataset;
+	} else {
+		return ml_error("LoadError", "Error importing dataset");
+	}
+}
+
+static ml_value_t *ml_dataset_column_count(void *Data, int Count, ml_value_t **Args) {
+	dataset_t *Dataset = (dataset_t *)Args[0];
 	return ml_integer(dataset_get_column_count(Dataset));
 }
 
@@ -330,6 +1522,13 @@ static ml_value_t *ml_dataset_column_open(void *Data, int Count, ml_value_t **Ar
 	return (ml_value_t *)dataset_column_open(Dataset, Index);
 }
 
+static ml_value_t *ml_dataset_column_open_name(void *Data, int Count, ml_value_t **Args) {
+	dataset_t *Dataset = (dataset_t *)Args[0];
+	int Index = dataset_get_column_index(Dataset, ml_string_value(Args[1]));
+	if (Index < 0) return ml_error("NameError", "Column %s not found", ml_string_value(Args[1]));
+	return (ml_value_t *)dataset_column_open(Dataset, Index);
+}
+
 static ml_value_t *ml_dataset_column_create(void *Data, int Count, ml_value_t **Args) {
 	dataset_t *Dataset = (dataset_t *)Args[0];
 	const char *Name = ml_string_value(Args[1]);
@@ -337,6 +1536,169 @@ static ml_value_t *ml_dataset_column_create(void *Data, int Count, ml_value_t **
 	return (ml_value_t *)dataset_column_create(Dataset, Name, Type);
 }
 
+static ml_value_t *ml_dataset_append(void *Data, int Count, ml_value_t **Args) {
+	dataset_t *Dataset = (dataset_t *)Args[0];
+	long Rows = ml_integer_value(Args[1]);
+	if (Rows < 0) return ml_error("ValueError", "Invalid row count");
+	size_t Start;
+	if (dataset_append(Dataset, Rows, &Start, NULL, NULL)) return ml_error("AppendError", "Error appending rows");
+	return ml_integer(Start);
+}
+
+static ml_value_t *ml_dataset_flush(void *Data, int Count, ml_value_t **Args) {
+	dataset_flush((dataset_t *)Args[0]);
+	return Args[0];
+}
+
+static query_t *ml_dataset_query(dataset_t *Dataset, ml_value_t *Where, ml_value_t **Error) {
+	json_error_t JsonError;
+	json_t *Json = json_loadb(ml_string_value(Where), ml_string_length(Where), 0, &JsonError);
+	if (!Json) {
+		*Error = ml_error("ParseError", "%s", JsonError.text);
+		return NULL;
+	}
+	const char *QueryError;
+	query_t *Query = query_compile(Dataset, Json, &QueryError);
+	json_decref(Json);
+	if (!Query) *Error = ml_error("QueryError", "%s", QueryError);
+	return Query;
+}
+
+static ml_value_t *ml_dataset_count(void *Data, int Count, ml_value_t **Args) {
+	dataset_t *Dataset = (dataset_t *)Args[0];
+	ml_value_t *Error;
+	query_t *Query = ml_dataset_query(Dataset, Args[1], &Error);
+	if (!Query) return Error;
+	size_t Total;
+	uint64_t *Bitmap = query_run(Query, NULL, &Total);
+	query_free(Query);
+	if (!Bitmap) return ml_error("QueryError", "column is frozen");
+	free(Bitmap);
+	return ml_integer(Total);
+}
+
+static ml_value_t *ml_dataset_select(void *Data, int Count, ml_value_t **Args) {
+	dataset_t *Dataset = (dataset_t *)Args[0];
+	ml_value_t *Error;
+	query_t *Query = ml_dataset_query(Dataset, Args[1], &Error);
+	if (!Query) return Error;
+	size_t Length;
+	uint64_t *Bitmap = query_run(Query, &Length, NULL);
+	query_free(Query);
+	if (!Bitmap) return ml_error("QueryError", "column is frozen");
+	ml_value_t *Rows = ml_list();
+	for (size_t I = query_next(Bitmap, Length, 0); I < Length; I = query_next(Bitmap, Length, I + 1)) {
+		ml_list_append(Rows, ml_integer(I));
+	}
+	free(Bitmap);
+	return Rows;
+}
+
+static ml_value_t *ml_column_flush(void *Data, int Count, ml_value_t **Args) {
+	column_flush((column_t *)Args[0]);
+	return Args[0];
+}
+
+static ml_value_t *ml_column_compact(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	string_format_t Format = STRING_PACKED;
+	if (Count > 1) {
+		ML_CHECK_ARG_TYPE(1, MLIntegerT);
+		Format = ml_integer_value(Args[1]);
+	}
+	if (column_compact(Column, Format)) return ml_error("CompactError", "Error compacting column");
+	return Args[0];
+}
+
+static ml_value_t *ml_column_freeze(void *Data, int Count, ml_value_t **Args) {
+	if (column_freeze((column_t *)Args[0])) return ml_error("FreezeError", "Error freezing column");
+	return Args[0];
+}
+
+static ml_value_t *ml_column_thaw(void *Data, int Count, ml_value_t **Args) {
+	if (column_thaw((column_t *)Args[0])) return ml_error("FreezeError", "Error thawing column");
+	return Args[0];
+}
+
+static ml_value_t *ml_column_policy(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	column_policy_t Policy[1] = {{ml_integer_value(Args[1]), ml_integer_value(Args[2]), 0, 0}};
+	if (Policy->Access > ACCESS_RANDOM || Policy->Prefetch > PREFETCH_POPULATE) return ml_error("ValueError", "Invalid policy");
+	if (Count > 3) Policy->Lock = Args[3] != MLNil;
+	if (Count > 4) Policy->HugePages = Args[4] != MLNil;
+	if (column_set_policy(Column, Policy)) return ml_error("PolicyError", "Error locking column");
+	return (ml_value_t *)Column;
+}
+
+static ml_value_t *ml_column_groups(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	if (Column->DataType != COLUMN_CATEGORY) return ml_error("TypeError", "Expected category column");
+	size_t NumCodes = column_category_count(Column);
+	uint64_t *Counts = calloc(NumCodes, sizeof(uint64_t));
+	column_category_counts(Column, 0, Column->Dataset->Length, Counts);
+	ml_value_t *Groups = ml_map();
+	for (size_t I = 0; I < NumCodes; ++I) {
+		if (!Counts[I]) continue;
+		ml_map_insert(Groups, ml_string(Column->Dictionary->Values[I], Column->Dictionary->Lengths[I]), ml_integer(Counts[I]));
+	}
+	free(Counts);
+	return Groups;
+}
+
+static ml_value_t *ml_column_stat(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	column_stats_t Stats[1];
+	if (column_aggregate(Column, 0, Column->Dataset->Length, Stats)) return ml_error("TypeError", "Expected numeric column");
+	if (!Data) return ml_integer(Stats->Count);
+	return ml_real(*(double *)((char *)Stats + (uintptr_t)Data));
+}
+
+static ml_value_t *ml_column_histogram(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	int NumBuckets = ml_integer_value(Args[1]);
+	if (NumBuckets <= 0) return ml_error("ValueError", "Invalid bucket count");
+	double Min, Max;
+	if (Count > 3) {
+		ML_CHECK_ARG_TYPE(2, MLNumberT);
+		ML_CHECK_ARG_TYPE(3, MLNumberT);
+		Min = Args[2]->Type == MLIntegerT ? ml_integer_value(Args[2]) : ml_real_value(Args[2]);
+		Max = Args[3]->Type == MLIntegerT ? ml_integer_value(Args[3]) : ml_real_value(Args[3]);
+	} else {
+		column_stats_t Stats[1];
+		if (column_aggregate(Column, 0, Column->Dataset->Length, Stats)) return ml_error("TypeError", "Expected numeric column");
+		Min = Stats->Min;
+		Max = Stats->Max;
+	}
+	uint64_t *Buckets = GC_malloc_atomic(NumBuckets * sizeof(uint64_t));
+	if (column_histogram(Column, 0, Column->Dataset->Length, Min, Max, NumBuckets, Buckets)) return ml_error("ValueError", "Invalid histogram range");
+	ml_value_t *Result = ml_list();
+	for (int I = 0; I < NumBuckets; ++I) ml_list_append(Result, ml_integer(Buckets[I]));
+	return Result;
+}
+
+static ml_value_t *ml_column_index_create(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	if (column_index_create(Column)) return ml_error("IndexError", "Error creating index");
+	return Args[0];
+}
+
+static ml_value_t *ml_column_lookup(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	if (Column->DataType != COLUMN_STRING && Column->DataType != COLUMN_CATEGORY) return ml_error("TypeError", "Expected string column");
+	const char *Value = ml_string_value(Args[1]);
+	int Length = ml_string_length(Args[1]);
+	size_t Max = 16, *Rows = malloc(Max * sizeof(size_t));
+	size_t Total = column_string_lookup(Column, Value, Length, Rows, Max);
+	if (Total > Max) {
+		Rows = realloc(Rows, Total * sizeof(size_t));
+		column_string_lookup(Column, Value, Length, Rows, Total);
+	}
+	ml_value_t *Result = ml_list();
+	for (size_t I = 0; I < Total; ++I) ml_list_append(Result, ml_integer(Rows[I]));
+	free(Rows);
+	return Result;
+}
+
 static ml_value_t *ml_column_to_string(void *Data, int Count, ml_value_t **Args) {
 	column_t *Column = (column_t *)Args[0];
 	return ml_string(Column->Name, -1);
@@ -353,7 +1715,7 @@ static ml_value_t *column_ref_deref(column_ref_t *Ref) {
 	switch (Column->DataType) {
 	case COLUMN_STRING: {
 		size_t Length = column_string_get_length(Column, Ref->Index);
-		char *Buffer = GC_malloc_atomic(Length);
+		char *Buffer = GC_malloc_atomic(Length + 1);
 		column_string_get_value(Column, Ref->Index, Buffer);
 		Buffer[Length] = 0;
 		return ml_string(Buffer, Length);
@@ -361,14 +1723,33 @@ static ml_value_t *column_ref_deref(column_ref_t *Ref) {
 	case COLUMN_REAL: {
 		return ml_real(column_real_get(Column, Ref->Index));
 	}
+	case COLUMN_CATEGORY: {
+		size_t Length;
+		const char *Value = column_category_value(Column, column_category_get_code(Column, Ref->Index), &Length);
+		return ml_string(Value, Length);
+	}
+	case COLUMN_INT32: {
+		return ml_integer(column_int32_get(Column, Ref->Index));
+	}
+	case COLUMN_INT64: {
+		return ml_integer(column_int64_get(Column, Ref->Index));
+	}
+	case COLUMN_FLOAT32: {
+		return ml_real(column_float32_get(Column, Ref->Index));
+	}
+	case COLUMN_BOOL: {
+		return ml_integer(column_bool_get(Column, Ref->Index));
+	}
 	}
 	return MLNil;
 }
 
 static ml_value_t *column_ref_assign(column_ref_t *Ref, ml_value_t *Value) {
 	column_t *Column = Ref->Column;
+	if (Column->Frozen) return ml_error("FrozenError", "Column is frozen");
 	switch (Column->DataType) {
-	case COLUMN_STRING: {
+	case COLUMN_STRING:
+	case COLUMN_CATEGORY: {
 		if (Value->Type != MLStringT) return ml_error("TypeError", "Expected string");
 		column_string_set(Column, Ref->Index, ml_string_value(Value), ml_string_length(Value));
 		break;
@@ -383,6 +1764,36 @@ static ml_value_t *column_ref_assign(column_ref_t *Ref, ml_value_t *Value) {
 		}
 		break;
 	}
+	case COLUMN_INT32: {
+		if (Value->Type != MLIntegerT) return ml_error("TypeError", "Expected integer");
+		column_int32_set(Column, Ref->Index, ml_integer_value(Value));
+		break;
+	}
+	case COLUMN_INT64: {
+		if (Value->Type != MLIntegerT) return ml_error("TypeError", "Expected integer");
+		column_int64_set(Column, Ref->Index, ml_integer_value(Value));
+		break;
+	}
+	case COLUMN_FLOAT32: {
+		if (Value->Type == MLIntegerT) {
+			column_float32_set(Column, Ref->Index, ml_integer_value(Value));
+		} else if (Value->Type == MLRealT) {
+			column_float32_set(Column, Ref->Index, ml_real_value(Value));
+		} else {
+			return ml_error("TypeError", "Expected number");
+		}
+		break;
+	}
+	case COLUMN_BOOL: {
+		if (Value->Type == MLIntegerT) {
+			column_bool_set(Column, Ref->Index, ml_integer_value(Value) != 0);
+		} else if (Value == MLNil) {
+			column_bool_set(Column, Ref->Index, 0);
+		} else {
+			return ml_error("TypeError", "Expected integer");
+		}
+		break;
+	}
 	}
 	return Value;
 }
@@ -409,16 +1820,395 @@ static ml_value_t *ml_column_index(void *Data, int Count, ml_value_t **Args) {
 	return (ml_value_t *)ColumnRef;
 }
 
+/*
+bulk access decodes rows a block at a time with the range getters, so a pass
+over a column allocates only the values handed to minilang. Category values
+and bools are boxed once per pass instead of once per row.
+*/
+
+#define ML_BLOCK_SIZE 256
+
+static ml_value_t *BoolValues[2];
+
+typedef struct column_block_t {
+	column_t *Column;
+	ml_value_t **Categories;
+	size_t NumCategories, Start, Count;
+	union {
+		double Reals[ML_BLOCK_SIZE];
+		int32_t Int32s[ML_BLOCK_SIZE];
+		int64_t Int64s[ML_BLOCK_SIZE];
+		float Float32s[ML_BLOCK_SIZE];
+		uint8_t Bools[ML_BLOCK_SIZE];
+	};
+} column_block_t;
+
+static void column_block_init(column_block_t *Block, column_t *Column) {
+	Block->Column = Column;
+	Block->Start = Block->Count = 0;
+	Block->NumCategories = 0;
+	Block->Categories = NULL;
+	if (Column->DataType == COLUMN_CATEGORY) {
+		Block->NumCategories = column_category_count(Column);
+		Block->Categories = anew(ml_value_t *, Block->NumCategories + 1);
+	}
+}
+
+static void column_block_load(column_block_t *Block, size_t Index) {
+	column_t *Column = Block->Column;
+	size_t Start = Index - Index % ML_BLOCK_SIZE, Count = ML_BLOCK_SIZE;
+	switch (Column->DataType) {
+	case COLUMN_STRING:
+	case COLUMN_CATEGORY:
+		if (Count > Column->Dataset->Length - Start) Count = Column->Dataset->Length - Start;
+		break;
+	case COLUMN_REAL: Count = column_real_get_range(Column, Start, Count, Block->Reals); break;
+	case COLUMN_INT32: Count = column_int32_get_range(Column, Start, Count, Block->Int32s); break;
+	case COLUMN_INT64: Count = column_int64_get_range(Column, Start, Count, Block->Int64s); break;
+	case COLUMN_FLOAT32: Count = column_float32_get_range(Column, Start, Count, Block->Float32s); break;
+	case COLUMN_BOOL: Count = column_bool_get_range(Column, Start, Count, Block->Bools); break;
+	}
+	Block->Start = Start;
+	Block->Count = Count;
+}
+
+static ml_value_t *column_block_value(column_block_t *Block, size_t Index) {
+	if (Index - Block->Start >= Block->Count) column_block_load(Block, Index);
+	column_t *Column = Block->Column;
+	size_t I = Index - Block->Start;
+	switch (Column->DataType) {
+	case COLUMN_STRING: {
+		size_t Length = column_string_get_length(Column, Index);
+		char *Buffer = GC_malloc_atomic(Length + 1);
+		column_string_get_value(Column, Index, Buffer);
+		Buffer[Length] = 0;
+		return ml_string(Buffer, Length);
+	}
+	case COLUMN_CATEGORY: {
+		uint32_t Code = column_category_get_code(Column, Index);
+		if (Code < Block->NumCategories && Block->Categories[Code]) return Block->Categories[Code];
+		size_t Length;
+		const char *Value = column_category_value(Column, Code, &Length);
+		ml_value_t *String = ml_string(Value, Length);
+		if (Code < Block->NumCategories) Block->Categories[Code] = String;
+		return String;
+	}
+	case COLUMN_REAL: return ml_real(Block->Reals[I]);
+	case COLUMN_INT32: return ml_integer(Block->Int32s[I]);
+	case COLUMN_INT64: return ml_integer(Block->Int64s[I]);
+	case COLUMN_FLOAT32: return ml_real(Block->Float32s[I]);
+	case COLUMN_BOOL: return BoolValues[Block->Bools[I]];
+	}
+	return MLNil;
+}
+
+static ml_value_t *column_block_store(column_block_t *Block, size_t Index, ml_value_t *Value) {
+	// strings are written straight away, other values wait in the block for column_block_save
+	column_t *Column = Block->Column;
+	size_t I = Index - Block->Start;
+	switch (Column->DataType) {
+	case COLUMN_STRING:
+	case COLUMN_CATEGORY:
+		if (Value->Type != MLStringT) return ml_error("TypeError", "Expected string");
+		column_string_set(Column, Index, ml_string_value(Value), ml_string_length(Value));
+		break;
+	case COLUMN_REAL:
+		if (Value->Type == MLIntegerT) {
+			Block->Reals[I] = ml_integer_value(Value);
+		} else if (Value->Type == MLRealT) {
+			Block->Reals[I] = ml_real_value(Value);
+		} else {
+			return ml_error("TypeError", "Expected number");
+		}
+		break;
+	case COLUMN_INT32:
+		if (Value->Type != MLIntegerT) return ml_error("TypeError", "Expected integer");
+		Block->Int32s[I] = ml_integer_value(Value);
+		break;
+	case COLUMN_INT64:
+		if (Value->Type != MLIntegerT) return ml_error("TypeError", "Expected integer");
+		Block->Int64s[I] = ml_integer_value(Value);
+		break;
+	case COLUMN_FLOAT32:
+		if (Value->Type == MLIntegerT) {
+			Block->Float32s[I] = ml_integer_value(Value);
+		} else if (Value->Type == MLRealT) {
+			Block->Float32s[I] = ml_real_value(Value);
+		} else {
+			return ml_error("TypeError", "Expected number");
+		}
+		break;
+	case COLUMN_BOOL:
+		if (Value->Type == MLIntegerT) {
+			Block->Bools[I] = ml_integer_value(Value) != 0;
+		} else if (Value == MLNil) {
+			Block->Bools[I] = 0;
+		} else {
+			return ml_error("TypeError", "Expected integer");
+		}
+		break;
+	}
+	return NULL;
+}
+
+static void column_block_save(column_block_t *Block, size_t Offset, size_t Start, size_t Count) {
+	column_t *Column = Block->Column;
+	switch (Column->DataType) {
+	case COLUMN_STRING:
+	case COLUMN_CATEGORY: break;
+	case COLUMN_REAL: column_real_set_range(Column, Start, Count, Block->Reals + Offset); break;
+	case COLUMN_INT32: column_int32_set_range(Column, Start, Count, Block->Int32s + Offset); break;
+	case COLUMN_INT64: column_int64_set_range(Column, Start, Count, Block->Int64s + Offset); break;
+	case COLUMN_FLOAT32: column_float32_set_range(Column, Start, Count, Block->Float32s + Offset); break;
+	case COLUMN_BOOL: column_bool_set_range(Column, Start, Count, Block->Bools + Offset); break;
+	}
+}
+
+static ml_value_t *ml_column_rows(column_t *Column, int Count, ml_value_t **Args, int First, size_t *Start, size_t *End) {
+	// optional [From, To) row arguments starting at Args[First]
+	size_t Length = Column->Dataset->Length;
+	*Start = 0;
+	*End = Length;
+	if (Count > First) {
+		ML_CHECK_ARG_TYPE(First, MLIntegerT);
+		long From = ml_integer_value(Args[First]);
+		if (From < 0 || From > Length) return ml_error("RangeError", "Invalid row range");
+		*Start = From;
+	}
+	if (Count > First + 1) {
+		ML_CHECK_ARG_TYPE(First + 1, MLIntegerT);
+		long To = ml_integer_value(Args[First + 1]);
+		// compared as signed, a negative To would otherwise wrap to the end
+		if (To < 0 || To < (long)*Start) return ml_error("RangeError", "Invalid row range");
+		if (To < (long)Length) *End = To;
+	}
+	return NULL;
+}
+
+typedef struct column_range_t {
+	const ml_type_t *Type;
+	column_t *Column;
+	size_t Start, End;
+} column_range_t;
+
+typedef struct column_iter_t {
+	const ml_type_t *Type;
+	size_t Index, End;
+	column_block_t Block[1];
+} column_iter_t;
+
+static ml_value_t *column_iter_current(column_iter_t *Iter) {
+	return column_block_value(Iter->Block, Iter->Index);
+}
+
+static ml_value_t *column_iter_next(column_iter_t *Iter) {
+	// the iterator is advanced in place
+	if (++Iter->Index >= Iter->End) return MLNil;
+	return (ml_value_t *)Iter;
+}
+
+static ml_value_t *column_iter_key(column_iter_t *Iter) {
+	return ml_integer(Iter->Index);
+}
+
+static ml_type_t ColumnIterT[1] = {{
+	MLTypeT,
+	MLAnyT, "column-iter",
+	ml_default_hash,
+	ml_default_call,
+	ml_default_deref,
+	ml_default_assign,
+	ml_default_iterate,
+	(void *)column_iter_current,
+	(void *)column_iter_next,
+	(void *)column_iter_key
+}};
+
+static ml_value_t *column_iterate_rows(column_t *Column, size_t Start, size_t End) {
+	if (Start >= End) return MLNil;
+	column_iter_t *Iter = new(column_iter_t);
+	Iter->Type = ColumnIterT;
+	Iter->Index = Start;
+	Iter->End = End;
+	column_block_init(Iter->Block, Column);
+	return (ml_value_t *)Iter;
+}
+
+static ml_value_t *column_iterate(column_t *Column) {
+	return column_iterate_rows(Column, 0, Column->Dataset->Length);
+}
+
+static ml_value_t *column_range_iterate(column_range_t *Range) {
+	size_t End = Range->End;
+	if (End > Range->Column->Dataset->Length) End = Range->Column->Dataset->Length;
+	return column_iterate_rows(Range->Column, Range->Start, End);
+}
+
+static ml_type_t ColumnRangeT[1] = {{
+	MLTypeT,
+	MLAnyT, "column-range",
+	ml_default_hash,
+	ml_default_call,
+	ml_default_deref,
+	ml_default_assign,
+	(void *)column_range_iterate,
+	ml_default_current,
+	ml_default_next,
+	ml_default_key
+}};
+
+static ml_value_t *ml_column_range(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	column_range_t *Range = new(column_range_t);
+	ml_value_t *Error = ml_column_rows(Column, Count, Args, 1, &Range->Start, &Range->End);
+	if (Error) return Error;
+	Range->Type = ColumnRangeT;
+	Range->Column = Column;
+	return (ml_value_t *)Range;
+}
+
+static ml_value_t *ml_column_values(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	size_t Start, End;
+	ml_value_t *Error = ml_column_rows(Column, Count, Args, 1, &Start, &End);
+	if (Error) return Error;
+	column_block_t Block[1];
+	column_block_init(Block, Column);
+	ml_value_t *Values = ml_list();
+	for (size_t Index = Start; Index < End; ++Index) ml_list_append(Values, column_block_value(Block, Index));
+	return Values;
+}
+
+static ml_value_t *ml_column_map(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	ml_value_t *Function = Args[1];
+	size_t Start, End;
+	ml_value_t *Error = ml_column_rows(Column, Count, Args, 2, &Start, &End);
+	if (Error) return Error;
+	column_block_t Block[1];
+	column_block_init(Block, Column);
+	ml_value_t *Results = ml_list();
+	for (size_t Index = Start; Index < End; ++Index) {
+		ml_value_t *Value = column_block_value(Block, Index);
+		ml_value_t *Result = ml_call(Function, 1, &Value);
+		Result = Result->Type->deref(Result);
+		if (Result->Type == MLErrorT) return Result;
+		ml_list_append(Results, Result);
+	}
+	return Results;
+}
+
+static ml_value_t *ml_column_apply(void *Data, int Count, ml_value_t **Args) {
+	// replaces each value in the range with Function(Value), a block at a time
+	column_t *Column = (column_t *)Args[0];
+	ml_value_t *Function = Args[1];
+	if (Column->Frozen) return ml_error("FrozenError", "Column is frozen");
+	size_t Start, End;
+	ml_value_t *Error = ml_column_rows(Column, Count, Args, 2, &Start, &End);
+	if (Error) return Error;
+	column_block_t Block[1];
+	column_block_init(Block, Column);
+	for (size_t Index = Start; Index < End;) {
+		size_t Next = (Index / ML_BLOCK_SIZE + 1) * ML_BLOCK_SIZE;
+		if (Next > End) Next = End;
+		for (size_t I = Index; I < Next; ++I) {
+			ml_value_t *Value = column_block_value(Block, I);
+			ml_value_t *Result = ml_call(Function, 1, &Value);
+			Result = Result->Type->deref(Result);
+			if (Result->Type != MLErrorT) Result = column_block_store(Block, I, Result);
+			if (Result) {
+				column_block_save(Block, Index - Block->Start, Index, I - Index);
+				return Result;
+			}
+		}
+		column_block_save(Block, Index - Block->Start, Index, Next - Index);
+		Index = Next;
+	}
+	return (ml_value_t *)Column;
+}
+
+static ml_value_t *ml_column_fill(void *Data, int Count, ml_value_t **Args) {
+	column_t *Column = (column_t *)Args[0];
+	ml_value_t *Value = Args[1];
+	if (Column->Frozen) return ml_error("FrozenError", "Column is frozen");
+	size_t Start, End;
+	ml_value_t *Error = ml_column_rows(Column, Count, Args, 2, &Start, &End);
+	if (Error) return Error;
+	column_block_t Block[1];
+	column_block_init(Block, Column);
+	if (Column->DataType == COLUMN_STRING || Column->DataType == COLUMN_CATEGORY) {
+		for (size_t Index = Start; Index < End; ++Index) {
+			Error = column_block_store(Block, Index, Value);
+			if (Error) return Error;
+		}
+		return (ml_value_t *)Column;
+	}
+	// the value is converted once into a block which is then written repeatedly
+	Block->Count = ML_BLOCK_SIZE;
+	for (size_t I = 0; I < ML_BLOCK_SIZE; ++I) {
+		Error = column_block_store(Block, I, Value);
+		if (Error) return Error;
+	}
+	for (size_t Index = Start; Index < End; Index += ML_BLOCK_SIZE) {
+		size_t Rows = End - Index < ML_BLOCK_SIZE ? End - Index : ML_BLOCK_SIZE;
+		column_block_save(Block, 0, Index, Rows);
+	}
+	return (ml_value_t *)Column;
+}
+
 void dataset_init(stringmap_t *Globals) {
+	PageSize = sysconf(_SC_PAGESIZE);
 	DatasetT = ml_type(MLAnyT, "dataset");
 	ColumnT = ml_type(MLAnyT, "column");
+	ColumnT->iterate = (void *)column_iterate;
+	BoolValues[0] = ml_integer(0);
+	BoolValues[1] = ml_integer(1);
 	stringmap_insert(Globals, "dataset_open", ml_function(NULL, ml_dataset_open));
 	stringmap_insert(Globals, "dataset_create", ml_function(NULL, ml_dataset_create));
+	stringmap_insert(Globals, "dataset_import", ml_function(NULL, ml_dataset_import));
 	stringmap_insert(Globals, "COLUMN_REAL", ml_integer(COLUMN_REAL));
 	stringmap_insert(Globals, "COLUMN_STRING", ml_integer(COLUMN_STRING));
+	stringmap_insert(Globals, "COLUMN_CATEGORY", ml_integer(COLUMN_CATEGORY));
+	stringmap_insert(Globals, "COLUMN_INT32", ml_integer(COLUMN_INT32));
+	stringmap_insert(Globals, "COLUMN_INT64", ml_integer(COLUMN_INT64));
+	stringmap_insert(Globals, "COLUMN_FLOAT32", ml_integer(COLUMN_FLOAT32));
+	stringmap_insert(Globals, "COLUMN_BOOL", ml_integer(COLUMN_BOOL));
+	stringmap_insert(Globals, "STRING_LINKED", ml_integer(STRING_LINKED));
+	stringmap_insert(Globals, "STRING_PACKED", ml_integer(STRING_PACKED));
+	stringmap_insert(Globals, "ACCESS_NORMAL", ml_integer(ACCESS_NORMAL));
+	stringmap_insert(Globals, "ACCESS_SEQUENTIAL", ml_integer(ACCESS_SEQUENTIAL));
+	stringmap_insert(Globals, "ACCESS_RANDOM", ml_integer(ACCESS_RANDOM));
+	stringmap_insert(Globals, "PREFETCH_NONE", ml_integer(PREFETCH_NONE));
+	stringmap_insert(Globals, "PREFETCH_WILLNEED", ml_integer(PREFETCH_WILLNEED));
+	stringmap_insert(Globals, "PREFETCH_POPULATE", ml_integer(PREFETCH_POPULATE));
 	ml_method_by_name("column_count", NULL, ml_dataset_column_count, DatasetT, NULL);
 	ml_method_by_name("column_open", NULL, ml_dataset_column_open, DatasetT, MLIntegerT, NULL);
+	ml_method_by_name("column_open", NULL, ml_dataset_column_open_name, DatasetT, MLStringT, NULL);
 	ml_method_by_name("column_create", NULL, ml_dataset_column_create, DatasetT, MLStringT, MLIntegerT, NULL);
+	ml_method_by_name("flush", NULL, ml_dataset_flush, DatasetT, NULL);
+	ml_method_by_name("append", NULL, ml_dataset_append, DatasetT, MLIntegerT, NULL);
+	ml_method_by_name("count", NULL, ml_dataset_count, DatasetT, MLStringT, NULL);
+	ml_method_by_name("select", NULL, ml_dataset_select, DatasetT, MLStringT, NULL);
+	ml_method_by_name("flush", NULL, ml_column_flush, ColumnT, NULL);
+	ml_method_by_name("compact", NULL, ml_column_compact, ColumnT, NULL);
+	ml_method_by_name("freeze", NULL, ml_column_freeze, ColumnT, NULL);
+	ml_method_by_name("thaw", NULL, ml_column_thaw, ColumnT, NULL);
+	ml_method_by_name("policy", NULL, ml_column_policy, ColumnT, MLIntegerT, MLIntegerT, NULL);
+	ml_method_by_name("groups", NULL, ml_column_groups, ColumnT, NULL);
+	ml_method_by_name("count", NULL, ml_column_stat, ColumnT, NULL);
+	ml_method_by_name("sum", (void *)offsetof(column_stats_t, Sum), ml_column_stat, ColumnT, NULL);
+	ml_method_by_name("min", (void *)offsetof(column_stats_t, Min), ml_column_stat, ColumnT, NULL);
+	ml_method_by_name("max", (void *)offsetof(column_stats_t, Max), ml_column_stat, ColumnT, NULL);
+	ml_method_by_name("mean", (void *)offsetof(column_stats_t, Mean), ml_column_stat, ColumnT, NULL);
+	ml_method_by_name("variance", (void *)offsetof(column_stats_t, Variance), ml_column_stat, ColumnT, NULL);
+	ml_method_by_name("histogram", NULL, ml_column_histogram, ColumnT, MLIntegerT, NULL);
+	ml_method_by_name("index", NULL, ml_column_index_create, ColumnT, NULL);
+	ml_method_by_name("lookup", NULL, ml_column_lookup, ColumnT, MLStringT, NULL);
 	ml_method_by_name("string", NULL, ml_column_to_string, ColumnT, NULL);
 	ml_method_by_name("[]", NULL, ml_column_index, ColumnT, NULL);
+	ml_method_by_name("range", NULL, ml_column_range, ColumnT, NULL);
+	ml_method_by_name("values", NULL, ml_column_values, ColumnT, NULL);
+	ml_method_by_name("map", NULL, ml_column_map, ColumnT, MLAnyT, NULL);
+	ml_method_by_name("apply", NULL, ml_column_apply, ColumnT, MLAnyT, NULL);
+	ml_method_by_name("fill", NULL, ml_column_fill, ColumnT, MLAnyT, NULL);
 }
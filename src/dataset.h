@@ -2,37 +2,158 @@
 #define DATASET_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <jansson.h>
 #include "minilang/stringmap.h"
 
-typedef enum {COLUMN_STRING, COLUMN_REAL} column_type_t;
+typedef enum {COLUMN_STRING, COLUMN_REAL, COLUMN_CATEGORY, COLUMN_INT32, COLUMN_INT64, COLUMN_FLOAT32, COLUMN_BOOL} column_type_t;
+typedef enum {STRING_LINKED, STRING_PACKED} string_format_t;
+typedef enum {INDEX_NONE, INDEX_SORTED, INDEX_HASH} index_type_t;
+typedef enum {ACCESS_NORMAL, ACCESS_SEQUENTIAL, ACCESS_RANDOM} access_mode_t;
+typedef enum {PREFETCH_NONE, PREFETCH_WILLNEED, PREFETCH_POPULATE} prefetch_mode_t;
 
 typedef struct column_t column_t;
 
+typedef enum {SYNC_WRITE, SYNC_PERIODIC, SYNC_MANUAL} sync_mode_t;
+
+void dataset_set_sync_mode(sync_mode_t Mode, int Interval, int Writes);
+void dataset_set_change_feed(int Enabled);
+
 column_type_t column_get_type(column_t *Column);
 size_t column_get_length(column_t *Column);
+size_t column_get_index(column_t *Column);
+uint64_t column_get_version(column_t *Column);
+
+typedef struct column_counters_t {
+	uint64_t Reads, Writes, Remaps, Syncs;
+} column_counters_t;
+
+void column_get_counters(column_t *Column, column_counters_t *Counters);
+
+typedef struct column_policy_t {
+	access_mode_t Access;
+	prefetch_mode_t Prefetch;
+	int Lock, HugePages;
+} column_policy_t;
+
+void column_get_policy(column_t *Column, column_policy_t *Policy);
+int column_set_policy(column_t *Column, const column_policy_t *Policy);
+
+void column_lock_read(column_t *Column);
+void column_lock_write(column_t *Column);
+void column_unlock(column_t *Column);
+void column_flush(column_t *Column);
 
 size_t column_string_get_length(column_t *Column, size_t Index);
 void column_string_get_value(column_t *Column, size_t Index, char *Buffer);
+const char *column_string_get_pointer(column_t *Column, size_t Index);
 void column_string_set(column_t *Column, size_t Index, const char *Value, int Length);
+void column_string_set_range(column_t *Column, size_t Start, size_t Count, const char **Values, const int *Lengths);
+string_format_t column_string_get_format(column_t *Column);
+int column_compact(column_t *Column, string_format_t Format);
+
+int column_freeze(column_t *Column);
+int column_thaw(column_t *Column);
+int column_is_frozen(column_t *Column);
+
+size_t column_category_count(column_t *Column);
+const char *column_category_value(column_t *Column, uint32_t Code, size_t *Length);
+int64_t column_category_lookup(column_t *Column, const char *Value, int Length);
+uint32_t column_category_get_code(column_t *Column, size_t Index);
+void column_category_counts(column_t *Column, size_t Start, size_t Count, uint64_t *Counts);
 
 double column_real_get(column_t *Column, size_t Index);
 void column_real_set(column_t *Column, size_t Index, double Value);
+size_t column_real_get_range(column_t *Column, size_t Start, size_t Count, double *Values);
+size_t column_real_set_range(column_t *Column, size_t Start, size_t Count, const double *Values);
+
+int32_t column_int32_get(column_t *Column, size_t Index);
+void column_int32_set(column_t *Column, size_t Index, int32_t Value);
+size_t column_int32_get_range(column_t *Column, size_t Start, size_t Count, int32_t *Values);
+size_t column_int32_set_range(column_t *Column, size_t Start, size_t Count, const int32_t *Values);
+
+int64_t column_int64_get(column_t *Column, size_t Index);
+void column_int64_set(column_t *Column, size_t Index, int64_t Value);
+size_t column_int64_get_range(column_t *Column, size_t Start, size_t Count, int64_t *Values);
+size_t column_int64_set_range(column_t *Column, size_t Start, size_t Count, const int64_t *Values);
+
+float column_float32_get(column_t *Column, size_t Index);
+void column_float32_set(column_t *Column, size_t Index, float Value);
+size_t column_float32_get_range(column_t *Column, size_t Start, size_t Count, float *Values);
+size_t column_float32_set_range(column_t *Column, size_t Start, size_t Count, const float *Values);
+
+int column_bool_get(column_t *Column, size_t Index);
+void column_bool_set(column_t *Column, size_t Index, int Value);
+size_t column_bool_get_range(column_t *Column, size_t Start, size_t Count, uint8_t *Values);
+size_t column_bool_set_range(column_t *Column, size_t Start, size_t Count, const uint8_t *Values);
+size_t column_bool_count(column_t *Column, size_t Start, size_t Count);
+
+int column_is_numeric(column_t *Column);
+double column_number_get(column_t *Column, size_t Index);
+
+const void *column_pin(column_t *Column, size_t Start, size_t *Width);
+void column_unpin(column_t *Column);
+
+int column_index_create(column_t *Column);
+int column_index_drop(column_t *Column);
+index_type_t column_index_type(column_t *Column);
+size_t column_sorted_lower(column_t *Column, double Value);
+size_t column_sorted_upper(column_t *Column, double Value);
+size_t column_sorted_count(column_t *Column);
+size_t column_sorted_rows(column_t *Column, size_t Position, size_t Count, int Reverse, size_t *Rows);
+size_t column_string_lookup(column_t *Column, const char *Value, int Length, size_t *Rows, size_t Max);
+
+typedef struct column_stats_t {
+	size_t Count;
+	double Sum, Min, Max, Mean, Variance;
+} column_stats_t;
+
+int column_aggregate(column_t *Column, size_t Start, size_t Count, column_stats_t *Stats);
+int column_histogram(column_t *Column, size_t Start, size_t Count, double Min, double Max, int NumBuckets, uint64_t *Buckets);
 
 typedef struct dataset_t dataset_t;
 
 dataset_t *dataset_create(const char *Path, const char *Name, size_t Length);
 dataset_t *dataset_open(const char *Path);
+dataset_t *dataset_import(const char *Path, const char *Name, const char *FileName, int NumTypes, const column_type_t *Types);
 
+const char *dataset_get_name(dataset_t *Dataset);
 json_t *dataset_get_info(dataset_t *Dataset);
 size_t dataset_get_length(dataset_t *Dataset);
+uint64_t dataset_get_version(dataset_t *Dataset);
+// Fill, if given, writes the new rows while every column is still write locked
+int dataset_append(dataset_t *Dataset, size_t Count, size_t *Start, void (*Fill)(size_t Start, void *Data), void *Data);
+void dataset_prefetch(dataset_t *Dataset);
+dataset_t *dataset_snapshot(dataset_t *Dataset, const char *Path);
+void dataset_close(dataset_t *Dataset);
 
 size_t dataset_get_column_count(dataset_t *Dataset);
 column_type_t dataset_get_column_type(dataset_t *Dataset, size_t Index);
 const char *dataset_get_column_name(dataset_t *Dataset, size_t Index);
+int dataset_get_column_index(dataset_t *Dataset, const char *Name);
+int dataset_get_column_counters(dataset_t *Dataset, size_t Index, column_counters_t *Counters);
+uint64_t dataset_get_column_version(dataset_t *Dataset, size_t Index);
+
+#define COLUMN_MAX_CHANGES 16
+
+typedef struct column_change_t {
+	size_t Start, Count;
+} column_change_t;
+
+column_t *dataset_take_changed(dataset_t *Dataset);
+int column_take_changes(column_t *Column, column_change_t *Changes);
 
 column_t *dataset_column_create(dataset_t *Dataset, const char *Name, column_type_t Type);
 column_t *dataset_column_open(dataset_t *Dataset, size_t Index);
+void dataset_flush(dataset_t *Dataset);
+
+typedef struct query_t query_t;
+
+query_t *query_compile(dataset_t *Dataset, json_t *Json, const char **Error);
+// returns NULL if a column was frozen after the query was compiled, Scanned is the number of rows in the bitmap
+uint64_t *query_run(query_t *Query, size_t *Scanned, size_t *Count);
+size_t query_next(const uint64_t *Bitmap, size_t Length, size_t Index);
+void query_free(query_t *Query);
 
 void dataset_init(stringmap_t *Globals);
 
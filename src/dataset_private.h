@@ -0,0 +1,348 @@
+#ifndef DATASET_PRIVATE_H
+#define DATASET_PRIVATE_H
+
+#include "dataset.h"
+#include "minilang/minilang.h"
+#include "minilang/stringmap.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+string column structure (with N values):
+	header
+	entry * N
+	nodes * header->count
+*/
+
+typedef struct string_header_t {
+	int32_t FreeStart, FreeCount;
+} string_header_t;
+
+typedef struct string_entry_t {
+	int32_t Link, Length;
+} string_entry_t;
+
+typedef union string_node_t {
+	struct { int32_t Link; char Small[12]; };
+	char Large[16];
+} string_node_t;
+
+/*
+packed string column structure (with N values):
+	header
+	entry * N
+with the bytes of every value stored contiguously in a separate heap file.
+Values are rewritten in place when they fit their slot, otherwise appended
+to the heap, leaving the old slot as garbage until the column is compacted.
+*/
+
+typedef struct packed_header_t {
+	uint64_t HeapUsed, Garbage;
+} packed_header_t;
+
+typedef struct packed_entry_t {
+	uint64_t Offset;
+	uint32_t Length, Capacity;
+} packed_entry_t;
+
+/*
+category column structure (with N values):
+	header
+	code * N (1, 2 or 4 bytes each, widened as the dictionary grows)
+with the dictionary appended to a separate <N>.dict file as (length, bytes)
+records. Code 0 is always the empty string. Values may contain NUL bytes, so
+the in memory index is an open addressing table of code + 1 keyed by the
+(bytes, length) of each value, at most half full.
+*/
+
+typedef struct category_header_t {
+	uint32_t Width, Count;
+} category_header_t;
+
+typedef struct category_t {
+	const char **Values;
+	uint32_t *Lengths;
+	size_t Count, Size;
+	uint32_t *Slots;
+	size_t Mask;
+	int Fd;
+} category_t;
+
+/*
+numeric columns are plain arrays of N values, except bool columns which
+pack 64 rows into each uint64_t word, row I at bit I % 64 of word I / 64.
+*/
+
+static inline size_t column_bool_words(size_t Length) {
+	return (Length + 63) / 64;
+}
+
+/*
+column indexes are stored in a separate <N>.index file, either
+	row * N (uint32_t)
+sorted by value for real columns, or
+	header
+	slot * capacity
+an open addressing hash table of (hash, row) pairs for string columns.
+*/
+
+typedef struct hash_header_t {
+	uint64_t Capacity, Tombstones;
+} hash_header_t;
+
+typedef struct hash_slot_t {
+	uint32_t Hash, Row;
+} hash_slot_t;
+
+/*
+frozen columns are read only and stored in a separate <N>.lz4 file as
+	header
+	block * header->count (LZ4 compressed)
+	chunk * header->count
+each block holding a run of rows in the layout of the plain column (codes
+for category columns) or, for string columns,
+	offset * (rows + 1) (uint32_t)
+	bytes
+Recently used blocks are kept decompressed in a small per-column cache.
+*/
+
+typedef struct frozen_header_t {
+	uint64_t Length, NumChunks, ChunksOffset;
+	uint32_t Width, Count;
+} frozen_header_t;
+
+typedef struct frozen_chunk_t {
+	uint64_t Row, Offset;
+	uint32_t Rows, Size, RawSize, Reserved;
+} frozen_chunk_t;
+
+#define FROZEN_CACHE_SIZE 4
+
+typedef struct frozen_slot_t {
+	const frozen_chunk_t *Chunk;
+	char *Data;
+	size_t Size;
+	uint64_t Used;
+} frozen_slot_t;
+
+typedef struct frozen_cache_t {
+	pthread_mutex_t Lock[1];
+	frozen_slot_t Slots[FROZEN_CACHE_SIZE];
+	uint64_t Tick;
+} frozen_cache_t;
+
+/*
+real and string columns keep a zone map in a separate <N>.zones file as
+	header
+	zone * ceil(N / ZONE_SIZE)
+summarising each run of ZONE_SIZE rows by the min and max of its values,
+or the range of lengths and 8 byte big endian prefixes for strings, and an
+exact count of NaNs (empty strings). Bounds only ever widen on writes, a
+zone is rescanned once enough writes may have loosened them. The file is
+marked clean whenever the values are synced, unmarked before the next write
+changes it, and rebuilt on open if it was not clean.
+*/
+
+#define ZONE_SIZE (1 << 16)
+#define ZONE_REBUILD (ZONE_SIZE / 8)
+
+typedef struct zone_header_t {
+	uint64_t NumZones;
+	uint32_t ZoneSize, Clean;
+} zone_header_t;
+
+typedef struct zone_t {
+	union {
+		struct { double Min, Max; };
+		struct { uint64_t MinPrefix, MaxPrefix; };
+	};
+	uint32_t Nulls, MinLength, MaxLength, Loose;
+} zone_t;
+
+typedef struct column_mapping_t column_mapping_t;
+
+struct column_mapping_t {
+	column_mapping_t *Next;
+	void *Map;
+	size_t Size;
+};
+
+typedef struct dirty_t {
+	uint64_t *Bits;
+	size_t Words;
+} dirty_t;
+
+struct column_t {
+	const ml_type_t *Type;
+	dataset_t *Dataset;
+	const char *Name;
+	union {
+		void *Map;
+		struct {
+			string_header_t Header;
+			string_entry_t Entries[];
+		} *Strings;
+		struct {
+			packed_header_t Header;
+			packed_entry_t Entries[];
+		} *Packed;
+		struct {
+			category_header_t Header;
+			char Codes[];
+		} *Categories;
+		double *Reals;
+		int32_t *Int32s;
+		int64_t *Int64s;
+		float *Float32s;
+		uint64_t *Bools;
+		frozen_header_t *Compressed;
+	};
+	category_t *Dictionary;
+	size_t MapSize, Index;
+	int Mapped, Frozen;
+	frozen_cache_t *Cache;
+	column_type_t DataType;
+	string_format_t Format;
+	int Fd, HeapFd;
+	char *Heap;
+	size_t HeapSize;
+	index_type_t IndexType;
+	int IndexFd;
+	union {
+		void *IndexMap;
+		uint32_t *Sorted;
+		struct {
+			hash_header_t Header;
+			hash_slot_t Slots[];
+		} *Hashes;
+	};
+	size_t IndexSize;
+	struct {
+		zone_header_t Header;
+		zone_t Entries[];
+	} *Zones;
+	size_t ZonesSize;
+	int ZonesFd;
+	pthread_rwlock_t Lock[1];
+	pthread_mutex_t SyncLock[1], PinLock[1];
+	column_change_t Changes[COLUMN_MAX_CHANGES];
+	int NumChanges;
+	column_t *NextChanged;
+	column_mapping_t *Retired;
+	size_t Pins;
+	dirty_t Dirty[1], HeapDirty[1], IndexDirty[1];
+	size_t Writes;
+	int64_t SyncTime;
+	column_counters_t Counters;
+	column_policy_t Policy[1];
+	// bumped after every change to the values
+	uint64_t Version;
+};
+
+struct dataset_t {
+	const ml_type_t *Type;
+	const char *Path, *Name, *InfoFile;
+	column_t **Columns;
+	size_t NumColumns, MaxColumns;
+	stringmap_t ColumnIndex[1];
+	json_t *Info;
+	size_t Length, Capacity;
+	pthread_mutex_t Lock[1], ChangeLock[1];
+	column_t *Changed;
+	// bumped when rows or columns are added
+	uint64_t Version;
+};
+
+static inline column_t *dataset_column(dataset_t *Dataset, size_t Index) {
+	// Columns is always published before NumColumns, and old arrays are never modified
+	if (Index >= __atomic_load_n(&Dataset->NumColumns, __ATOMIC_ACQUIRE)) return NULL;
+	return __atomic_load_n(&Dataset->Columns, __ATOMIC_ACQUIRE)[Index];
+}
+
+static inline void column_count(uint64_t *Counter) {
+	__atomic_fetch_add(Counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline int string_block_count(size_t Length) {
+	return Length > 16 ? 1 + (Length - 5) / 12 : 1;
+}
+
+static inline void string_fill(string_entry_t *Entry, string_node_t *Nodes, size_t *Next, const char *Value, size_t Length) {
+	int32_t Link = *Next;
+	Entry->Link = Link;
+	Entry->Length = Length;
+	string_node_t *Node = Nodes + Link;
+	while (Length > 16) {
+		memcpy(Node->Small, Value, 12);
+		Node->Link = ++Link;
+		Value += 12;
+		Length -= 12;
+		Node = Nodes + Link;
+	}
+	memcpy(Node->Large, Value, Length);
+	*Next = Link + 1;
+}
+
+static inline uint32_t hash_string(const char *Value, size_t Length) {
+	uint32_t Hash = 2166136261U;
+	for (size_t I = 0; I < Length; ++I) Hash = (Hash ^ (uint8_t)Value[I]) * 16777619U;
+	return Hash;
+}
+
+static inline uint32_t category_get(column_t *Column, size_t Index) {
+	switch (Column->Categories->Header.Width) {
+	case 1: return ((uint8_t *)Column->Categories->Codes)[Index];
+	case 2: return ((uint16_t *)Column->Categories->Codes)[Index];
+	default: return ((uint32_t *)Column->Categories->Codes)[Index];
+	}
+}
+
+uint32_t category_code(column_t *Column, const char *Value, int Length);
+void category_put(column_t *Column, size_t Index, uint32_t Code);
+void category_resize(column_t *Column, int Width);
+
+void column_dirty(column_t *Column, const void *Address, size_t Size);
+void column_commit(column_t *Column);
+void *column_map_file(const char *FileName, size_t Size, int *Fd);
+void column_retire(column_t *Column);
+int column_advise(column_t *Column);
+
+int column_index_open(column_t *Column);
+int column_index_append(column_t *Column, size_t Start, size_t Count);
+void sorted_update(column_t *Column, size_t Row, double Value);
+void sorted_update_range(column_t *Column, size_t Start, size_t Count, const double *Values);
+uint32_t hash_row(column_t *Column, size_t Row);
+void hash_update(column_t *Column, size_t Row, uint32_t OldHash, const char *Value, size_t Length);
+
+int column_zones_open(column_t *Column);
+void column_zones_close(column_t *Column);
+void column_zones_sync(column_t *Column);
+int column_zones_append(column_t *Column, size_t Start, size_t Count);
+void zones_real_update(column_t *Column, size_t Start, size_t Count, const double *Values);
+void zones_string_update(column_t *Column, size_t Row, const char *Value, size_t Length);
+
+static inline const zone_t *column_zone(column_t *Column, size_t Row) {
+	if (!Column->Zones) return NULL;
+	size_t Zone = Row / ZONE_SIZE;
+	return Zone < Column->Zones->Header.NumZones ? Column->Zones->Entries + Zone : NULL;
+}
+
+static inline uint64_t zone_prefix(const char *Value, size_t Length) {
+	uint64_t Prefix = 0;
+	for (int I = 0; I < 8; ++I) Prefix = (Prefix << 8) | (I < Length ? (uint8_t)Value[I] : 0);
+	return Prefix;
+}
+
+int frozen_open(column_t *Column);
+void frozen_close(column_t *Column);
+size_t frozen_read(column_t *Column, size_t Start, size_t Count, void *Values);
+uint32_t frozen_code(column_t *Column, size_t Index);
+size_t frozen_string_length(column_t *Column, size_t Index);
+void frozen_string_value(column_t *Column, size_t Index, char *Buffer);
+void frozen_category_counts(column_t *Column, size_t Start, size_t Count, uint64_t *Counts);
+
+dataset_t *dataset_new(const char *Path, const char *Name, size_t Length);
+column_t *dataset_column_alloc(dataset_t *Dataset, const char *Name, column_type_t Type, size_t NodeCount);
+
+#endif
@@ -0,0 +1,439 @@
+#include "dataset.h"
+#include "dataset_private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <lz4.h>
+
+/*
+numeric and category blocks hold FROZEN_CHUNK_ROWS rows, string blocks end
+early once their values pass FROZEN_CHUNK_BYTES so that a block always
+decompresses into a modest buffer. Blocks are found by binary search on
+their first row, the cache is checked first so sequential reads only
+search once per block.
+*/
+
+#define FROZEN_CHUNK_ROWS 65536
+#define FROZEN_CHUNK_BYTES (1 << 20)
+
+static void frozen_file(column_t *Column, char *FileName, const char *Suffix) {
+	sprintf(FileName, "%s/%d%s", Column->Dataset->Path, (int)Column->Index, Suffix);
+}
+
+static const frozen_chunk_t *frozen_chunks(column_t *Column) {
+	return (const frozen_chunk_t *)((const char *)Column->Map + Column->Compressed->ChunksOffset);
+}
+
+static const frozen_chunk_t *frozen_find(column_t *Column, size_t Row) {
+	const frozen_chunk_t *Chunks = frozen_chunks(Column);
+	size_t Lo = 0, Hi = Column->Compressed->NumChunks;
+	while (Hi - Lo > 1) {
+		size_t Mid = (Lo + Hi) / 2;
+		if (Chunks[Mid].Row <= Row) Lo = Mid; else Hi = Mid;
+	}
+	return Chunks + Lo;
+}
+
+static const char *frozen_load(column_t *Column, size_t Row, const frozen_chunk_t **Found) {
+	// called with the cache locked
+	frozen_cache_t *Cache = Column->Cache;
+	frozen_slot_t *Victim = Cache->Slots;
+	for (int I = 0; I < FROZEN_CACHE_SIZE; ++I) {
+		frozen_slot_t *Slot = Cache->Slots + I;
+		const frozen_chunk_t *Chunk = Slot->Chunk;
+		if (Chunk && Row >= Chunk->Row && Row < Chunk->Row + Chunk->Rows) {
+			Slot->Used = ++Cache->Tick;
+			*Found = Chunk;
+			return Slot->Data;
+		}
+		if (Victim->Used > Slot->Used) Victim = Slot;
+	}
+	const frozen_chunk_t *Chunk = frozen_find(Column, Row);
+	if (Victim->Size < Chunk->RawSize) {
+		Victim->Data = realloc(Victim->Data, Chunk->RawSize);
+		Victim->Size = Chunk->RawSize;
+	}
+	const char *Block = (const char *)Column->Map + Chunk->Offset;
+	if (LZ4_decompress_safe(Block, Victim->Data, Chunk->Size, Chunk->RawSize) != Chunk->RawSize) {
+		Victim->Chunk = NULL;
+		Victim->Used = 0;
+		return NULL;
+	}
+	Victim->Chunk = Chunk;
+	Victim->Used = ++Cache->Tick;
+	*Found = Chunk;
+	return Victim->Data;
+}
+
+size_t frozen_read(column_t *Column, size_t Start, size_t Count, void *Values) {
+	size_t Length = Column->Dataset->Length;
+	if (Start >= Length) return 0;
+	if (Count > Length - Start) Count = Length - Start;
+	size_t Width = Column->Compressed->Width;
+	char *Out = (char *)Values;
+	frozen_cache_t *Cache = Column->Cache;
+	pthread_mutex_lock(Cache->Lock);
+	for (size_t Row = Start, End = Start + Count; Row < End;) {
+		const frozen_chunk_t *Chunk;
+		const char *Data = frozen_load(Column, Row, &Chunk);
+		if (!Data) break;
+		size_t Rows = Chunk->Row + Chunk->Rows - Row;
+		if (Rows > End - Row) Rows = End - Row;
+		memcpy(Out, Data + (Row - Chunk->Row) * Width, Rows * Width);
+		Out += Rows * Width;
+		Row += Rows;
+	}
+	pthread_mutex_unlock(Cache->Lock);
+	return (Out - (char *)Values) / Width;
+}
+
+uint32_t frozen_code(column_t *Column, size_t Index) {
+	union {
+		uint8_t Code8;
+		uint16_t Code16;
+		uint32_t Code32;
+	} Code = {0};
+	frozen_read(Column, Index, 1, &Code);
+	switch (Column->Compressed->Width) {
+	case 1: return Code.Code8;
+	case 2: return Code.Code16;
+	default: return Code.Code32;
+	}
+}
+
+size_t frozen_string_length(column_t *Column, size_t Index) {
+	if (Column->DataType == COLUMN_CATEGORY) return Column->Dictionary->Lengths[frozen_code(Column, Index)];
+	size_t Length = 0;
+	frozen_cache_t *Cache = Column->Cache;
+	pthread_mutex_lock(Cache->Lock);
+	const frozen_chunk_t *Chunk;
+	const uint32_t *Offsets = (const uint32_t *)frozen_load(Column, Index, &Chunk);
+	if (Offsets) Length = Offsets[Index - Chunk->Row + 1] - Offsets[Index - Chunk->Row];
+	pthread_mutex_unlock(Cache->Lock);
+	return Length;
+}
+
+void frozen_string_value(column_t *Column, size_t Index, char *Buffer) {
+	if (Column->DataType == COLUMN_CATEGORY) {
+		uint32_t Code = frozen_code(Column, Index);
+		memcpy(Buffer, Column->Dictionary->Values[Code], Column->Dictionary->Lengths[Code]);
+		return;
+	}
+	frozen_cache_t *Cache = Column->Cache;
+	pthread_mutex_lock(Cache->Lock);
+	const frozen_chunk_t *Chunk;
+	const uint32_t *Offsets = (const uint32_t *)frozen_load(Column, Index, &Chunk);
+	if (Offsets) {
+		const char *Bytes = (const char *)(Offsets + Chunk->Rows + 1);
+		size_t I = Index - Chunk->Row;
+		memcpy(Buffer, Bytes + Offsets[I], Offsets[I + 1] - Offsets[I]);
+	}
+	pthread_mutex_unlock(Cache->Lock);
+}
+
+void frozen_category_counts(column_t *Column, size_t Start, size_t Count, uint64_t *Counts) {
+	int Width = Column->Compressed->Width;
+	frozen_cache_t *Cache = Column->Cache;
+	pthread_mutex_lock(Cache->Lock);
+	for (size_t Row = Start, End = Start + Count; Row < End;) {
+		const frozen_chunk_t *Chunk;
+		const char *Data = frozen_load(Column, Row, &Chunk);
+		if (!Data) break;
+		size_t First = Row - Chunk->Row, Last = Chunk->Rows;
+		if (Last > End - Chunk->Row) Last = End - Chunk->Row;
+		switch (Width) {
+		case 1:
+			for (size_t I = First; I < Last; ++I) ++Counts[((const uint8_t *)Data)[I]];
+			break;
+		case 2:
+			for (size_t I = First; I < Last; ++I) ++Counts[((const uint16_t *)Data)[I]];
+			break;
+		default:
+			for (size_t I = First; I < Last; ++I) ++Counts[((const uint32_t *)Data)[I]];
+			break;
+		}
+		Row = Chunk->Row + Last;
+	}
+	pthread_mutex_unlock(Cache->Lock);
+}
+
+int frozen_open(column_t *Column) {
+	char FileName[strlen(Column->Dataset->Path) + 32];
+	frozen_file(Column, FileName, ".lz4");
+	struct stat Stat[1];
+	if (stat(FileName, Stat)) return -1;
+	int Fd = open(FileName, O_RDONLY);
+	if (Fd < 0) return -1;
+	void *Map = mmap(NULL, Stat->st_size, PROT_READ, MAP_SHARED, Fd, 0);
+	if (Map == MAP_FAILED) {
+		close(Fd);
+		return -1;
+	}
+	Column->Map = Map;
+	Column->MapSize = Stat->st_size;
+	Column->Fd = Fd;
+	frozen_cache_t *Cache = Column->Cache = calloc(1, sizeof(frozen_cache_t));
+	pthread_mutex_init(Cache->Lock, NULL);
+	return 0;
+}
+
+void frozen_close(column_t *Column) {
+	munmap(Column->Map, Column->MapSize);
+	close(Column->Fd);
+	frozen_cache_t *Cache = Column->Cache;
+	for (int I = 0; I < FROZEN_CACHE_SIZE; ++I) free(Cache->Slots[I].Data);
+	pthread_mutex_destroy(Cache->Lock);
+	free(Cache);
+	Column->Cache = NULL;
+}
+
+static void frozen_save(column_t *Column, int Frozen) {
+	dataset_t *Dataset = Column->Dataset;
+	pthread_mutex_lock(Dataset->Lock);
+	json_t *ColumnJson = json_array_get(json_object_get(Dataset->Info, "columns"), Column->Index);
+	if (Frozen) {
+		json_object_set_new(ColumnJson, "frozen", json_true());
+	} else {
+		json_object_del(ColumnJson, "frozen");
+		if (Column->DataType == COLUMN_STRING) json_object_set_new(ColumnJson, "format", json_integer(STRING_PACKED));
+	}
+	json_dump_file(Dataset->Info, Dataset->InfoFile, 0);
+	pthread_mutex_unlock(Dataset->Lock);
+}
+
+static int frozen_width(column_t *Column) {
+	switch (Column->DataType) {
+	case COLUMN_REAL: return sizeof(double);
+	case COLUMN_INT32: return sizeof(int32_t);
+	case COLUMN_INT64: return sizeof(int64_t);
+	case COLUMN_FLOAT32: return sizeof(float);
+	case COLUMN_CATEGORY: return Column->Categories->Header.Width;
+	case COLUMN_STRING: return 0;
+	default: return -1;
+	}
+}
+
+static void *frozen_reserve(void *Buffer, size_t *Size, size_t Required) {
+	if (*Size >= Required) return Buffer;
+	*Size = Required;
+	return realloc(Buffer, Required);
+}
+
+int column_freeze(column_t *Column) {
+	// called with the column write locked
+	if (Column->Frozen) return 0;
+	int Width = frozen_width(Column);
+	if (Width < 0 || Column->IndexType == INDEX_SORTED) return -1;
+	dataset_t *Dataset = Column->Dataset;
+	size_t Length = Dataset->Length;
+	char FileName[strlen(Dataset->Path) + 32], TempName[strlen(Dataset->Path) + 32];
+	frozen_file(Column, FileName, ".lz4");
+	frozen_file(Column, TempName, ".lz4.tmp");
+	int Fd = open(TempName, O_RDWR | O_CREAT | O_TRUNC, 0777);
+	if (Fd < 0) return -1;
+	const char *Base = (Column->DataType == COLUMN_CATEGORY) ? Column->Categories->Codes : (const char *)Column->Map;
+	size_t NumChunks = 0, MaxChunks = Length / FROZEN_CHUNK_ROWS + 1;
+	frozen_chunk_t *Chunks = malloc(MaxChunks * sizeof(frozen_chunk_t));
+	char *Raw = NULL, *Block = NULL;
+	size_t RawSize = 0, BlockSize = 0, Offset = sizeof(frozen_header_t);
+	int Status = 0;
+	for (size_t Row = 0; Row < Length;) {
+		size_t Rows = 0, Size;
+		if (Width) {
+			Rows = Length - Row;
+			if (Rows > FROZEN_CHUNK_ROWS) Rows = FROZEN_CHUNK_ROWS;
+			Size = Rows * Width;
+			Raw = frozen_reserve(Raw, &RawSize, Size);
+			memcpy(Raw, Base + Row * Width, Size);
+		} else {
+			size_t Bytes = 0;
+			while (Row + Rows < Length && Rows < FROZEN_CHUNK_ROWS && Bytes < FROZEN_CHUNK_BYTES) {
+				Bytes += column_string_get_length(Column, Row + Rows);
+				++Rows;
+			}
+			Size = (Rows + 1) * sizeof(uint32_t) + Bytes;
+			Raw = frozen_reserve(Raw, &RawSize, Size);
+			uint32_t *Offsets = (uint32_t *)Raw;
+			char *Values = (char *)(Offsets + Rows + 1);
+			uint32_t Total = 0;
+			for (size_t I = 0; I < Rows; ++I) {
+				Offsets[I] = Total;
+				column_string_get_value(Column, Row + I, Values + Total);
+				Total += column_string_get_length(Column, Row + I);
+			}
+			Offsets[Rows] = Total;
+		}
+		int Bound = LZ4_compressBound(Size);
+		Block = frozen_reserve(Block, &BlockSize, Bound);
+		int Compressed = LZ4_compress_default(Raw, Block, Size, Bound);
+		if (Compressed <= 0 || pwrite(Fd, Block, Compressed, Offset) != Compressed) {
+			Status = -1;
+			break;
+		}
+		if (NumChunks == MaxChunks) {
+			MaxChunks *= 2;
+			Chunks = realloc(Chunks, MaxChunks * sizeof(frozen_chunk_t));
+		}
+		frozen_chunk_t *Chunk = Chunks + NumChunks++;
+		Chunk->Row = Row;
+		Chunk->Offset = Offset;
+		Chunk->Rows = Rows;
+		Chunk->Size = Compressed;
+		Chunk->RawSize = Size;
+		Chunk->Reserved = 0;
+		Offset += Compressed;
+		Row += Rows;
+	}
+	free(Raw);
+	free(Block);
+	// the chunk index is read in place from the mapping
+	Offset = (Offset + 7) & ~(size_t)7;
+	frozen_header_t Header[1] = {{Length, NumChunks, Offset, Width, Column->Dictionary ? Column->Dictionary->Count : 0}};
+	size_t ChunksSize = NumChunks * sizeof(frozen_chunk_t);
+	if (!Status && pwrite(Fd, Chunks, ChunksSize, Offset) != ChunksSize) Status = -1;
+	if (!Status && pwrite(Fd, Header, sizeof(frozen_header_t), 0) != sizeof(frozen_header_t)) Status = -1;
+	if (!Status && fdatasync(Fd)) Status = -1;
+	free(Chunks);
+	close(Fd);
+	if (Status || rename(TempName, FileName)) {
+		unlink(TempName);
+		return -1;
+	}
+	frozen_save(Column, 1);
+	// the values cannot change while frozen, so the zone map is kept for thawing
+	column_zones_close(Column);
+	// slices pinned from the plain column stay valid until they are released
+	column_retire(Column);
+	close(Column->Fd);
+	frozen_file(Column, FileName, "");
+	unlink(FileName);
+	if (Column->Heap) {
+		munmap(Column->Heap, Column->HeapSize);
+		close(Column->HeapFd);
+		Column->Heap = NULL;
+		Column->HeapSize = 0;
+		frozen_file(Column, FileName, ".heap");
+		unlink(FileName);
+	}
+	Column->Dirty->Words = Column->HeapDirty->Words = 0;
+	Column->Frozen = 1;
+	column_count(&Column->Counters.Remaps);
+	if (frozen_open(Column)) return -1;
+	column_advise(Column);
+	return 0;
+}
+
+int column_thaw(column_t *Column) {
+	// called with the column write locked, rows are restored at the dataset capacity
+	if (!Column->Frozen) return 0;
+	dataset_t *Dataset = Column->Dataset;
+	size_t Capacity = Dataset->Capacity;
+	const frozen_header_t *Header = Column->Compressed;
+	const frozen_chunk_t *Chunks = frozen_chunks(Column);
+	size_t Width = Header->Width;
+	char FileName[strlen(Dataset->Path) + 32], TempName[strlen(Dataset->Path) + 32];
+	char HeapName[strlen(Dataset->Path) + 32], TempHeapName[strlen(Dataset->Path) + 32];
+	frozen_file(Column, FileName, "");
+	frozen_file(Column, TempName, ".tmp");
+	frozen_file(Column, HeapName, ".heap");
+	frozen_file(Column, TempHeapName, ".heap.tmp");
+	int Fd, HeapFd = -1;
+	char *Map, *Heap = NULL;
+	size_t MapSize, HeapSize = 0;
+	char *Raw = NULL;
+	size_t RawSize = 0;
+	int Status = 0;
+	if (Column->DataType == COLUMN_STRING) {
+		size_t Total = 0;
+		for (size_t I = 0; I < Header->NumChunks; ++I) Total += Chunks[I].RawSize - (Chunks[I].Rows + 1) * sizeof(uint32_t);
+		size_t PageSize = sysconf(_SC_PAGESIZE);
+		HeapSize = Total > PageSize ? Total : PageSize;
+		Heap = column_map_file(TempHeapName, HeapSize, &HeapFd);
+		if (!Heap) return -1;
+		MapSize = sizeof(packed_header_t) + Capacity * sizeof(packed_entry_t);
+		Map = column_map_file(TempName, MapSize, &Fd);
+		if (!Map) {
+			munmap(Heap, HeapSize);
+			close(HeapFd);
+			unlink(TempHeapName);
+			return -1;
+		}
+		packed_header_t *Packed = (packed_header_t *)Map;
+		packed_entry_t *Entries = (packed_entry_t *)(Packed + 1);
+		size_t Offset = 0;
+		for (size_t I = 0; I < Header->NumChunks; ++I) {
+			const frozen_chunk_t *Chunk = Chunks + I;
+			Raw = frozen_reserve(Raw, &RawSize, Chunk->RawSize);
+			if (LZ4_decompress_safe((const char *)Column->Map + Chunk->Offset, Raw, Chunk->Size, Chunk->RawSize) != Chunk->RawSize) {
+				Status = -1;
+				break;
+			}
+			const uint32_t *Offsets = (const uint32_t *)Raw;
+			const char *Bytes = (const char *)(Offsets + Chunk->Rows + 1);
+			for (size_t J = 0; J < Chunk->Rows; ++J) {
+				packed_entry_t *Entry = Entries + Chunk->Row + J;
+				Entry->Offset = Offset + Offsets[J];
+				Entry->Length = Entry->Capacity = Offsets[J + 1] - Offsets[J];
+			}
+			memcpy(Heap + Offset, Bytes, Offsets[Chunk->Rows]);
+			Offset += Offsets[Chunk->Rows];
+		}
+		Packed->HeapUsed = Offset;
+		Packed->Garbage = 0;
+		msync(Heap, HeapSize, MS_SYNC);
+	} else {
+		size_t HeaderSize = 0;
+		if (Column->DataType == COLUMN_CATEGORY) HeaderSize = sizeof(category_header_t);
+		MapSize = HeaderSize + Capacity * Width;
+		Map = column_map_file(TempName, MapSize, &Fd);
+		if (!Map) return -1;
+		if (HeaderSize) {
+			category_header_t *Categories = (category_header_t *)Map;
+			Categories->Width = Width;
+			Categories->Count = Header->Count;
+		}
+		for (size_t I = 0; I < Header->NumChunks; ++I) {
+			const frozen_chunk_t *Chunk = Chunks + I;
+			char *Values = Map + HeaderSize + Chunk->Row * Width;
+			if (LZ4_decompress_safe((const char *)Column->Map + Chunk->Offset, Values, Chunk->Size, Chunk->RawSize) != Chunk->RawSize) {
+				Status = -1;
+				break;
+			}
+		}
+	}
+	free(Raw);
+	msync(Map, MapSize, MS_SYNC);
+	if (Status) {
+		munmap(Map, MapSize);
+		close(Fd);
+		unlink(TempName);
+		if (Heap) {
+			munmap(Heap, HeapSize);
+			close(HeapFd);
+			unlink(TempHeapName);
+		}
+		return -1;
+	}
+	if (Heap) rename(TempHeapName, HeapName);
+	rename(TempName, FileName);
+	frozen_save(Column, 0);
+	frozen_close(Column);
+	frozen_file(Column, FileName, ".lz4");
+	unlink(FileName);
+	Column->Map = Map;
+	Column->MapSize = MapSize;
+	Column->Fd = Fd;
+	Column->Heap = Heap;
+	Column->HeapSize = HeapSize;
+	Column->HeapFd = HeapFd;
+	if (Column->DataType == COLUMN_STRING) Column->Format = STRING_PACKED;
+	Column->Frozen = 0;
+	column_count(&Column->Counters.Remaps);
+	column_zones_open(Column);
+	column_advise(Column);
+	return 0;
+}
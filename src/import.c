@@ -0,0 +1,290 @@
+#include "dataset.h"
+#include "dataset_private.h"
+#include "libcsv/csv.h"
+#include <gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+CSV import runs two passes over the same row aligned chunks of the file:
+	pass 0 counts rows and string nodes and infers column types
+	pass 1 writes each chunk directly into its own rows and node ranges
+Every column file is therefore sized exactly once.
+*/
+
+#define IMPORT_MIN_CHUNK_SIZE (16 << 20)
+
+typedef struct import_column_t {
+	size_t Nodes;
+	int NotReal, NotEmpty;
+} import_column_t;
+
+typedef struct import_chunk_t {
+	const char *Start;
+	size_t Size, Row, Rows;
+	import_column_t *Stats;
+	column_t **Columns;
+	pthread_mutex_t *Locks;
+	size_t *Nodes;
+	int NumColumns, Field, Pass, Error;
+} import_chunk_t;
+
+static int import_is_real(const char *Value, size_t Length) {
+	if (!Length) return 1;
+	char *End;
+	strtod(Value, &End);
+	return End == Value + Length;
+}
+
+static int import_is_true(const char *Value, size_t Length) {
+	switch (Length) {
+	case 1: return Value[0] && strchr("1tTyY", Value[0]);
+	case 3: return !strcasecmp(Value, "yes");
+	case 4: return !strcasecmp(Value, "true");
+	default: return 0;
+	}
+}
+
+static void import_value(import_chunk_t *Chunk, int Index, const char *Value, size_t Length) {
+	if (Chunk->Pass == 0) {
+		import_column_t *Stats = Chunk->Stats + Index;
+		Stats->Nodes += string_block_count(Length);
+		if (Length) Stats->NotEmpty = 1;
+		if (!Stats->NotReal && !import_is_real(Value, Length)) Stats->NotReal = 1;
+	} else {
+		column_t *Column = Chunk->Columns[Index];
+		switch (Column->DataType) {
+		case COLUMN_STRING:
+			string_fill(Column->Strings->Entries + Chunk->Row, (string_node_t *)(Column->Strings->Entries + Column->Dataset->Length), Chunk->Nodes + Index, Value, Length);
+			break;
+		case COLUMN_REAL: {
+			char *End;
+			double Real = strtod(Value, &End);
+			Column->Reals[Chunk->Row] = (Length && End == Value + Length) ? Real : NAN;
+			break;
+		}
+		case COLUMN_INT32:
+			Column->Int32s[Chunk->Row] = strtol(Value, NULL, 10);
+			break;
+		case COLUMN_INT64:
+			Column->Int64s[Chunk->Row] = strtoll(Value, NULL, 10);
+			break;
+		case COLUMN_FLOAT32: {
+			char *End;
+			float Real = strtof(Value, &End);
+			Column->Float32s[Chunk->Row] = (Length && End == Value + Length) ? Real : NAN;
+			break;
+		}
+		case COLUMN_BOOL:
+			// chunks share the words at their boundaries, the map starts zeroed so only bits are set
+			if (import_is_true(Value, Length)) __atomic_fetch_or(Column->Bools + Chunk->Row / 64, (uint64_t)1 << (Chunk->Row % 64), __ATOMIC_RELAXED);
+			break;
+		case COLUMN_CATEGORY: {
+			pthread_mutex_lock(Chunk->Locks + Index);
+			uint32_t Code = category_code(Column, Value, Length);
+			pthread_mutex_unlock(Chunk->Locks + Index);
+			((uint32_t *)Column->Categories->Codes)[Chunk->Row] = Code;
+			break;
+		}
+		}
+	}
+}
+
+static void import_field(void *Value, size_t Length, void *Data) {
+	import_chunk_t *Chunk = (import_chunk_t *)Data;
+	int Index = Chunk->Field++;
+	if (Index >= Chunk->NumColumns) return;
+	if (!Value) Value = "", Length = 0;
+	import_value(Chunk, Index, Value, Length);
+}
+
+static void import_row(int Char, void *Data) {
+	import_chunk_t *Chunk = (import_chunk_t *)Data;
+	while (Chunk->Field < Chunk->NumColumns) import_value(Chunk, Chunk->Field++, "", 0);
+	Chunk->Field = 0;
+	++Chunk->Row;
+	++Chunk->Rows;
+}
+
+static void *import_parse(void *Data) {
+	import_chunk_t *Chunk = (import_chunk_t *)Data;
+	struct csv_parser Parser[1];
+	csv_init(Parser, CSV_APPEND_NULL);
+	Chunk->Field = 0;
+	Chunk->Rows = 0;
+	if (csv_parse(Parser, Chunk->Start, Chunk->Size, import_field, import_row, Chunk) < Chunk->Size) {
+		fprintf(stderr, "Error: %s\n", csv_strerror(csv_error(Parser)));
+		Chunk->Error = 1;
+	}
+	csv_fini(Parser, import_field, import_row, Chunk);
+	csv_free(Parser);
+	return NULL;
+}
+
+static void import_run(import_chunk_t *Chunks, int NumChunks) {
+	pthread_t Threads[NumChunks];
+	for (int I = 1; I < NumChunks; ++I) pthread_create(&Threads[I], NULL, import_parse, Chunks + I);
+	import_parse(Chunks);
+	for (int I = 1; I < NumChunks; ++I) pthread_join(Threads[I], NULL);
+}
+
+static const char *import_next_row(const char *Next, const char *Target, const char *End, int *Quoted) {
+	while (Next < Target) {
+		const char *Quote = memchr(Next, '"', Target - Next);
+		if (!Quote) {
+			Next = Target;
+			break;
+		}
+		*Quoted = !*Quoted;
+		Next = Quote + 1;
+	}
+	while (Next < End) {
+		char Char = *Next++;
+		if (Char == '"') {
+			*Quoted = !*Quoted;
+		} else if (Char == '\n' && !*Quoted) {
+			break;
+		}
+	}
+	return Next;
+}
+
+typedef struct import_header_t {
+	const char **Names;
+	int NumColumns, Done;
+} import_header_t;
+
+static void import_header_field(void *Value, size_t Length, void *Data) {
+	import_header_t *Header = (import_header_t *)Data;
+	if (Header->Done) return;
+	Header->Names = GC_realloc(Header->Names, (Header->NumColumns + 1) * sizeof(const char *));
+	char *Name = GC_malloc_atomic(Length + 1);
+	if (Value) memcpy(Name, Value, Length);
+	Name[Length] = 0;
+	Header->Names[Header->NumColumns++] = Name;
+}
+
+static void import_header_row(int Char, void *Data) {
+	((import_header_t *)Data)->Done = 1;
+}
+
+dataset_t *dataset_import(const char *Path, const char *Name, const char *FileName, int NumTypes, const column_type_t *Types) {
+	int Fd = open(FileName, O_RDONLY);
+	if (Fd < 0) return NULL;
+	struct stat Stat[1];
+	fstat(Fd, Stat);
+	size_t Size = Stat->st_size;
+	if (!Size) {
+		close(Fd);
+		return NULL;
+	}
+	const char *Start = mmap(NULL, Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+	close(Fd);
+	if (Start == MAP_FAILED) return NULL;
+	madvise((void *)Start, Size, MADV_SEQUENTIAL);
+	const char *End = Start + Size, *Next = Start;
+	if (Size >= 3 && !memcmp(Next, "\xEF\xBB\xBF", 3)) Next += 3;
+	int Quoted = 0;
+	const char *Body = import_next_row(Next, Next, End, &Quoted);
+	import_header_t Header[1] = {{NULL, 0, 0}};
+	struct csv_parser Parser[1];
+	csv_init(Parser, CSV_APPEND_NULL);
+	csv_parse(Parser, Next, Body - Next, import_header_field, import_header_row, Header);
+	csv_fini(Parser, import_header_field, import_header_row, Header);
+	csv_free(Parser);
+	int NumColumns = Header->NumColumns;
+	if (!NumColumns) {
+		munmap((void *)Start, Size);
+		return NULL;
+	}
+
+	long NumCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+	int NumChunks = (End - Body) / IMPORT_MIN_CHUNK_SIZE + 1;
+	if (NumChunks > NumCPUs) NumChunks = NumCPUs > 0 ? NumCPUs : 1;
+	size_t ChunkSize = (End - Body) / NumChunks;
+	import_chunk_t Chunks[NumChunks];
+	memset(Chunks, 0, sizeof(Chunks));
+	Next = Body;
+	for (int I = 0; I < NumChunks; ++I) {
+		const char *Target = (I == NumChunks - 1) ? End : Body + (I + 1) * ChunkSize;
+		const char *ChunkEnd = import_next_row(Next, Target, End, &Quoted);
+		if (I == NumChunks - 1) ChunkEnd = End;
+		Chunks[I].Start = Next;
+		Chunks[I].Size = ChunkEnd - Next;
+		Chunks[I].NumColumns = NumColumns;
+		Chunks[I].Stats = calloc(NumColumns, sizeof(import_column_t));
+		Chunks[I].Nodes = calloc(NumColumns, sizeof(size_t));
+		Next = ChunkEnd;
+	}
+	import_run(Chunks, NumChunks);
+
+	column_type_t ColumnTypes[NumColumns];
+	size_t ColumnNodes[NumColumns];
+	pthread_mutex_t Locks[NumColumns];
+	dataset_t *Dataset = NULL;
+	size_t Length = 0;
+	for (int I = 0; I < NumChunks; ++I) {
+		if (Chunks[I].Error) goto done;
+		Chunks[I].Row = Length;
+		Length += Chunks[I].Rows;
+	}
+	for (int J = 0; J < NumColumns; ++J) {
+		size_t Nodes = 0;
+		int NotReal = 0, NotEmpty = 0;
+		for (int I = 0; I < NumChunks; ++I) {
+			Chunks[I].Nodes[J] = Nodes;
+			Nodes += Chunks[I].Stats[J].Nodes;
+			NotReal |= Chunks[I].Stats[J].NotReal;
+			NotEmpty |= Chunks[I].Stats[J].NotEmpty;
+		}
+		if (J < NumTypes) {
+			ColumnTypes[J] = Types[J];
+		} else {
+			ColumnTypes[J] = (NotEmpty && !NotReal) ? COLUMN_REAL : COLUMN_STRING;
+		}
+		if (ColumnTypes[J] == COLUMN_STRING && Nodes > INT32_MAX) {
+			fprintf(stderr, "Error: column %s too large for string storage\n", Header->Names[J]);
+			goto done;
+		}
+		ColumnNodes[J] = Nodes;
+	}
+	Dataset = dataset_new(Path, Name, Length);
+	if (!Dataset) goto done;
+	column_t **Columns = GC_malloc(NumColumns * sizeof(column_t *));
+	for (int J = 0; J < NumColumns; ++J) {
+		Columns[J] = dataset_column_alloc(Dataset, Header->Names[J], ColumnTypes[J], ColumnNodes[J]);
+	}
+	for (int J = 0; J < NumColumns; ++J) {
+		pthread_mutex_init(Locks + J, NULL);
+		if (ColumnTypes[J] == COLUMN_CATEGORY) category_resize(Columns[J], 4);
+	}
+	for (int I = 0; I < NumChunks; ++I) {
+		Chunks[I].Pass = 1;
+		Chunks[I].Columns = Columns;
+		Chunks[I].Locks = Locks;
+	}
+	import_run(Chunks, NumChunks);
+	for (int J = 0; J < NumColumns; ++J) {
+		if (ColumnTypes[J] == COLUMN_CATEGORY) {
+			size_t NumCodes = column_category_count(Columns[J]);
+			category_resize(Columns[J], NumCodes <= 0x100 ? 1 : NumCodes <= 0x10000 ? 2 : 4);
+		}
+		column_zones_open(Columns[J]);
+		column_dirty(Columns[J], Columns[J]->Map, Columns[J]->MapSize);
+		column_commit(Columns[J]);
+	}
+done:
+	for (int I = 0; I < NumChunks; ++I) {
+		free(Chunks[I].Stats);
+		free(Chunks[I].Nodes);
+	}
+	munmap((void *)Start, Size);
+	return Dataset;
+}
@@ -0,0 +1,383 @@
+#include "dataset.h"
+#include "dataset_private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+sorted indexes are ordered by (value, row) with NaN last. Single updates
+move the row to its new position with one memmove, range updates touching
+more than 1/SORTED_REBUILD_FRACTION of the rows rebuild the whole index.
+
+hash indexes hold one slot per row in a table at most half full, probed
+linearly. Updates leave a tombstone and insert the row again under its new
+hash, the table is rebuilt once tombstones fill 1/HASH_REBUILD_FRACTION of
+the slots.
+*/
+
+#define SORTED_REBUILD_FRACTION 16
+#define HASH_REBUILD_FRACTION 4
+#define HASH_EMPTY UINT32_MAX
+#define HASH_DELETED (UINT32_MAX - 1)
+
+static inline int sorted_less(double A, size_t RowA, double B, size_t RowB) {
+	if (A != A) return (B != B) && RowA < RowB;
+	if (B != B) return 1;
+	return A < B || (A == B && RowA < RowB);
+}
+
+// first position among the first Total entries whose (value, row) is not less than (Value, Row)
+static size_t sorted_search(column_t *Column, size_t Total, double Value, size_t Row) {
+	const uint32_t *Sorted = Column->Sorted;
+	const double *Reals = Column->Reals;
+	size_t Lo = 0, Hi = Total;
+	while (Lo < Hi) {
+		size_t Mid = Lo + (Hi - Lo) / 2;
+		if (sorted_less(Reals[Sorted[Mid]], Sorted[Mid], Value, Row)) Lo = Mid + 1; else Hi = Mid;
+	}
+	return Lo;
+}
+
+static int sorted_compare(const void *A, const void *B, void *Data) {
+	const double *Reals = (const double *)Data;
+	uint32_t RowA = *(const uint32_t *)A, RowB = *(const uint32_t *)B;
+	if (sorted_less(Reals[RowA], RowA, Reals[RowB], RowB)) return -1;
+	if (sorted_less(Reals[RowB], RowB, Reals[RowA], RowA)) return 1;
+	return 0;
+}
+
+static void sorted_rebuild(column_t *Column) {
+	size_t Length = Column->Dataset->Length;
+	uint32_t *Sorted = Column->Sorted;
+	for (size_t I = 0; I < Length; ++I) Sorted[I] = I;
+	qsort_r(Sorted, Length, sizeof(uint32_t), sorted_compare, Column->Reals);
+	column_dirty(Column, Sorted, Length * sizeof(uint32_t));
+}
+
+static void sorted_move(column_t *Column, size_t Row, double Value) {
+	double Old = Column->Reals[Row];
+	if (Old == Value || (Old != Old && Value != Value)) return;
+	uint32_t *Sorted = Column->Sorted;
+	size_t Length = Column->Dataset->Length;
+	size_t From = sorted_search(Column, Length, Old, Row);
+	size_t To = sorted_search(Column, Length, Value, Row);
+	if (To > From) {
+		--To;
+		memmove(Sorted + From, Sorted + From + 1, (To - From) * sizeof(uint32_t));
+		column_dirty(Column, Sorted + From, (To - From + 1) * sizeof(uint32_t));
+	} else if (To < From) {
+		memmove(Sorted + To + 1, Sorted + To, (From - To) * sizeof(uint32_t));
+		column_dirty(Column, Sorted + To, (From - To + 1) * sizeof(uint32_t));
+	}
+	Sorted[To] = Row;
+}
+
+static void sorted_insert(column_t *Column, size_t Total, size_t Row) {
+	uint32_t *Sorted = Column->Sorted;
+	size_t Position = sorted_search(Column, Total, Column->Reals[Row], Row);
+	memmove(Sorted + Position + 1, Sorted + Position, (Total - Position) * sizeof(uint32_t));
+	Sorted[Position] = Row;
+	column_dirty(Column, Sorted + Position, (Total - Position + 1) * sizeof(uint32_t));
+}
+
+void sorted_update(column_t *Column, size_t Row, double Value) {
+	sorted_move(Column, Row, Value);
+	Column->Reals[Row] = Value;
+}
+
+void sorted_update_range(column_t *Column, size_t Start, size_t Count, const double *Values) {
+	if (Count > Column->Dataset->Length / SORTED_REBUILD_FRACTION) {
+		memcpy(Column->Reals + Start, Values, Count * sizeof(double));
+		sorted_rebuild(Column);
+	} else {
+		for (size_t I = 0; I < Count; ++I) sorted_update(Column, Start + I, Values[I]);
+	}
+}
+
+typedef struct hash_buffer_t {
+	char *Value;
+	size_t Size;
+} hash_buffer_t;
+
+static const char *hash_value(column_t *Column, size_t Row, size_t *Length, hash_buffer_t *Buffer) {
+	*Length = column_string_get_length(Column, Row);
+	const char *Value = column_string_get_pointer(Column, Row);
+	if (Value) return Value;
+	if (Buffer->Size < *Length) {
+		Buffer->Size = *Length;
+		Buffer->Value = realloc(Buffer->Value, *Length);
+	}
+	column_string_get_value(Column, Row, Buffer->Value);
+	return Buffer->Value;
+}
+
+static size_t hash_capacity(size_t Rows) {
+	size_t Capacity = 16;
+	while (Capacity < 2 * Rows) Capacity *= 2;
+	return Capacity;
+}
+
+static void hash_insert(column_t *Column, size_t Row, uint32_t Hash) {
+	hash_slot_t *Slots = Column->Hashes->Slots;
+	size_t Mask = Column->Hashes->Header.Capacity - 1;
+	size_t Index = Hash & Mask;
+	while (Slots[Index].Row != HASH_EMPTY && Slots[Index].Row != HASH_DELETED) Index = (Index + 1) & Mask;
+	if (Slots[Index].Row == HASH_DELETED) --Column->Hashes->Header.Tombstones;
+	Slots[Index].Hash = Hash;
+	Slots[Index].Row = Row;
+	column_dirty(Column, Slots + Index, sizeof(hash_slot_t));
+}
+
+static void hash_rebuild(column_t *Column) {
+	size_t Length = Column->Dataset->Length;
+	hash_header_t *Header = &Column->Hashes->Header;
+	memset(Column->Hashes->Slots, 0xFF, Header->Capacity * sizeof(hash_slot_t));
+	Header->Tombstones = 0;
+	hash_buffer_t Buffer[1] = {{NULL, 0}};
+	for (size_t I = 0; I < Length; ++I) {
+		size_t ValueLength;
+		const char *Value = hash_value(Column, I, &ValueLength, Buffer);
+		hash_insert(Column, I, hash_string(Value, ValueLength));
+	}
+	free(Buffer->Value);
+	column_dirty(Column, Column->IndexMap, Column->IndexSize);
+}
+
+uint32_t hash_row(column_t *Column, size_t Row) {
+	hash_buffer_t Buffer[1] = {{NULL, 0}};
+	size_t Length;
+	const char *Value = hash_value(Column, Row, &Length, Buffer);
+	uint32_t Hash = hash_string(Value, Length);
+	free(Buffer->Value);
+	return Hash;
+}
+
+void hash_update(column_t *Column, size_t Row, uint32_t OldHash, const char *Value, size_t Length) {
+	uint32_t Hash = hash_string(Value, Length);
+	if (Hash == OldHash) return;
+	hash_header_t *Header = &Column->Hashes->Header;
+	hash_slot_t *Slots = Column->Hashes->Slots;
+	size_t Mask = Header->Capacity - 1;
+	size_t Index = OldHash & Mask;
+	while (Slots[Index].Row != HASH_EMPTY) {
+		if (Slots[Index].Row == Row) {
+			Slots[Index].Row = HASH_DELETED;
+			++Header->Tombstones;
+			column_dirty(Column, Slots + Index, sizeof(hash_slot_t));
+			break;
+		}
+		Index = (Index + 1) & Mask;
+	}
+	if (Header->Tombstones > Header->Capacity / HASH_REBUILD_FRACTION) {
+		hash_rebuild(Column);
+	} else {
+		hash_insert(Column, Row, Hash);
+	}
+	column_dirty(Column, Header, sizeof(hash_header_t));
+}
+
+static int hash_compare_rows(const void *A, const void *B) {
+	size_t RowA = *(const size_t *)A, RowB = *(const size_t *)B;
+	return (RowA > RowB) - (RowA < RowB);
+}
+
+size_t column_string_lookup(column_t *Column, const char *Value, int Length, size_t *Rows, size_t Max) {
+	size_t Count = 0;
+	hash_buffer_t Buffer[1] = {{NULL, 0}};
+	if (Column->IndexType == INDEX_HASH && Column->Hashes) {
+		uint32_t Hash = hash_string(Value, Length);
+		hash_slot_t *Slots = Column->Hashes->Slots;
+		size_t Mask = Column->Hashes->Header.Capacity - 1;
+		for (size_t Index = Hash & Mask; Slots[Index].Row != HASH_EMPTY; Index = (Index + 1) & Mask) {
+			if (Slots[Index].Hash != Hash || Slots[Index].Row == HASH_DELETED) continue;
+			size_t Row = Slots[Index].Row, RowLength;
+			const char *RowValue = hash_value(Column, Row, &RowLength, Buffer);
+			if (RowLength != Length || memcmp(RowValue, Value, Length)) continue;
+			if (Count < Max) Rows[Count] = Row;
+			++Count;
+		}
+		// probing finds rows out of order
+		qsort(Rows, Count < Max ? Count : Max, sizeof(size_t), hash_compare_rows);
+	} else if (Column->DataType == COLUMN_CATEGORY) {
+		// resolve the value once, then compare codes
+		int64_t Code = column_category_lookup(Column, Value, Length);
+		if (Code < 0) return 0;
+		size_t NumRows = Column->Dataset->Length;
+		for (size_t Row = 0; Row < NumRows; ++Row) {
+			if (column_category_get_code(Column, Row) != Code) continue;
+			if (Count < Max) Rows[Count] = Row;
+			++Count;
+		}
+	} else {
+		size_t NumRows = Column->Dataset->Length;
+		for (size_t Row = 0; Row < NumRows; ++Row) {
+			if (column_string_get_length(Column, Row) != Length) continue;
+			size_t RowLength;
+			const char *RowValue = hash_value(Column, Row, &RowLength, Buffer);
+			if (memcmp(RowValue, Value, Length)) continue;
+			if (Count < Max) Rows[Count] = Row;
+			++Count;
+		}
+	}
+	free(Buffer->Value);
+	return Count;
+}
+
+static void column_index_file(column_t *Column, char *FileName) {
+	sprintf(FileName, "%s/%d.index", Column->Dataset->Path, (int)Column->Index);
+}
+
+static void column_index_save(column_t *Column, index_type_t IndexType) {
+	dataset_t *Dataset = Column->Dataset;
+	Column->IndexType = IndexType;
+	pthread_mutex_lock(Dataset->Lock);
+	json_t *ColumnJson = json_array_get(json_object_get(Dataset->Info, "columns"), Column->Index);
+	json_object_set_new(ColumnJson, "index", json_integer(IndexType));
+	json_dump_file(Dataset->Info, Dataset->InfoFile, 0);
+	pthread_mutex_unlock(Dataset->Lock);
+}
+
+int column_index_open(column_t *Column) {
+	char FileName[strlen(Column->Dataset->Path) + 32];
+	column_index_file(Column, FileName);
+	struct stat Stat[1];
+	if (stat(FileName, Stat)) return -1;
+	Column->IndexFd = open(FileName, O_RDWR, 0777);
+	Column->IndexSize = Stat->st_size;
+	Column->IndexMap = mmap(NULL, Column->IndexSize, PROT_READ | PROT_WRITE, MAP_SHARED, Column->IndexFd, 0);
+	if (Column->IndexMap == MAP_FAILED) {
+		close(Column->IndexFd);
+		Column->IndexMap = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+int column_index_create(column_t *Column) {
+	index_type_t IndexType;
+	switch (Column->DataType) {
+	case COLUMN_REAL: IndexType = INDEX_SORTED; break;
+	case COLUMN_STRING: IndexType = INDEX_HASH; break;
+	default: return -1;
+	}
+	if (Column->IndexMap) return 0;
+	// sorted indexes read the values in place, hash indexes only use the getters
+	if (Column->Frozen && IndexType == INDEX_SORTED) return -1;
+	size_t Capacity = Column->Dataset->Capacity;
+	if (Capacity >= HASH_DELETED) return -1;
+	size_t IndexSize;
+	if (IndexType == INDEX_SORTED) {
+		IndexSize = (Capacity ?: 1) * sizeof(uint32_t);
+	} else {
+		IndexSize = sizeof(hash_header_t) + hash_capacity(Capacity) * sizeof(hash_slot_t);
+	}
+	char FileName[strlen(Column->Dataset->Path) + 32];
+	column_index_file(Column, FileName);
+	void *IndexMap = column_map_file(FileName, IndexSize, &Column->IndexFd);
+	if (!IndexMap) return -1;
+	Column->IndexMap = IndexMap;
+	Column->IndexSize = IndexSize;
+	column_advise(Column);
+	if (IndexType == INDEX_SORTED) {
+		sorted_rebuild(Column);
+	} else {
+		Column->Hashes->Header.Capacity = (IndexSize - sizeof(hash_header_t)) / sizeof(hash_slot_t);
+		hash_rebuild(Column);
+	}
+	column_commit(Column);
+	column_index_save(Column, IndexType);
+	return 0;
+}
+
+static int column_index_remap(column_t *Column, size_t IndexSize) {
+	if (ftruncate(Column->IndexFd, IndexSize)) return -1;
+	void *IndexMap = mremap(Column->IndexMap, Column->IndexSize, IndexSize, MREMAP_MAYMOVE);
+	if (IndexMap == MAP_FAILED) return -1;
+	column_count(&Column->Counters.Remaps);
+	Column->IndexMap = IndexMap;
+	Column->IndexSize = IndexSize;
+	return 0;
+}
+
+int column_index_append(column_t *Column, size_t Start, size_t Count) {
+	if (!Column->IndexMap) return 0;
+	size_t Capacity = Column->Dataset->Capacity;
+	if (Capacity >= HASH_DELETED) return -1;
+	switch (Column->IndexType) {
+	case INDEX_SORTED: {
+		if (Column->IndexSize < Capacity * sizeof(uint32_t)) {
+			if (column_index_remap(Column, Capacity * sizeof(uint32_t))) return -1;
+		}
+		if (Count > Start / SORTED_REBUILD_FRACTION) {
+			sorted_rebuild(Column);
+		} else {
+			for (size_t I = 0; I < Count; ++I) sorted_insert(Column, Start + I, Start + I);
+		}
+		break;
+	}
+	case INDEX_HASH: {
+		size_t Slots = hash_capacity(Capacity);
+		if (Column->Hashes->Header.Capacity < Slots) {
+			if (column_index_remap(Column, sizeof(hash_header_t) + Slots * sizeof(hash_slot_t))) return -1;
+			Column->Hashes->Header.Capacity = Slots;
+			hash_rebuild(Column);
+		} else {
+			for (size_t I = Start; I < Start + Count; ++I) hash_insert(Column, I, hash_row(Column, I));
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	return 0;
+}
+
+int column_index_drop(column_t *Column) {
+	if (!Column->IndexMap) return -1;
+	munmap(Column->IndexMap, Column->IndexSize);
+	close(Column->IndexFd);
+	Column->IndexMap = NULL;
+	Column->IndexSize = 0;
+	free(Column->IndexDirty->Bits);
+	Column->IndexDirty->Bits = NULL;
+	Column->IndexDirty->Words = 0;
+	char FileName[strlen(Column->Dataset->Path) + 32];
+	column_index_file(Column, FileName);
+	unlink(FileName);
+	column_index_save(Column, INDEX_NONE);
+	return 0;
+}
+
+index_type_t column_index_type(column_t *Column) {
+	return Column->IndexType;
+}
+
+size_t column_sorted_lower(column_t *Column, double Value) {
+	return sorted_search(Column, Column->Dataset->Length, Value, 0);
+}
+
+size_t column_sorted_upper(column_t *Column, double Value) {
+	return sorted_search(Column, Column->Dataset->Length, Value, SIZE_MAX);
+}
+
+size_t column_sorted_count(column_t *Column) {
+	return sorted_search(Column, Column->Dataset->Length, NAN, 0);
+}
+
+size_t column_sorted_rows(column_t *Column, size_t Position, size_t Count, int Reverse, size_t *Rows) {
+	size_t Total = column_sorted_count(Column);
+	if (Position >= Total) return 0;
+	if (Count > Total - Position) Count = Total - Position;
+	const uint32_t *Sorted = Column->Sorted;
+	if (Reverse) {
+		for (size_t I = 0; I < Count; ++I) Rows[I] = Sorted[Total - 1 - Position - I];
+	} else {
+		for (size_t I = 0; I < Count; ++I) Rows[I] = Sorted[Position + I];
+	}
+	return Count;
+}
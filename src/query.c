@@ -0,0 +1,438 @@
+#include "dataset.h"
+#include "dataset_private.h"
+#include <gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+predicates are compiled from json into a tree of nodes:
+	{"and": [predicate, ...]}
+	{"or": [predicate, ...]}
+	{"not": predicate}
+	{"column": index, "op": "<" | "<=" | ">" | ">=" | "==" | "!=", "value": value}
+	{"column": index, "between": [min, max]}
+	{"column": index, "prefix": string}
+Each block of QUERY_BLOCK_SIZE rows is evaluated into its part of a row
+selection bitmap (row I at bit I % 64 of word I / 64). Blocks are handed out
+to threads dynamically, every node of the tree writes into its own scratch
+bitmap and the results are combined a word at a time. Blocks line up with
+the column zone maps, so a predicate whose zone rules out (or in) every row
+of a block is answered without reading the column.
+*/
+
+#define QUERY_BLOCK_SIZE ZONE_SIZE
+#define QUERY_BLOCK_WORDS (QUERY_BLOCK_SIZE / 64)
+
+typedef enum {
+	QUERY_AND,
+	QUERY_OR,
+	QUERY_NOT,
+	QUERY_RANGE,
+	QUERY_EQUAL,
+	QUERY_PREFIX
+} query_op_t;
+
+typedef struct query_node_t query_node_t;
+
+struct query_node_t {
+	query_op_t Op;
+	column_t *Column;
+	double Min, Max;
+	char *Value;
+	size_t Length;
+	uint8_t *Codes;
+	size_t NumCodes;
+	query_node_t **Children;
+	int NumChildren;
+};
+
+struct query_t {
+	dataset_t *Dataset;
+	query_node_t *Root;
+	column_t **Columns;
+	int NumColumns, Depth;
+};
+
+typedef struct query_thread_t {
+	query_t *Query;
+	uint64_t *Bitmap, *Scratch;
+	char *Buffer;
+	size_t BufferSize;
+	size_t *NextBlock;
+	size_t NumBlocks, Length;
+} query_thread_t;
+
+static void query_node_free(query_node_t *Node) {
+	for (int I = 0; I < Node->NumChildren; ++I) query_node_free(Node->Children[I]);
+	free(Node->Children);
+	free(Node->Value);
+	free(Node->Codes);
+	free(Node);
+}
+
+static query_node_t *query_parse(query_t *Query, json_t *Json, int Depth, const char **Error);
+
+static query_node_t *query_parse_list(query_t *Query, query_op_t Op, json_t *List, int Depth, const char **Error) {
+	if (!json_is_array(List) || !json_array_size(List)) {
+		*Error = "expected list of predicates";
+		return NULL;
+	}
+	query_node_t *Node = calloc(1, sizeof(query_node_t));
+	Node->Op = Op;
+	Node->Children = calloc(json_array_size(List), sizeof(query_node_t *));
+	for (size_t I = 0; I < json_array_size(List); ++I) {
+		query_node_t *Child = query_parse(Query, json_array_get(List, I), Depth + 1, Error);
+		if (!Child) {
+			query_node_free(Node);
+			return NULL;
+		}
+		Node->Children[Node->NumChildren++] = Child;
+	}
+	return Node;
+}
+
+static query_node_t *query_not(query_node_t *Child) {
+	query_node_t *Node = calloc(1, sizeof(query_node_t));
+	Node->Op = QUERY_NOT;
+	Node->Children = calloc(1, sizeof(query_node_t *));
+	Node->Children[0] = Child;
+	Node->NumChildren = 1;
+	return Node;
+}
+
+static column_t *query_column(query_t *Query, int Index) {
+	if (Index < 0 || Index >= dataset_get_column_count(Query->Dataset)) return NULL;
+	column_t *Column = dataset_column_open(Query->Dataset, Index);
+	if (!Column) return NULL;
+	for (int I = 0; I < Query->NumColumns; ++I) if (Query->Columns[I] == Column) return Column;
+	Query->Columns = realloc(Query->Columns, (Query->NumColumns + 1) * sizeof(column_t *));
+	Query->Columns[Query->NumColumns++] = Column;
+	return Column;
+}
+
+static query_node_t *query_parse(query_t *Query, json_t *Json, int Depth, const char **Error) {
+	if (!json_is_object(Json)) {
+		*Error = "expected predicate object";
+		return NULL;
+	}
+	if (Query->Depth < Depth + 1) Query->Depth = Depth + 1;
+	json_t *Children;
+	if ((Children = json_object_get(Json, "and"))) return query_parse_list(Query, QUERY_AND, Children, Depth, Error);
+	if ((Children = json_object_get(Json, "or"))) return query_parse_list(Query, QUERY_OR, Children, Depth, Error);
+	if ((Children = json_object_get(Json, "not"))) {
+		query_node_t *Child = query_parse(Query, Children, Depth + 1, Error);
+		return Child ? query_not(Child) : NULL;
+	}
+	int ColumnIndex;
+	const char *OpName = NULL, *Prefix = NULL;
+	json_t *Value = NULL, *Between = NULL;
+	if (json_unpack(Json, "{sis?ss?os?os?s}", "column", &ColumnIndex, "op", &OpName, "value", &Value, "between", &Between, "prefix", &Prefix)) {
+		*Error = "invalid predicate";
+		return NULL;
+	}
+	column_t *Column = query_column(Query, ColumnIndex);
+	if (!Column) {
+		*Error = "invalid column";
+		return NULL;
+	}
+	if (column_is_frozen(Column)) {
+		*Error = "column is frozen";
+		return NULL;
+	}
+	int Numeric = column_is_numeric(Column);
+	query_node_t *Node = calloc(1, sizeof(query_node_t));
+	Node->Column = Column;
+	if (Prefix) {
+		if (Numeric) goto invalid;
+		Node->Op = QUERY_PREFIX;
+		Node->Length = strlen(Prefix);
+		Node->Value = strdup(Prefix);
+	} else if (Between) {
+		double Min, Max;
+		if (!Numeric || json_unpack(Between, "[FF]", &Min, &Max)) goto invalid;
+		Node->Op = QUERY_RANGE;
+		Node->Min = Min;
+		Node->Max = Max;
+	} else if (OpName && Value) {
+		int Negate = 0;
+		if (!strcmp(OpName, "!=")) {
+			Negate = 1;
+			OpName = "==";
+		}
+		if (Numeric) {
+			if (!json_is_number(Value)) goto invalid;
+			double Number = json_number_value(Value);
+			Node->Op = QUERY_RANGE;
+			Node->Min = -INFINITY;
+			Node->Max = INFINITY;
+			if (!strcmp(OpName, "==")) {
+				Node->Min = Node->Max = Number;
+			} else if (!strcmp(OpName, "<")) {
+				Node->Max = nextafter(Number, -INFINITY);
+			} else if (!strcmp(OpName, "<=")) {
+				Node->Max = Number;
+			} else if (!strcmp(OpName, ">")) {
+				Node->Min = nextafter(Number, INFINITY);
+			} else if (!strcmp(OpName, ">=")) {
+				Node->Min = Number;
+			} else {
+				goto invalid;
+			}
+		} else {
+			if (!json_is_string(Value) || strcmp(OpName, "==")) goto invalid;
+			Node->Op = QUERY_EQUAL;
+			Node->Length = json_string_length(Value);
+			Node->Value = malloc(Node->Length + 1);
+			memcpy(Node->Value, json_string_value(Value), Node->Length + 1);
+		}
+		if (Negate) Node = query_not(Node);
+	} else {
+		goto invalid;
+	}
+	return Node;
+invalid:
+	query_node_free(Node);
+	*Error = "invalid predicate for column type";
+	return NULL;
+}
+
+static int query_compare_columns(const void *A, const void *B) {
+	size_t IndexA = (*(column_t **)A)->Index, IndexB = (*(column_t **)B)->Index;
+	return (IndexA > IndexB) - (IndexA < IndexB);
+}
+
+query_t *query_compile(dataset_t *Dataset, json_t *Json, const char **Error) {
+	query_t *Query = calloc(1, sizeof(query_t));
+	Query->Dataset = Dataset;
+	Query->Root = query_parse(Query, Json, 0, Error);
+	if (!Query->Root) {
+		query_free(Query);
+		return NULL;
+	}
+	// columns are locked in index order, like every other writer or reader of several columns
+	qsort(Query->Columns, Query->NumColumns, sizeof(column_t *), query_compare_columns);
+	return Query;
+}
+
+void query_free(query_t *Query) {
+	if (Query->Root) query_node_free(Query->Root);
+	free(Query->Columns);
+	free(Query);
+}
+
+static int query_match(query_node_t *Node, const char *Value, size_t Length) {
+	if (Node->Op == QUERY_EQUAL) {
+		return Length == Node->Length && !memcmp(Value, Node->Value, Length);
+	} else {
+		return Length >= Node->Length && !memcmp(Value, Node->Value, Node->Length);
+	}
+}
+
+static void query_prepare(query_node_t *Node) {
+	for (int I = 0; I < Node->NumChildren; ++I) query_prepare(Node->Children[I]);
+	column_t *Column = Node->Column;
+	if (!Column || Column->DataType != COLUMN_CATEGORY) return;
+	// category predicates become a lookup table over the dictionary codes
+	free(Node->Codes);
+	Node->NumCodes = column_category_count(Column);
+	Node->Codes = malloc(Node->NumCodes);
+	for (size_t I = 0; I < Node->NumCodes; ++I) {
+		Node->Codes[I] = query_match(Node, Column->Dictionary->Values[I], Column->Dictionary->Lengths[I]);
+	}
+}
+
+#define QUERY_RANGE_TYPED(TYPE, VALUES) { \
+	const TYPE *Values = (const TYPE *)(VALUES) + Start; \
+	for (size_t W = 0; W < Words; ++W) { \
+		size_t Limit = Rows - W * 64 < 64 ? Rows - W * 64 : 64; \
+		const TYPE *Base = Values + W * 64; \
+		uint64_t Bits = 0; \
+		for (size_t B = 0; B < Limit; ++B) { \
+			double Value = Base[B]; \
+			Bits |= (uint64_t)(Value >= Min && Value <= Max) << B; \
+		} \
+		Out[W] = Bits; \
+	} \
+	break; \
+}
+
+static int query_zone(query_node_t *Node, size_t Start) {
+	// returns 0 when no row of the block can match, 1 when every row does and -1 otherwise
+	const zone_t *Zone = column_zone(Node->Column, Start);
+	if (!Zone) return -1;
+	if (Node->Op == QUERY_RANGE) {
+		if (Zone->Min > Zone->Max || Zone->Max < Node->Min || Zone->Min > Node->Max) return 0;
+		if (!Zone->Nulls && Zone->Min >= Node->Min && Zone->Max <= Node->Max) return 1;
+		return -1;
+	}
+	size_t Length = Node->Length;
+	if (Length > Zone->MaxLength) return 0;
+	if (Node->Op == QUERY_EQUAL && Length < Zone->MinLength) return 0;
+	uint64_t Low = zone_prefix(Node->Value, Length), High = Low;
+	if (Node->Op == QUERY_PREFIX && Length < 8) High |= UINT64_MAX >> (8 * Length);
+	if (High < Zone->MinPrefix || Low > Zone->MaxPrefix) return 0;
+	return -1;
+}
+
+static void query_eval(query_thread_t *Thread, query_node_t *Node, size_t Start, size_t Rows, uint64_t *Out, uint64_t *Scratch) {
+	size_t Words = (Rows + 63) / 64;
+	switch (Node->Op) {
+	case QUERY_AND: {
+		query_eval(Thread, Node->Children[0], Start, Rows, Out, Scratch);
+		for (int I = 1; I < Node->NumChildren; ++I) {
+			uint64_t Any = 0;
+			for (size_t W = 0; W < Words; ++W) Any |= Out[W];
+			if (!Any) break;
+			query_eval(Thread, Node->Children[I], Start, Rows, Scratch, Scratch + QUERY_BLOCK_WORDS);
+			for (size_t W = 0; W < Words; ++W) Out[W] &= Scratch[W];
+		}
+		break;
+	}
+	case QUERY_OR: {
+		query_eval(Thread, Node->Children[0], Start, Rows, Out, Scratch);
+		for (int I = 1; I < Node->NumChildren; ++I) {
+			query_eval(Thread, Node->Children[I], Start, Rows, Scratch, Scratch + QUERY_BLOCK_WORDS);
+			for (size_t W = 0; W < Words; ++W) Out[W] |= Scratch[W];
+		}
+		break;
+	}
+	case QUERY_NOT: {
+		query_eval(Thread, Node->Children[0], Start, Rows, Out, Scratch);
+		for (size_t W = 0; W < Words; ++W) Out[W] = ~Out[W];
+		break;
+	}
+	case QUERY_RANGE: {
+		column_t *Column = Node->Column;
+		double Min = Node->Min, Max = Node->Max;
+		int Zone = query_zone(Node, Start);
+		if (Zone >= 0) {
+			memset(Out, Zone ? 0xFF : 0, Words * sizeof(uint64_t));
+			break;
+		}
+		switch (Column->DataType) {
+		case COLUMN_REAL: QUERY_RANGE_TYPED(double, Column->Reals)
+		case COLUMN_INT32: QUERY_RANGE_TYPED(int32_t, Column->Int32s)
+		case COLUMN_INT64: QUERY_RANGE_TYPED(int64_t, Column->Int64s)
+		case COLUMN_FLOAT32: QUERY_RANGE_TYPED(float, Column->Float32s)
+		case COLUMN_BOOL: {
+			const uint64_t *Bools = Column->Bools + Start / 64;
+			uint64_t Ones = (Min <= 1 && 1 <= Max) ? ~(uint64_t)0 : 0;
+			uint64_t Zeros = (Min <= 0 && 0 <= Max) ? ~(uint64_t)0 : 0;
+			for (size_t W = 0; W < Words; ++W) Out[W] = (Bools[W] & Ones) | (~Bools[W] & Zeros);
+			break;
+		}
+		default:
+			memset(Out, 0, Words * sizeof(uint64_t));
+			break;
+		}
+		break;
+	}
+	case QUERY_EQUAL:
+	case QUERY_PREFIX: {
+		column_t *Column = Node->Column;
+		memset(Out, 0, Words * sizeof(uint64_t));
+		if (!query_zone(Node, Start)) break;
+		if (Column->DataType == COLUMN_CATEGORY) {
+			const uint8_t *Codes = Node->Codes;
+			size_t NumCodes = Node->NumCodes;
+			for (size_t I = 0; I < Rows; ++I) {
+				uint32_t Code = category_get(Column, Start + I);
+				if (Code < NumCodes && Codes[Code]) Out[I / 64] |= (uint64_t)1 << (I % 64);
+			}
+		} else {
+			for (size_t I = 0; I < Rows; ++I) {
+				size_t Length = column_string_get_length(Column, Start + I);
+				if (Length < Node->Length || (Node->Op == QUERY_EQUAL && Length > Node->Length)) continue;
+				const char *Value = column_string_get_pointer(Column, Start + I);
+				if (!Value) {
+					if (Thread->BufferSize < Length) {
+						Thread->BufferSize = Length;
+						Thread->Buffer = realloc(Thread->Buffer, Length);
+					}
+					column_string_get_value(Column, Start + I, Thread->Buffer);
+					Value = Thread->Buffer;
+				}
+				if (query_match(Node, Value, Length)) Out[I / 64] |= (uint64_t)1 << (I % 64);
+			}
+		}
+		break;
+	}
+	}
+}
+
+static void *query_thread(void *Data) {
+	query_thread_t *Thread = (query_thread_t *)Data;
+	query_t *Query = Thread->Query;
+	size_t Length = Thread->Length;
+	for (;;) {
+		size_t Block = __atomic_fetch_add(Thread->NextBlock, 1, __ATOMIC_RELAXED);
+		if (Block >= Thread->NumBlocks) break;
+		size_t Start = Block * QUERY_BLOCK_SIZE;
+		size_t Rows = Length - Start < QUERY_BLOCK_SIZE ? Length - Start : QUERY_BLOCK_SIZE;
+		uint64_t *Out = Thread->Bitmap + Start / 64;
+		query_eval(Thread, Query->Root, Start, Rows, Out, Thread->Scratch);
+		if (Rows % 64) Out[Rows / 64] &= ((uint64_t)1 << (Rows % 64)) - 1;
+	}
+	return NULL;
+}
+
+uint64_t *query_run(query_t *Query, size_t *Scanned, size_t *Count) {
+	for (int I = 0; I < Query->NumColumns; ++I) column_lock_read(Query->Columns[I]);
+	// a column frozen since the query was compiled no longer maps its values
+	for (int I = 0; I < Query->NumColumns; ++I) if (Query->Columns[I]->Frozen) {
+		for (int J = 0; J < Query->NumColumns; ++J) column_unlock(Query->Columns[J]);
+		return NULL;
+	}
+	// rows can only be appended while no column is locked
+	size_t Length = Query->Dataset->Length;
+	if (Scanned) *Scanned = Length;
+	size_t NumWords = column_bool_words(Length);
+	uint64_t *Bitmap = calloc(NumWords ?: 1, sizeof(uint64_t));
+	query_prepare(Query->Root);
+	size_t NumBlocks = (Length + QUERY_BLOCK_SIZE - 1) / QUERY_BLOCK_SIZE, NextBlock = 0;
+	long NumCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+	int NumThreads = NumBlocks < NumCPUs ? NumBlocks : NumCPUs;
+	if (NumThreads < 1) NumThreads = 1;
+	query_thread_t Threads[NumThreads];
+	pthread_t Handles[NumThreads];
+	for (int I = 0; I < NumThreads; ++I) {
+		Threads[I].Query = Query;
+		Threads[I].Bitmap = Bitmap;
+		Threads[I].Scratch = malloc(Query->Depth * QUERY_BLOCK_WORDS * sizeof(uint64_t));
+		Threads[I].Buffer = NULL;
+		Threads[I].BufferSize = 0;
+		Threads[I].NextBlock = &NextBlock;
+		Threads[I].NumBlocks = NumBlocks;
+		Threads[I].Length = Length;
+	}
+	for (int I = 1; I < NumThreads; ++I) pthread_create(&Handles[I], NULL, query_thread, Threads + I);
+	query_thread(Threads);
+	for (int I = 1; I < NumThreads; ++I) pthread_join(Handles[I], NULL);
+	for (int I = 0; I < Query->NumColumns; ++I) column_unlock(Query->Columns[I]);
+	for (int I = 0; I < NumThreads; ++I) {
+		free(Threads[I].Scratch);
+		free(Threads[I].Buffer);
+	}
+	if (Count) {
+		size_t Total = 0;
+		for (size_t I = 0; I < NumWords; ++I) Total += __builtin_popcountll(Bitmap[I]);
+		*Count = Total;
+	}
+	return Bitmap;
+}
+
+size_t query_next(const uint64_t *Bitmap, size_t Length, size_t Index) {
+	while (Index < Length) {
+		uint64_t Word = Bitmap[Index / 64] >> (Index % 64);
+		if (Word) {
+			Index += __builtin_ctzll(Word);
+			return Index < Length ? Index : Length;
+		}
+		Index = (Index / 64 + 1) * 64;
+	}
+	return Length;
+}
@@ -7,126 +7,2857 @@
 #include "minilang/stringmap.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <czmq.h>
 #include <gc.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/prctl.h>
 #include <jansson.h>
 #include "dataset.h"
 
-typedef struct dataset_entry_t dataset_entry_t;
+typedef struct dataset_entry_t {
+	dataset_t *Dataset;
+	size_t FeedLength, FeedColumns;
+} dataset_entry_t;
+
+static dataset_entry_t **DatasetEntries = 0;
+static int NumDatasets = 0, MaxDatasets = 0;
+static stringmap_t DatasetNames[1] = {STRINGMAP_INIT};
+static pthread_rwlock_t DatasetsLock[1] = {PTHREAD_RWLOCK_INITIALIZER};
+static const char *DatasetPath = 0;
+
+static int datasets_compare(const void *A, const void *B) {
+	return *(const int *)A - *(const int *)B;
+}
+
+typedef struct datasets_loader_t {
+	const char *Present;
+	int Next, Count;
+} datasets_loader_t;
+
+static void *datasets_load_thread(void *Data) {
+	datasets_loader_t *Loader = (datasets_loader_t *)Data;
+	for (;;) {
+		int Index = __atomic_fetch_add(&Loader->Next, 1, __ATOMIC_RELAXED);
+		if (Index >= Loader->Count) break;
+		if (!Loader->Present[Index]) continue;
+		char *Path;
+		asprintf(&Path, "%s/%d", DatasetPath, Index);
+		dataset_t *Dataset = DatasetEntries[Index]->Dataset = dataset_open(Path);
+		if (Dataset) dataset_prefetch(Dataset);
+	}
+	return NULL;
+}
+
+static void datasets_load() {
+	// datasets are numbered directories, indices left by failed creates stay empty so later datasets keep theirs
+	DIR *Dir = opendir(DatasetPath);
+	if (!Dir) return;
+	int *Indices = NULL, NumIndices = 0, MaxIndices = 0;
+	struct dirent *Entry;
+	while ((Entry = readdir(Dir))) {
+		char *End;
+		long Index = strtol(Entry->d_name, &End, 10);
+		if (End == Entry->d_name || *End || Index < 0 || Index > INT_MAX) continue;
+		if (Entry->d_type != DT_DIR) {
+			if (Entry->d_type != DT_UNKNOWN) continue;
+			struct stat Stat[1];
+			if (fstatat(dirfd(Dir), Entry->d_name, Stat, 0) || !S_ISDIR(Stat->st_mode)) continue;
+		}
+		if (NumIndices == MaxIndices) {
+			MaxIndices = MaxIndices ? 2 * MaxIndices : 64;
+			Indices = realloc(Indices, MaxIndices * sizeof(int));
+		}
+		Indices[NumIndices++] = Index;
+	}
+	closedir(Dir);
+	qsort(Indices, NumIndices, sizeof(int), datasets_compare);
+	int Count = NumIndices ? Indices[NumIndices - 1] + 1 : 0;
+	char *Present = calloc(Count + 1, 1);
+	for (int I = 0; I < NumIndices; ++I) Present[Indices[I]] = 1;
+	free(Indices);
+	MaxDatasets = Count < 16 ? 16 : Count;
+	DatasetEntries = anew(dataset_entry_t *, MaxDatasets);
+	for (int I = 0; I < Count; ++I) DatasetEntries[I] = new(dataset_entry_t);
+	// only info.json is parsed here, column files are mapped on first use
+	datasets_loader_t Loader[1] = {{Present, 0, Count}};
+	int NumThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (NumThreads > Count / 8) NumThreads = Count / 8;
+	if (NumThreads > 1) {
+		pthread_t Threads[NumThreads];
+		for (int I = 0; I < NumThreads; ++I) pthread_create(Threads + I, NULL, datasets_load_thread, Loader);
+		for (int I = 0; I < NumThreads; ++I) pthread_join(Threads[I], NULL);
+	} else {
+		datasets_load_thread(Loader);
+	}
+	free(Present);
+	NumDatasets = Count;
+	for (int I = 0; I < Count; ++I) {
+		dataset_t *Dataset = DatasetEntries[I]->Dataset;
+		if (Dataset) stringmap_insert(DatasetNames, dataset_get_name(Dataset), (void *)(intptr_t)(I + 1));
+	}
+}
+
+static dataset_t *datasets_find(int Index) {
+	if (Index < 0) return NULL;
+	dataset_t *Dataset = NULL;
+	pthread_rwlock_rdlock(DatasetsLock);
+	if (Index < NumDatasets) Dataset = __atomic_load_n(&DatasetEntries[Index]->Dataset, __ATOMIC_ACQUIRE);
+	pthread_rwlock_unlock(DatasetsLock);
+	return Dataset;
+}
+
+static int datasets_find_name(const char *Name) {
+	pthread_rwlock_rdlock(DatasetsLock);
+	int Index = (intptr_t)stringmap_search(DatasetNames, Name);
+	pthread_rwlock_unlock(DatasetsLock);
+	return Index - 1;
+}
+
+typedef struct client_t {
+	zframe_t *Frame;
+} client_t;
+
+#define MAX_PARTS 2
+#define MAX_BATCH 4096
+
+typedef struct request_part_t {
+	void *Data;
+	size_t Size;
+	zmq_free_fn *Free;
+	void *Hint;
+} request_part_t;
+
+typedef struct snapshot_t snapshot_t;
+
+typedef struct request_t {
+	client_t *Client;
+	snapshot_t *Snapshot;
+	request_part_t Parts[MAX_PARTS];
+	int NumParts;
+} request_t;
+
+static void request_attach(request_t *Request, void *Data, size_t Size, zmq_free_fn *Free, void *Hint) {
+	request_part_t *Part = Request->Parts + Request->NumParts++;
+	Part->Data = Data;
+	Part->Size = Size;
+	Part->Free = Free;
+	Part->Hint = Hint;
+}
+
+static void request_free(void *Data, void *Hint) {
+	free(Data);
+}
+
+static void request_unpin(void *Data, void *Hint) {
+	column_unpin((column_t *)Hint);
+}
+
+/*
+snapshots are point-in-time copies of a dataset under <path>/snapshots/<id>,
+opened as separate datasets for the read methods. A released snapshot is
+closed and removed once the last request using it has finished.
+*/
+
+struct snapshot_t {
+	dataset_t *Dataset;
+	char *Path;
+	int Source, Refs;
+};
+
+static snapshot_t **Snapshots = NULL;
+static int NumSnapshots = 0, MaxSnapshots = 0;
+static pthread_mutex_t SnapshotsLock[1] = {PTHREAD_MUTEX_INITIALIZER};
+
+static void snapshot_remove(const char *Path) {
+	DIR *Dir = opendir(Path);
+	if (!Dir) return;
+	struct dirent *Entry;
+	while ((Entry = readdir(Dir))) if (Entry->d_name[0] != '.') unlinkat(dirfd(Dir), Entry->d_name, 0);
+	closedir(Dir);
+	rmdir(Path);
+}
+
+static void snapshots_clear() {
+	// snapshots do not outlive the server
+	char *Path;
+	asprintf(&Path, "%s/snapshots", DatasetPath);
+	DIR *Dir = opendir(Path);
+	if (Dir) {
+		struct dirent *Entry;
+		while ((Entry = readdir(Dir))) {
+			if (Entry->d_name[0] == '.') continue;
+			char *SnapshotPath;
+			asprintf(&SnapshotPath, "%s/%s", Path, Entry->d_name);
+			snapshot_remove(SnapshotPath);
+			free(SnapshotPath);
+		}
+		closedir(Dir);
+	}
+	mkdir(Path, 0777);
+	free(Path);
+}
+
+static void snapshot_release(snapshot_t *Snapshot) {
+	pthread_mutex_lock(SnapshotsLock);
+	int Close = !--Snapshot->Refs;
+	pthread_mutex_unlock(SnapshotsLock);
+	if (!Close) return;
+	dataset_close(Snapshot->Dataset);
+	snapshot_remove(Snapshot->Path);
+}
+
+static dataset_t *datasets_view(request_t *Request, int Index, int SnapshotId) {
+	// the snapshot is held until the request finishes
+	if (SnapshotId < 0) return datasets_find(Index);
+	snapshot_t *Snapshot = NULL;
+	pthread_mutex_lock(SnapshotsLock);
+	if (SnapshotId < NumSnapshots) Snapshot = Snapshots[SnapshotId];
+	if (Snapshot && (Snapshot->Source != Index || Request->Snapshot)) Snapshot = NULL;
+	if (Snapshot) ++Snapshot->Refs;
+	pthread_mutex_unlock(SnapshotsLock);
+	if (!Snapshot) return NULL;
+	Request->Snapshot = Snapshot;
+	return Snapshot->Dataset;
+}
+
+#define LATENCY_BUCKETS 40
+
+typedef struct method_t {
+	json_t *(*Fn)(request_t *, json_t *);
+	// logged methods change datasets and are written to the log before they run
+	int Logged;
+	uint64_t Errors, BytesIn, BytesOut, MaxLatency;
+	// request latencies in microseconds, bucket I counts latencies below 2^I
+	uint64_t Latencies[LATENCY_BUCKETS];
+} method_t;
+
+static stringmap_t Clients[1] = {STRINGMAP_INIT};
+static stringmap_t Methods[1] = {STRINGMAP_INIT};
+static int Verbose = 0;
+static int64_t StartTime;
+
+static void method_register(const char *Name, json_t *(*Fn)(request_t *, json_t *), int Logged) {
+	method_t *Method = new(method_t);
+	Method->Fn = Fn;
+	Method->Logged = Logged;
+	stringmap_insert(Methods, Name, Method);
+}
+
+static void method_record(method_t *Method, uint64_t Latency, int Error, size_t BytesIn, size_t BytesOut) {
+	int Bucket = Latency ? 64 - __builtin_clzll(Latency) : 0;
+	if (Bucket >= LATENCY_BUCKETS) Bucket = LATENCY_BUCKETS - 1;
+	if (Error) __atomic_fetch_add(&Method->Errors, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&Method->BytesIn, BytesIn, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&Method->BytesOut, BytesOut, __ATOMIC_RELAXED);
+	__atomic_fetch_add(Method->Latencies + Bucket, 1, __ATOMIC_RELAXED);
+	uint64_t Max = __atomic_load_n(&Method->MaxLatency, __ATOMIC_RELAXED);
+	while (Max < Latency && !__atomic_compare_exchange_n(&Method->MaxLatency, &Max, Latency, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static uint64_t method_percentile(const uint64_t *Latencies, uint64_t Count, double Fraction) {
+	// reports the upper bound of the bucket containing the percentile
+	uint64_t Target = Count * Fraction, Seen = 0;
+	for (int I = 0; I < LATENCY_BUCKETS; ++I) {
+		Seen += Latencies[I];
+		if (Seen > Target) return (uint64_t)1 << I;
+	}
+	return (uint64_t)1 << (LATENCY_BUCKETS - 1);
+}
+
+/*
+the write-ahead log is a redo log of logged requests in <path>/wal.log, one
+compact json record per line:
+
+	{"seq": N, "method": M, "argument": A[, "index": I][, "start": S]}
+
+each record is written with a single write() before its request runs and
+logged requests are serialized while the log is enabled, so the log order is
+the order in which mutations were applied. Only the append itself holds the
+log lock, so wal/read, syncs and checkpoints do not wait for a long request.
+"index" records the dataset index a create or import will be given and
+"start" the first row of an append, which makes replaying a record that had
+already taken effect harmless. Imports are logged by file name, the file must
+exist when the import is logged and at the same path wherever the record is
+replayed; a follower or recovery that cannot apply a record stops instead of
+leaving a gap.
+
+the log is synced once per batch before any response is sent, or every
+WalSyncInterval ms (group commit). A checkpoint flushes every dataset,
+records the last applied sequence number in wal.checkpoint and rotates
+wal.log to wal.log.1 once it passes WAL_ROTATE_SIZE and no record is still
+being applied. On startup records after
+the checkpoint are replayed and a torn record at the end is discarded.
+
+a follower (-r) is started from a copy of the leader's directory and polls
+the leader with wal/read, appending each record to its own log before
+applying it. Followers only accept read methods.
+*/
+
+#define WAL_ROTATE_SIZE (64 << 20)
+#define WAL_MARK_INTERVAL 256
+#define WAL_READ_LIMIT 1024
+#define WAL_FOLLOW_INTERVAL 100
+#define WAL_FOLLOW_TIMEOUT 5000
+
+typedef struct wal_mark_t {
+	uint64_t Seq;
+	off_t Offset;
+} wal_mark_t;
+
+// WalApplyLock orders logged requests, WalLock guards the log file and is taken inside it
+static pthread_mutex_t WalLock[1] = {PTHREAD_MUTEX_INITIALIZER};
+static pthread_mutex_t WalApplyLock[1] = {PTHREAD_MUTEX_INITIALIZER};
+static int WalFd = -1, WalSyncInterval = 0;
+static uint64_t WalSeq = 0, WalSynced = 0, WalFirst = 0, WalApplied = 0;
+static off_t WalSize = 0;
+// sparse sequence number to offset marks for wal/read in the current log
+static wal_mark_t *WalMarks = NULL;
+static int NumWalMarks = 0, MaxWalMarks = 0;
+static const char *Leader = NULL;
+
+static void datasets_flush();
+
+static char *wal_file(const char *Name) {
+	char *FileName;
+	asprintf(&FileName, "%s/%s", DatasetPath, Name);
+	return FileName;
+}
+
+static void wal_mark(uint64_t Seq, off_t Offset) {
+	if (!WalFirst) WalFirst = Seq;
+	if (NumWalMarks && Seq % WAL_MARK_INTERVAL) return;
+	if (NumWalMarks == MaxWalMarks) {
+		MaxWalMarks = MaxWalMarks ? 2 * MaxWalMarks : 64;
+		WalMarks = realloc(WalMarks, MaxWalMarks * sizeof(wal_mark_t));
+	}
+	WalMarks[NumWalMarks].Seq = Seq;
+	WalMarks[NumWalMarks].Offset = Offset;
+	++NumWalMarks;
+}
+
+static int wal_write(json_t *Record, uint64_t Seq) {
+	// called with WalLock held
+	char *Line = json_dumps(Record, JSON_COMPACT);
+	size_t Length = strlen(Line);
+	Line[Length] = '\n';
+	ssize_t Written = write(WalFd, Line, Length + 1);
+	free(Line);
+	if (Written != Length + 1) {
+		// drop the partial record so that the next one starts on a fresh line
+		if (Written > 0 && ftruncate(WalFd, WalSize)) fprintf(stderr, "Error: error truncating log\n");
+		return -1;
+	}
+	wal_mark(Seq, WalSize);
+	WalSize += Length + 1;
+	__atomic_store_n(&WalSeq, Seq, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static int wal_log(const char *Method, json_t *Argument) {
+	json_t *Record = json_pack("{sIsssO}", "seq", (json_int_t)(WalSeq + 1), "method", Method, "argument", Argument);
+	int DatasetIndex;
+	if (!strcmp(Method, "dataset/create") || !strcmp(Method, "dataset/import")) {
+		pthread_rwlock_rdlock(DatasetsLock);
+		json_object_set_new(Record, "index", json_integer(NumDatasets));
+		pthread_rwlock_unlock(DatasetsLock);
+	} else if (!strcmp(Method, "dataset/append") && !json_unpack(Argument, "{si}", "dataset", &DatasetIndex)) {
+		dataset_t *Dataset = datasets_find(DatasetIndex);
+		if (Dataset) json_object_set_new(Record, "start", json_integer(dataset_get_length(Dataset)));
+	}
+	int Status = wal_write(Record, WalSeq + 1);
+	json_decref(Record);
+	return Status;
+}
+
+static void wal_sync() {
+	if (__atomic_load_n(&WalSeq, __ATOMIC_ACQUIRE) == __atomic_load_n(&WalSynced, __ATOMIC_ACQUIRE)) return;
+	pthread_mutex_lock(WalLock);
+	uint64_t Seq = WalSeq;
+	if (fdatasync(WalFd)) fprintf(stderr, "Error: error syncing log\n");
+	__atomic_store_n(&WalSynced, Seq, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(WalLock);
+}
+
+static void *wal_syncer(void *Data) {
+	for (;;) {
+		zclock_sleep(WalSyncInterval);
+		wal_sync();
+	}
+	return NULL;
+}
+
+static void wal_checkpoint() {
+	// a record still being applied may be partly flushed, it is replayed from the log
+	uint64_t Seq = __atomic_load_n(&WalApplied, __ATOMIC_ACQUIRE);
+	datasets_flush();
+	// flushed pages still have to reach the disk before the log can be dropped
+	int Fd = open(DatasetPath, O_RDONLY | O_DIRECTORY);
+	if (Fd >= 0) {
+		syncfs(Fd);
+		close(Fd);
+	}
+	pthread_mutex_lock(WalLock);
+	fdatasync(WalFd);
+	__atomic_store_n(&WalSynced, WalSeq, __ATOMIC_RELEASE);
+	char *FileName = wal_file("wal.checkpoint");
+	char *TempName = wal_file("wal.checkpoint.tmp");
+	FILE *File = fopen(TempName, "w");
+	if (File) {
+		fprintf(File, "%" PRIu64 "\n", Seq);
+		fflush(File);
+		fdatasync(fileno(File));
+		fclose(File);
+		rename(TempName, FileName);
+	}
+	free(TempName);
+	free(FileName);
+	if (WalSize > WAL_ROTATE_SIZE && __atomic_load_n(&WalApplied, __ATOMIC_ACQUIRE) == WalSeq) {
+		// the previous log is kept for followers that are behind
+		char *LogName = wal_file("wal.log");
+		char *OldName = wal_file("wal.log.1");
+		rename(LogName, OldName);
+		close(WalFd);
+		WalFd = open(LogName, O_WRONLY | O_CREAT | O_APPEND, 0666);
+		WalSize = 0;
+		WalFirst = 0;
+		NumWalMarks = 0;
+		free(OldName);
+		free(LogName);
+	}
+	pthread_mutex_unlock(WalLock);
+}
+
+static void *wal_checkpointer(void *Data) {
+	int Interval = (intptr_t)Data;
+	for (;;) {
+		zclock_sleep(Interval);
+		wal_checkpoint();
+	}
+	return NULL;
+}
+
+typedef int (*wal_callback_t)(json_t *Record, uint64_t Seq, off_t Offset, void *Data);
+
+static off_t wal_scan(const char *FileName, off_t Offset, wal_callback_t Callback, void *Data) {
+	// returns the end of the last complete record
+	FILE *File = fopen(FileName, "r");
+	if (!File) return 0;
+	if (Offset) fseeko(File, Offset, SEEK_SET);
+	char *Line = NULL;
+	size_t Size = 0;
+	ssize_t Length;
+	while ((Length = getline(&Line, &Size, File)) > 0) {
+		if (Line[Length - 1] != '\n') break;
+		json_t *Record = json_loadb(Line, Length, 0, NULL);
+		json_int_t Seq;
+		if (!Record || json_unpack(Record, "{sI}", "seq", &Seq)) {
+			json_decref(Record);
+			break;
+		}
+		int Stop = Callback(Record, Seq, Offset, Data);
+		json_decref(Record);
+		Offset += Length;
+		if (Stop) break;
+	}
+	free(Line);
+	fclose(File);
+	return Offset;
+}
+
+static const char *wal_check(const char *Method, json_t *Argument) {
+	// an import is replayed from its file name, which must name the same file wherever the log goes
+	const char *FileName;
+	if (!strcmp(Method, "dataset/import") && !json_unpack(Argument, "{ss}", "file", &FileName) && access(FileName, R_OK)) {
+		return "import file not found";
+	}
+	return NULL;
+}
+
+static int wal_apply_rows(int DatasetIndex, json_int_t Start, json_t *Rows) {
+	// the rows were appended before the crash but their values may not have been written
+	method_t *Write = stringmap_search(Methods, "column/write");
+	size_t NumColumns = json_array_size(json_array_get(Rows, 0));
+	for (size_t J = 0; J < NumColumns; ++J) {
+		json_t *Values = json_array();
+		for (size_t I = 0; I < json_array_size(Rows); ++I) json_array_append(Values, json_array_get(json_array_get(Rows, I), J));
+		json_t *Argument = json_pack("{sisisIso}", "dataset", DatasetIndex, "column", (int)J, "start", Start, "values", Values);
+		request_t Request[1];
+		memset(Request, 0, sizeof(request_t));
+		json_decref(Write->Fn(Request, Argument));
+		json_decref(Argument);
+	}
+	return 0;
+}
+
+static int wal_apply(json_t *Record) {
+	const char *Method;
+	json_t *Argument;
+	json_int_t Index = -1, Start = -1;
+	if (json_unpack(Record, "{sssos?Is?I}", "method", &Method, "argument", &Argument, "index", &Index, "start", &Start)) return -1;
+	method_t *MethodInfo = stringmap_search(Methods, Method);
+	if (!MethodInfo || !MethodInfo->Logged) return -1;
+	if (Index >= 0) {
+		pthread_rwlock_rdlock(DatasetsLock);
+		int Count = NumDatasets;
+		pthread_rwlock_unlock(DatasetsLock);
+		if (Index < Count) return 0;
+		if (Index > Count) return -1;
+	}
+	if (Start >= 0) {
+		int DatasetIndex;
+		json_t *Rows = NULL;
+		if (json_unpack(Argument, "{sis?o}", "dataset", &DatasetIndex, "rows", &Rows)) return -1;
+		dataset_t *Dataset = datasets_find(DatasetIndex);
+		if (Dataset) {
+			size_t Length = dataset_get_length(Dataset);
+			if (Length < Start) return -1;
+			if (Length > Start) return Rows ? wal_apply_rows(DatasetIndex, Start, Rows) : 0;
+		}
+	}
+	const char *Error = wal_check(Method, Argument);
+	if (Error) {
+		fprintf(stderr, "Error: %s: %s\n", Method, Error);
+		return -1;
+	}
+	request_t Request[1];
+	memset(Request, 0, sizeof(request_t));
+	json_t *Result = MethodInfo->Fn(Request, Argument);
+	// requests that failed on the leader are logged too and fail the same way here
+	if (Verbose && json_is_object(Result) && json_object_get(Result, "error")) {
+		printf("Log %s: %s\n", Method, json_string_value(json_object_get(Result, "error")));
+	}
+	json_decref(Result);
+	return 0;
+}
+
+static int wal_recover_record(json_t *Record, uint64_t Seq, off_t Offset, void *Data) {
+	int *Replayed = (int *)Data;
+	if (Replayed[1]) wal_mark(Seq, Offset);
+	if (Seq <= WalSeq) return 0;
+	if (Seq != WalSeq + 1) {
+		fprintf(stderr, "Error: log is missing records %" PRIu64 " to %" PRIu64 "\n", WalSeq + 1, Seq - 1);
+		exit(1);
+	}
+	if (wal_apply(Record)) {
+		fprintf(stderr, "Error: log record %" PRIu64 " cannot be applied\n", Seq);
+		exit(1);
+	}
+	WalSeq = Seq;
+	++Replayed[0];
+	return 0;
+}
+
+static void wal_recover() {
+	char *FileName = wal_file("wal.checkpoint");
+	FILE *File = fopen(FileName, "r");
+	if (File) {
+		if (fscanf(File, "%" SCNu64, &WalSeq) != 1) WalSeq = 0;
+		fclose(File);
+	}
+	free(FileName);
+	int Replayed[2] = {0, 0};
+	char *OldName = wal_file("wal.log.1");
+	wal_scan(OldName, 0, wal_recover_record, Replayed);
+	free(OldName);
+	Replayed[1] = 1;
+	char *LogName = wal_file("wal.log");
+	WalSize = wal_scan(LogName, 0, wal_recover_record, Replayed);
+	WalFd = open(LogName, O_WRONLY | O_CREAT | O_APPEND, 0666);
+	free(LogName);
+	if (WalFd < 0) {
+		fprintf(stderr, "Error: error opening log\n");
+		exit(1);
+	}
+	// a torn record at the end was never acknowledged
+	if (ftruncate(WalFd, WalSize)) fprintf(stderr, "Error: error truncating log\n");
+	WalSynced = WalApplied = WalSeq;
+	if (Replayed[0]) printf("Replayed %d log records up to %" PRIu64 "\n", Replayed[0], WalSeq);
+}
+
+typedef struct wal_reader_t {
+	json_t *Records;
+	uint64_t From;
+	size_t Limit;
+} wal_reader_t;
+
+static int wal_read_record(json_t *Record, uint64_t Seq, off_t Offset, void *Data) {
+	wal_reader_t *Reader = (wal_reader_t *)Data;
+	if (Seq < Reader->From) return 0;
+	json_array_append(Reader->Records, Record);
+	return json_array_size(Reader->Records) >= Reader->Limit;
+}
+
+static json_t *method_wal_read(request_t *Request, json_t *Argument) {
+	json_int_t From, Limit = WAL_READ_LIMIT;
+	if (json_unpack(Argument, "{sIs?I}", "from", &From, "limit", &Limit)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	if (WalFd < 0) return json_pack("{ss}", "error", "log not enabled");
+	if (Limit <= 0 || Limit > WAL_READ_LIMIT) Limit = WAL_READ_LIMIT;
+	wal_reader_t Reader[1] = {{json_array(), From, Limit}};
+	pthread_mutex_lock(WalLock);
+	uint64_t Seq = WalSeq;
+	off_t Offset = 0;
+	if (!WalFirst || From < WalFirst) {
+		char *OldName = wal_file("wal.log.1");
+		wal_scan(OldName, 0, wal_read_record, Reader);
+		free(OldName);
+	} else {
+		for (int I = 0; I < NumWalMarks && WalMarks[I].Seq <= From; ++I) Offset = WalMarks[I].Offset;
+	}
+	if (json_array_size(Reader->Records) < Limit) {
+		char *LogName = wal_file("wal.log");
+		wal_scan(LogName, Offset, wal_read_record, Reader);
+		free(LogName);
+	}
+	pthread_mutex_unlock(WalLock);
+	return json_pack("{sIso}", "seq", (json_int_t)Seq, "records", Reader->Records);
+}
+
+static void *wal_follow(void *Data) {
+	zsock_t *Socket = NULL;
+	for (;;) {
+		if (!Socket) {
+			Socket = zsock_new_dealer(Leader);
+			zsock_set_rcvtimeo(Socket, WAL_FOLLOW_TIMEOUT);
+		}
+		zstr_sendf(Socket, "[0,\"wal/read\",{\"from\":%" PRIu64 "}]", WalSeq + 1);
+		char *ResponseString = zstr_recv(Socket);
+		if (!ResponseString) {
+			// a fresh socket drops any late response to the lost request
+			zsock_destroy(&Socket);
+			zclock_sleep(WAL_FOLLOW_INTERVAL);
+			continue;
+		}
+		json_t *Response = json_loads(ResponseString, 0, NULL);
+		zstr_free(&ResponseString);
+		json_t *Result = json_array_get(Response, 1);
+		json_t *Records = json_object_get(Result, "records");
+		if (!Records) {
+			json_t *Error = json_object_get(Result, "error");
+			fprintf(stderr, "Error: %s\n", Error ? json_string_value(Error) : "invalid log response");
+			json_decref(Response);
+			zclock_sleep(WAL_FOLLOW_TIMEOUT);
+			continue;
+		}
+		size_t Count = json_array_size(Records);
+		pthread_mutex_lock(WalApplyLock);
+		for (size_t I = 0; I < Count; ++I) {
+			json_t *Record = json_array_get(Records, I);
+			uint64_t Seq = json_integer_value(json_object_get(Record, "seq"));
+			if (Seq <= WalSeq) continue;
+			if (Seq != WalSeq + 1) {
+				fprintf(stderr, "Error: leader no longer has record %" PRIu64 ", reseed this follower from a copy of the leader\n", WalSeq + 1);
+				pthread_mutex_unlock(WalApplyLock);
+				json_decref(Response);
+				zsock_destroy(&Socket);
+				return NULL;
+			}
+			pthread_mutex_lock(WalLock);
+			int Status = wal_write(Record, Seq);
+			pthread_mutex_unlock(WalLock);
+			if (Status) {
+				fprintf(stderr, "Error: error writing log\n");
+				break;
+			}
+			if (wal_apply(Record)) {
+				fprintf(stderr, "Error: record %" PRIu64 " cannot be applied here, reseed this follower from a copy of the leader\n", Seq);
+				pthread_mutex_unlock(WalApplyLock);
+				json_decref(Response);
+				zsock_destroy(&Socket);
+				return NULL;
+			}
+			__atomic_store_n(&WalApplied, Seq, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(WalApplyLock);
+		json_decref(Response);
+		if (!WalSyncInterval) wal_sync();
+		if (Count < WAL_READ_LIMIT) zclock_sleep(WAL_FOLLOW_INTERVAL);
+	}
+	return NULL;
+}
+
+static pthread_mutex_t ClientsLock[1] = {PTHREAD_MUTEX_INITIALIZER};
+
+static size_t request_respond(zmsg_t *ResponseMsg, json_t *Index, json_t *Result) {
+	json_t *Response = json_pack("[oo]", Index, Result);
+	char *ResponseString = json_dumps(Response, JSON_COMPACT);
+	size_t BytesOut = strlen(ResponseString);
+	zmsg_addstr(ResponseMsg, ResponseString);
+	free(ResponseString);
+	json_decref(Response);
+	return BytesOut;
+}
+
+static void request_run(request_t *Request, zframe_t *RequestFrame, zmsg_t *ResponseMsg) {
+	// every request is answered, those that cannot be run with an error so replies line up with the batch
+	json_error_t Error;
+	json_t *RequestJson = json_loadb(zframe_data(RequestFrame), zframe_size(RequestFrame), 0, &Error);
+	if (!RequestJson) {
+		fprintf(stderr, "Error: %s:%d: %s\n", Error.source, Error.line, Error.text);
+		request_respond(ResponseMsg, json_null(), json_pack("{ss}", "error", "invalid request"));
+		return;
+	}
+	int Index;
+	const char *Method;
+	json_t *Argument;
+	if (json_unpack(RequestJson, "[iso]", &Index, &Method, &Argument)) {
+		fprintf(stderr, "Error: invalid request\n");
+		json_t *IndexJson = json_array_get(RequestJson, 0);
+		request_respond(ResponseMsg, json_is_integer(IndexJson) ? json_incref(IndexJson) : json_null(), json_pack("{ss}", "error", "invalid request"));
+		json_decref(RequestJson);
+		return;
+	}
+	if (Verbose) printf("Method = %s\n", Method);
+	method_t *MethodInfo = stringmap_search(Methods, Method);
+	if (!MethodInfo) {
+		fprintf(stderr, "Error: unknown method %s\n", Method);
+		request_respond(ResponseMsg, json_integer(Index), json_pack("{ss}", "error", "unknown method"));
+		json_decref(RequestJson);
+		return;
+	}
+	int64_t Start = zclock_usecs();
+	json_t *Result;
+	if (MethodInfo->Logged && Leader) {
+		Result = json_pack("{ss}", "error", "read only follower");
+	} else if (MethodInfo->Logged && WalFd >= 0) {
+		pthread_mutex_lock(WalApplyLock);
+		const char *Error = wal_check(Method, Argument);
+		if (!Error) {
+			pthread_mutex_lock(WalLock);
+			if (wal_log(Method, Argument)) Error = "error writing log";
+			uint64_t Seq = WalSeq;
+			pthread_mutex_unlock(WalLock);
+			if (!Error) {
+				Result = MethodInfo->Fn(Request, Argument);
+				__atomic_store_n(&WalApplied, Seq, __ATOMIC_RELEASE);
+			}
+		}
+		if (Error) Result = json_pack("{ss}", "error", Error);
+		pthread_mutex_unlock(WalApplyLock);
+	} else {
+		Result = MethodInfo->Fn(Request, Argument);
+	}
+	json_decref(RequestJson);
+	if (Request->Snapshot) snapshot_release(Request->Snapshot);
+	if (!Result) Result = json_pack("{ss}", "error", "internal error");
+	int Failed = json_is_object(Result) && json_object_get(Result, "error");
+	size_t BytesOut = request_respond(ResponseMsg, json_integer(Index), Result);
+	for (int I = 0; I < Request->NumParts; ++I) BytesOut += Request->Parts[I].Size;
+	method_record(MethodInfo, zclock_usecs() - Start, Failed, zframe_size(RequestFrame), BytesOut);
+}
+
+static void datasets_send(zsock_t *Socket, zmsg_t *ResponseMsg, request_t *Requests, int NumResponses) {
+	int NumParts = 0;
+	for (int I = 0; I < NumResponses; ++I) NumParts += Requests[I].NumParts;
+	if (!NumParts) {
+		zmsg_send(&ResponseMsg, Socket);
+		return;
+	}
+	// binary parts follow the json frame of their request and are released by zmq once sent
+	zframe_t *Frame = zmsg_pop(ResponseMsg);
+	zframe_send(&Frame, Socket, ZFRAME_MORE);
+	for (int I = 0; I < NumResponses; ++I) {
+		request_t *Request = Requests + I;
+		int Last = I + 1 == NumResponses;
+		Frame = zmsg_pop(ResponseMsg);
+		zframe_send(&Frame, Socket, (Last && !Request->NumParts) ? 0 : ZFRAME_MORE);
+		for (int J = 0; J < Request->NumParts; ++J) {
+			request_part_t *Part = Request->Parts + J;
+			zmq_msg_t Msg;
+			zmq_msg_init_data(&Msg, Part->Data, Part->Size, Part->Free, Part->Hint);
+			int Flags = (Last && J + 1 == Request->NumParts) ? 0 : ZMQ_SNDMORE;
+			if (zmq_msg_send(&Msg, zsock_resolve(Socket), Flags) < 0) zmq_msg_close(&Msg);
+		}
+	}
+	zmsg_destroy(&ResponseMsg);
+}
+
+static void datasets_handle(zsock_t *Socket) {
+	static char HexDigits[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+	for (;;) {
+		zmsg_t *RequestMsg = zmsg_recv(Socket);
+		if (!RequestMsg) break;
+		if (Verbose) zmsg_print(RequestMsg);
+		zframe_t *ClientFrame = zmsg_pop(RequestMsg);
+		size_t IdSize = zframe_size(ClientFrame);
+		byte *IdData = zframe_data(ClientFrame);
+		char ClientId[2 * IdSize + 1];
+		char *Id = ClientId;
+		for (int I = 0; I < IdSize; ++I) {
+			Id[2 * I] = HexDigits[IdData[I] & 15];
+			Id[2 * I + 1] = HexDigits[(IdData[I] / 16) & 15];
+		}
+		Id[2 * IdSize] = 0;
+		pthread_mutex_lock(ClientsLock);
+		client_t *Client = stringmap_search(Clients, ClientId);
+		if (!Client) {
+			Client = new(client_t);
+			stringmap_insert(Clients, GC_strdup(ClientId), Client);
+			Client->Frame = zframe_dup(ClientFrame);
+		}
+		pthread_mutex_unlock(ClientsLock);
+		// each remaining frame is a request, a batch is run in order and answered in a single message
+		int NumRequests = zmsg_size(RequestMsg);
+		zmsg_t *ResponseMsg = zmsg_new();
+		int NumResponses = 0;
+		request_t *Requests = calloc(NumRequests ?: 1, sizeof(request_t));
+		if (NumRequests > MAX_BATCH) {
+			// a batch past the limit is refused as a whole with a single error
+			request_respond(ResponseMsg, json_null(), json_pack("{ss}", "error", "batch too large"));
+			NumResponses = 1;
+		} else {
+			zframe_t *RequestFrame;
+			while ((RequestFrame = zmsg_pop(RequestMsg))) {
+				request_t *Request = Requests + NumResponses++;
+				Request->Client = Client;
+				request_run(Request, RequestFrame, ResponseMsg);
+				zframe_destroy(&RequestFrame);
+			}
+		}
+		zmsg_destroy(&RequestMsg);
+		// logged requests in the batch are durable before any of them is answered
+		if (WalFd >= 0 && !WalSyncInterval) wal_sync();
+		if (!NumResponses) {
+			free(Requests);
+			zmsg_destroy(&ResponseMsg);
+			zframe_destroy(&ClientFrame);
+			continue;
+		}
+		zmsg_prepend(ResponseMsg, &ClientFrame);
+		if (Verbose) zmsg_print(ResponseMsg);
+		datasets_send(Socket, ResponseMsg, Requests, NumResponses);
+		free(Requests);
+	}
+}
+
+static void *datasets_worker(void *Data) {
+	zsock_t *Socket = zsock_new_dealer(NULL);
+	zsock_set_rcvhwm(Socket, 1);
+	zsock_connect(Socket, "inproc://workers");
+	datasets_handle(Socket);
+	zsock_destroy(&Socket);
+	return NULL;
+}
+
+static void datasets_serve(int Port, int Threads) {
+	zsock_t *Frontend = zsock_new_router(NULL);
+	zsock_bind(Frontend, "tcp://*:%d", Port);
+	if (Threads <= 1) {
+		datasets_handle(Frontend);
+		return;
+	}
+	zsock_t *Backend = zsock_new_dealer(NULL);
+	zsock_set_sndhwm(Backend, 1);
+	zsock_bind(Backend, "inproc://workers");
+	for (int I = 0; I < Threads; ++I) {
+		pthread_t Thread;
+		pthread_create(&Thread, NULL, datasets_worker, NULL);
+		pthread_detach(Thread);
+	}
+	zmq_proxy(zsock_resolve(Frontend), zsock_resolve(Backend), NULL);
+	zsock_destroy(&Backend);
+	zsock_destroy(&Frontend);
+}
+
+static json_t *method_dataset_list(request_t *Request, json_t *Argument) {
+	json_t *Result = json_array();
+	pthread_rwlock_rdlock(DatasetsLock);
+	for (int Index = 0; Index < NumDatasets; ++Index) {
+		dataset_t *Dataset = __atomic_load_n(&DatasetEntries[Index]->Dataset, __ATOMIC_ACQUIRE);
+		if (Dataset) json_array_append_new(Result, json_pack("{siso}", "index", Index, "info", dataset_get_info(Dataset)));
+	}
+	pthread_rwlock_unlock(DatasetsLock);
+	return Result;
+}
+
+static json_t *method_dataset_find(request_t *Request, json_t *Argument) {
+	const char *Name;
+	if (json_unpack(Argument, "{ss}", "name", &Name)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	int Index = datasets_find_name(Name);
+	if (Index < 0) return json_pack("{ss}", "error", "dataset not found");
+	return json_pack("{si}", "index", Index);
+}
+
+static json_t *method_column_find(request_t *Request, json_t *Argument) {
+	int DatasetIndex, SnapshotId = -1;
+	const char *Name;
+	if (json_unpack(Argument, "{sisss?i}", "dataset", &DatasetIndex, "name", &Name, "snapshot", &SnapshotId)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_view(Request, DatasetIndex, SnapshotId);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	int Index = dataset_get_column_index(Dataset, Name);
+	if (Index < 0) return json_pack("{ss}", "error", "column not found");
+	return json_pack("{sisi}", "index", Index, "type", dataset_get_column_type(Dataset, Index));
+}
+
+static void datasets_flush() {
+	pthread_rwlock_rdlock(DatasetsLock);
+	for (int Index = 0; Index < NumDatasets; ++Index) {
+		dataset_t *Dataset = __atomic_load_n(&DatasetEntries[Index]->Dataset, __ATOMIC_ACQUIRE);
+		if (Dataset) dataset_flush(Dataset);
+	}
+	pthread_rwlock_unlock(DatasetsLock);
+}
+
+static void *datasets_flusher(void *Data) {
+	int Interval = (intptr_t)Data;
+	for (;;) {
+		zclock_sleep(Interval);
+		datasets_flush();
+	}
+	return NULL;
+}
+
+static void *datasets_closer(void *Data) {
+	// a clean shutdown syncs every column, so no zone map is rebuilt on the next start
+	sigset_t *Signals = (sigset_t *)Data;
+	int Signal;
+	sigwait(Signals, &Signal);
+	datasets_flush();
+	exit(0);
+	return NULL;
+}
+
+static dataset_entry_t *datasets_reserve(int *Index) {
+	pthread_rwlock_wrlock(DatasetsLock);
+	if (NumDatasets == MaxDatasets) {
+		MaxDatasets = MaxDatasets ? 2 * MaxDatasets : 16;
+		DatasetEntries = GC_realloc(DatasetEntries, MaxDatasets * sizeof(dataset_entry_t *));
+	}
+	dataset_entry_t *Entry = DatasetEntries[NumDatasets] = new(dataset_entry_t);
+	*Index = NumDatasets++;
+	pthread_rwlock_unlock(DatasetsLock);
+	return Entry;
+}
+
+static void datasets_unreserve(int Index) {
+	// a failed create gives its index back unless a later create already took the next one
+	pthread_rwlock_wrlock(DatasetsLock);
+	if (Index == NumDatasets - 1) --NumDatasets;
+	pthread_rwlock_unlock(DatasetsLock);
+}
+
+static void datasets_publish(dataset_entry_t *Entry, int Index, dataset_t *Dataset) {
+	pthread_rwlock_wrlock(DatasetsLock);
+	__atomic_store_n(&Entry->Dataset, Dataset, __ATOMIC_RELEASE);
+	stringmap_insert(DatasetNames, dataset_get_name(Dataset), (void *)(intptr_t)(Index + 1));
+	pthread_rwlock_unlock(DatasetsLock);
+}
+
+static json_t *method_dataset_create(request_t *Request, json_t *Argument) {
+	const char *Name;
+	int Length;
+	if (json_unpack(Argument, "{sssi}", "name", &Name, "length", &Length)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	int Index;
+	dataset_entry_t *Entry = datasets_reserve(&Index);
+	char *Path;
+	asprintf(&Path, "%s/%d", DatasetPath, Index);
+	dataset_t *Dataset = dataset_create(Path, Name, Length);
+	if (!Dataset) {
+		datasets_unreserve(Index);
+		return json_pack("{ss}", "error", "error creating dataset");
+	}
+	datasets_publish(Entry, Index, Dataset);
+	return json_pack("{siso}", "index", Index, "info", dataset_get_info(Dataset));
+}
+
+static json_t *method_dataset_import(request_t *Request, json_t *Argument) {
+	const char *Name, *FileName;
+	json_t *TypesJson = NULL;
+	if (json_unpack(Argument, "{sssss?o}", "name", &Name, "file", &FileName, "types", &TypesJson)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	int NumTypes = json_array_size(TypesJson);
+	column_type_t Types[NumTypes + 1];
+	for (int I = 0; I < NumTypes; ++I) {
+		json_t *Type = json_array_get(TypesJson, I);
+		if (!json_is_integer(Type)) return json_pack("{ss}", "error", "invalid type");
+		json_int_t Value = json_integer_value(Type);
+		if (Value < COLUMN_STRING || Value > COLUMN_BOOL) return json_pack("{ss}", "error", "invalid type");
+		Types[I] = Value;
+	}
+	int Index;
+	dataset_entry_t *Entry = datasets_reserve(&Index);
+	char *Path;
+	asprintf(&Path, "%s/%d", DatasetPath, Index);
+	dataset_t *Dataset = dataset_import(Path, Name, FileName, NumTypes, Types);
+	if (!Dataset) {
+		datasets_unreserve(Index);
+		return json_pack("{ss}", "error", "error importing dataset");
+	}
+	datasets_publish(Entry, Index, Dataset);
+	return json_pack("{siso}", "index", Index, "info", dataset_get_info(Dataset));
+}
+
+static json_t *method_dataset_drop(request_t *Request, json_t *Argument) {
+	// undoes a create for a coordinator, mappings stay valid for any request still using the dataset
+	int DatasetIndex;
+	if (json_unpack(Argument, "{si}", "dataset", &DatasetIndex)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	pthread_rwlock_wrlock(DatasetsLock);
+	dataset_t *Dataset = (DatasetIndex >= 0 && DatasetIndex < NumDatasets) ? DatasetEntries[DatasetIndex]->Dataset : NULL;
+	if (!Dataset) {
+		pthread_rwlock_unlock(DatasetsLock);
+		return json_pack("{ss}", "error", "invalid dataset");
+	}
+	__atomic_store_n(&DatasetEntries[DatasetIndex]->Dataset, NULL, __ATOMIC_RELEASE);
+	const char *Name = dataset_get_name(Dataset);
+	if ((intptr_t)stringmap_search(DatasetNames, Name) == DatasetIndex + 1) stringmap_remove(DatasetNames, Name);
+	if (DatasetIndex == NumDatasets - 1) --NumDatasets;
+	pthread_rwlock_unlock(DatasetsLock);
+	char *Path;
+	asprintf(&Path, "%s/%d", DatasetPath, DatasetIndex);
+	snapshot_remove(Path);
+	free(Path);
+	return json_pack("{sb}", "dropped", 1);
+}
+
+static json_t *method_dataset_snapshot(request_t *Request, json_t *Argument) {
+	int DatasetIndex;
+	if (json_unpack(Argument, "{si}", "dataset", &DatasetIndex)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_find(DatasetIndex);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	pthread_mutex_lock(SnapshotsLock);
+	if (NumSnapshots == MaxSnapshots) {
+		MaxSnapshots = MaxSnapshots ? 2 * MaxSnapshots : 16;
+		Snapshots = GC_realloc(Snapshots, MaxSnapshots * sizeof(snapshot_t *));
+	}
+	int Id = NumSnapshots++;
+	Snapshots[Id] = NULL;
+	pthread_mutex_unlock(SnapshotsLock);
+	snapshot_t *Snapshot = new(snapshot_t);
+	asprintf(&Snapshot->Path, "%s/snapshots/%d", DatasetPath, Id);
+	Snapshot->Source = DatasetIndex;
+	Snapshot->Refs = 1;
+	Snapshot->Dataset = dataset_snapshot(Dataset, Snapshot->Path);
+	if (!Snapshot->Dataset) {
+		snapshot_remove(Snapshot->Path);
+		return json_pack("{ss}", "error", "error creating snapshot");
+	}
+	pthread_mutex_lock(SnapshotsLock);
+	Snapshots[Id] = Snapshot;
+	pthread_mutex_unlock(SnapshotsLock);
+	return json_pack("{sisI}", "snapshot", Id, "length", (json_int_t)dataset_get_length(Snapshot->Dataset));
+}
+
+static json_t *method_dataset_release(request_t *Request, json_t *Argument) {
+	int SnapshotId;
+	if (json_unpack(Argument, "{si}", "snapshot", &SnapshotId)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	snapshot_t *Snapshot = NULL;
+	pthread_mutex_lock(SnapshotsLock);
+	if (SnapshotId >= 0 && SnapshotId < NumSnapshots) {
+		Snapshot = Snapshots[SnapshotId];
+		Snapshots[SnapshotId] = NULL;
+	}
+	pthread_mutex_unlock(SnapshotsLock);
+	if (!Snapshot) return json_pack("{ss}", "error", "invalid snapshot");
+	snapshot_release(Snapshot);
+	return json_true();
+}
+
+static json_t *json_number_or_null(double Value) {
+	// json has no encoding for NaN or infinities
+	return isfinite(Value) ? json_real(Value) : json_null();
+}
+
+static json_t *column_values_json(column_t *Column, size_t Start, size_t Count) {
+	json_t *Values = json_array();
+	switch (column_get_type(Column)) {
+	case COLUMN_STRING:
+	case COLUMN_CATEGORY: {
+		size_t MaxLength = 0;
+		for (size_t I = Start; I < Start + Count; ++I) {
+			size_t ValueLength = column_string_get_length(Column, I);
+			if (MaxLength < ValueLength) MaxLength = ValueLength;
+		}
+		char *Buffer = malloc(MaxLength + 1);
+		for (size_t I = Start; I < Start + Count; ++I) {
+			size_t ValueLength = column_string_get_length(Column, I);
+			const char *Value = column_string_get_pointer(Column, I);
+			if (!Value) {
+				column_string_get_value(Column, I, Buffer);
+				Value = Buffer;
+			}
+			json_array_append_new(Values, json_stringn(Value, ValueLength) ?: json_null());
+		}
+		free(Buffer);
+		break;
+	}
+	case COLUMN_REAL: {
+		double *Buffer = malloc(Count * sizeof(double));
+		column_real_get_range(Column, Start, Count, Buffer);
+		for (size_t I = 0; I < Count; ++I) json_array_append_new(Values, json_number_or_null(Buffer[I]));
+		free(Buffer);
+		break;
+	}
+	case COLUMN_INT32: {
+		int32_t *Buffer = malloc(Count * sizeof(int32_t));
+		column_int32_get_range(Column, Start, Count, Buffer);
+		for (size_t I = 0; I < Count; ++I) json_array_append_new(Values, json_integer(Buffer[I]));
+		free(Buffer);
+		break;
+	}
+	case COLUMN_INT64: {
+		int64_t *Buffer = malloc(Count * sizeof(int64_t));
+		column_int64_get_range(Column, Start, Count, Buffer);
+		for (size_t I = 0; I < Count; ++I) json_array_append_new(Values, json_integer(Buffer[I]));
+		free(Buffer);
+		break;
+	}
+	case COLUMN_FLOAT32: {
+		float *Buffer = malloc(Count * sizeof(float));
+		column_float32_get_range(Column, Start, Count, Buffer);
+		for (size_t I = 0; I < Count; ++I) json_array_append_new(Values, json_number_or_null(Buffer[I]));
+		free(Buffer);
+		break;
+	}
+	case COLUMN_BOOL: {
+		uint8_t *Buffer = malloc(Count);
+		column_bool_get_range(Column, Start, Count, Buffer);
+		for (size_t I = 0; I < Count; ++I) json_array_append_new(Values, json_boolean(Buffer[I]));
+		free(Buffer);
+		break;
+	}
+	}
+	return Values;
+}
+
+static json_t *column_read_binary(request_t *Request, column_t *Column, size_t Start, size_t Count) {
+	column_type_t Type = column_get_type(Column);
+	json_t *Result = json_pack("{sIsIsi}", "start", (json_int_t)Start, "count", (json_int_t)Count, "type", Type);
+	switch (Type) {
+	case COLUMN_STRING:
+	case COLUMN_CATEGORY: {
+		uint64_t *Offsets = malloc((Count + 1) * sizeof(uint64_t));
+		column_lock_read(Column);
+		uint64_t Total = 0;
+		for (size_t I = 0; I < Count; ++I) {
+			Offsets[I] = Total;
+			Total += column_string_get_length(Column, Start + I);
+		}
+		Offsets[Count] = Total;
+		char *Bytes = malloc(Total + 1);
+		for (size_t I = 0; I < Count; ++I) column_string_get_value(Column, Start + I, Bytes + Offsets[I]);
+		column_unlock(Column);
+		request_attach(Request, Offsets, (Count + 1) * sizeof(uint64_t), request_free, NULL);
+		request_attach(Request, Bytes, Total, request_free, NULL);
+		json_object_set_new(Result, "width", json_integer(0));
+		break;
+	}
+	case COLUMN_BOOL: {
+		uint8_t *Bools = malloc(Count + 1);
+		column_lock_read(Column);
+		column_bool_get_range(Column, Start, Count, Bools);
+		column_unlock(Column);
+		request_attach(Request, Bools, Count, request_free, NULL);
+		json_object_set_new(Result, "width", json_integer(1));
+		break;
+	}
+	default: {
+		// fixed width values are sent straight from the mapped file
+		size_t Width;
+		const void *Values = column_pin(Column, Start, &Width);
+		if (Values) {
+			request_attach(Request, (void *)Values, Count * Width, request_unpin, Column);
+		} else {
+			// frozen columns are decompressed into a copy
+			void *Copy = malloc(Count * Width + 1);
+			column_lock_read(Column);
+			switch (Type) {
+			case COLUMN_REAL: column_real_get_range(Column, Start, Count, Copy); break;
+			case COLUMN_INT32: column_int32_get_range(Column, Start, Count, Copy); break;
+			case COLUMN_INT64: column_int64_get_range(Column, Start, Count, Copy); break;
+			case COLUMN_FLOAT32: column_float32_get_range(Column, Start, Count, Copy); break;
+			default: break;
+			}
+			column_unlock(Column);
+			request_attach(Request, Copy, Count * Width, request_free, NULL);
+		}
+		json_object_set_new(Result, "width", json_integer(Width));
+		break;
+	}
+	}
+	json_object_set_new(Result, "frames", json_integer(Request->NumParts));
+	return Result;
+}
+
+static json_t *method_column_read(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex, Binary = 0, SnapshotId = -1;
+	json_int_t Start = 0, Count = -1;
+	if (json_unpack(Argument, "{sisis?Is?Is?bs?i}", "dataset", &DatasetIndex, "column", &ColumnIndex, "start", &Start, "count", &Count, "binary", &Binary, "snapshot", &SnapshotId)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_view(Request, DatasetIndex, SnapshotId);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	size_t Length = column_get_length(Column);
+	if (Start < 0 || Start > Length) return json_pack("{ss}", "error", "invalid range");
+	if (Count < 0 || Count > Length - Start) Count = Length - Start;
+	if (Binary) return column_read_binary(Request, Column, Start, Count);
+	column_lock_read(Column);
+	json_t *Values = column_values_json(Column, Start, Count);
+	column_unlock(Column);
+	return json_pack("{sIso}", "start", Start, "values", Values);
+}
+
+typedef struct column_values_t {
+	size_t Count;
+	void *Values;
+	int *Lengths;
+} column_values_t;
+
+static void column_values_free(column_values_t *Parsed) {
+	free(Parsed->Values);
+	free(Parsed->Lengths);
+	Parsed->Values = NULL;
+	Parsed->Lengths = NULL;
+}
+
+static const char *column_values_parse(column_t *Column, json_t *Values, column_values_t *Parsed) {
+	size_t Count = Parsed->Count = json_array_size(Values);
+	Parsed->Lengths = NULL;
+	switch (column_get_type(Column)) {
+	case COLUMN_STRING:
+	case COLUMN_CATEGORY: {
+		const char **Strings = Parsed->Values = malloc(Count * sizeof(const char *));
+		int *Lengths = Parsed->Lengths = malloc(Count * sizeof(int));
+		for (size_t I = 0; I < Count; ++I) {
+			json_t *Value = json_array_get(Values, I);
+			if (!json_is_string(Value)) {
+				column_values_free(Parsed);
+				return "expected string";
+			}
+			Strings[I] = json_string_value(Value);
+			Lengths[I] = json_string_length(Value);
+		}
+		break;
+	}
+	case COLUMN_REAL: {
+		double *Reals = Parsed->Values = malloc(Count * sizeof(double));
+		for (size_t I = 0; I < Count; ++I) {
+			json_t *Value = json_array_get(Values, I);
+			if (json_is_number(Value)) {
+				Reals[I] = json_number_value(Value);
+			} else if (json_is_null(Value)) {
+				Reals[I] = NAN;
+			} else {
+				column_values_free(Parsed);
+				return "expected number";
+			}
+		}
+		break;
+	}
+	case COLUMN_INT32: {
+		int32_t *Ints = Parsed->Values = malloc(Count * sizeof(int32_t));
+		for (size_t I = 0; I < Count; ++I) {
+			json_t *Value = json_array_get(Values, I);
+			if (!json_is_integer(Value)) {
+				column_values_free(Parsed);
+				return "expected integer";
+			}
+			Ints[I] = json_integer_value(Value);
+		}
+		break;
+	}
+	case COLUMN_INT64: {
+		int64_t *Ints = Parsed->Values = malloc(Count * sizeof(int64_t));
+		for (size_t I = 0; I < Count; ++I) {
+			json_t *Value = json_array_get(Values, I);
+			if (!json_is_integer(Value)) {
+				column_values_free(Parsed);
+				return "expected integer";
+			}
+			Ints[I] = json_integer_value(Value);
+		}
+		break;
+	}
+	case COLUMN_FLOAT32: {
+		float *Floats = Parsed->Values = malloc(Count * sizeof(float));
+		for (size_t I = 0; I < Count; ++I) {
+			json_t *Value = json_array_get(Values, I);
+			if (json_is_number(Value)) {
+				Floats[I] = json_number_value(Value);
+			} else if (json_is_null(Value)) {
+				Floats[I] = NAN;
+			} else {
+				column_values_free(Parsed);
+				return "expected number";
+			}
+		}
+		break;
+	}
+	case COLUMN_BOOL: {
+		uint8_t *Bools = Parsed->Values = malloc(Count ?: 1);
+		for (size_t I = 0; I < Count; ++I) {
+			json_t *Value = json_array_get(Values, I);
+			if (json_is_boolean(Value)) {
+				Bools[I] = json_is_true(Value);
+			} else if (json_is_integer(Value)) {
+				Bools[I] = json_integer_value(Value) != 0;
+			} else {
+				column_values_free(Parsed);
+				return "expected boolean";
+			}
+		}
+		break;
+	}
+	}
+	return NULL;
+}
+
+static void column_values_write(column_t *Column, size_t Start, column_values_t *Parsed) {
+	size_t Count = Parsed->Count;
+	switch (column_get_type(Column)) {
+	case COLUMN_STRING:
+	case COLUMN_CATEGORY:
+		column_string_set_range(Column, Start, Count, Parsed->Values, Parsed->Lengths);
+		break;
+	case COLUMN_REAL:
+		column_real_set_range(Column, Start, Count, Parsed->Values);
+		break;
+	case COLUMN_INT32:
+		column_int32_set_range(Column, Start, Count, Parsed->Values);
+		break;
+	case COLUMN_INT64:
+		column_int64_set_range(Column, Start, Count, Parsed->Values);
+		break;
+	case COLUMN_FLOAT32:
+		column_float32_set_range(Column, Start, Count, Parsed->Values);
+		break;
+	case COLUMN_BOOL:
+		column_bool_set_range(Column, Start, Count, Parsed->Values);
+		break;
+	}
+}
+
+static json_t *method_column_write(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex;
+	json_int_t Start = 0;
+	json_t *Values;
+	if (json_unpack(Argument, "{sisis?Iso}", "dataset", &DatasetIndex, "column", &ColumnIndex, "start", &Start, "values", &Values)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	if (!json_is_array(Values)) return json_pack("{ss}", "error", "invalid arguments");
+	dataset_t *Dataset = datasets_find(DatasetIndex);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	if (column_is_frozen(Column)) return json_pack("{ss}", "error", "column is frozen");
+	size_t Length = column_get_length(Column);
+	size_t Count = json_array_size(Values);
+	if (Start < 0 || Start > Length || Count > Length - Start) return json_pack("{ss}", "error", "invalid range");
+	column_values_t Parsed[1];
+	const char *Error = column_values_parse(Column, Values, Parsed);
+	if (Error) return json_pack("{ss}", "error", Error);
+	column_lock_write(Column);
+	column_values_write(Column, Start, Parsed);
+	column_unlock(Column);
+	column_values_free(Parsed);
+	return json_pack("{sIsI}", "start", Start, "count", (json_int_t)Count);
+}
+
+typedef struct append_fill_t {
+	column_t **Columns;
+	column_values_t *Parsed;
+	size_t NumColumns;
+} append_fill_t;
+
+static void append_fill(size_t Start, void *Data) {
+	// called with the columns already write locked, columns added since parsing keep their defaults
+	append_fill_t *Fill = (append_fill_t *)Data;
+	for (size_t J = 0; J < Fill->NumColumns; ++J) column_values_write(Fill->Columns[J], Start, Fill->Parsed + J);
+}
+
+static json_t *method_dataset_append(request_t *Request, json_t *Argument) {
+	int DatasetIndex;
+	json_t *Rows = NULL;
+	json_int_t Count = 0;
+	if (json_unpack(Argument, "{sis?os?I}", "dataset", &DatasetIndex, "rows", &Rows, "count", &Count)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_find(DatasetIndex);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	size_t NumColumns = dataset_get_column_count(Dataset);
+	if (Rows) {
+		if (!json_is_array(Rows)) return json_pack("{ss}", "error", "invalid arguments");
+		Count = json_array_size(Rows);
+		for (size_t I = 0; I < Count; ++I) {
+			json_t *Row = json_array_get(Rows, I);
+			if (!json_is_array(Row) || json_array_size(Row) != NumColumns) return json_pack("{ss}", "error", "invalid row");
+		}
+	}
+	if (Count < 0) return json_pack("{ss}", "error", "invalid count");
+	column_t *Columns[NumColumns];
+	column_values_t Parsed[NumColumns];
+	for (size_t J = 0; J < NumColumns; ++J) {
+		Columns[J] = dataset_column_open(Dataset, J);
+		if (!Columns[J]) return json_pack("{ss}", "error", "invalid column");
+	}
+	if (Rows) {
+		for (size_t J = 0; J < NumColumns; ++J) {
+			json_t *Values = json_array();
+			for (size_t I = 0; I < Count; ++I) json_array_append(Values, json_array_get(json_array_get(Rows, I), J));
+			const char *Error = column_values_parse(Columns[J], Values, Parsed + J);
+			json_decref(Values);
+			if (Error) {
+				for (size_t K = 0; K < J; ++K) column_values_free(Parsed + K);
+				return json_pack("{ss}", "error", Error);
+			}
+		}
+	}
+	size_t Start;
+	append_fill_t Fill[1] = {{Columns, Parsed, NumColumns}};
+	int Status = dataset_append(Dataset, Count, &Start, Rows ? append_fill : NULL, Fill);
+	if (Rows) for (size_t J = 0; J < NumColumns; ++J) column_values_free(Parsed + J);
+	if (Status) return json_pack("{ss}", "error", "error appending rows");
+	return json_pack("{sIsI}", "start", (json_int_t)Start, "count", Count);
+}
+
+static json_t *method_dataset_flush(request_t *Request, json_t *Argument) {
+	int DatasetIndex = -1;
+	if (json_unpack(Argument, "{s?i}", "dataset", &DatasetIndex)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	if (DatasetIndex >= 0) {
+		dataset_t *Dataset = datasets_find(DatasetIndex);
+		if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+		dataset_flush(Dataset);
+	} else {
+		datasets_flush();
+	}
+	return json_true();
+}
+
+/*
+the result cache holds responses of read methods keyed by method and
+argument. An entry is only used while the dataset version (rows and columns
+added) and the versions of the columns it read still match, versions are
+read before the result is computed so a racing write only causes a miss.
+Memory is bounded by CacheLimit bytes, evicting the entry that is cheapest to
+recompute per byte among the least recently used ones.
+*/
+
+#define CACHE_EVICT_SAMPLE 8
+
+typedef struct cache_entry_t cache_entry_t;
+
+struct cache_entry_t {
+	cache_entry_t *Prev, *Next;
+	const char *Key;
+	dataset_t *Dataset;
+	json_t *Result;
+	uint64_t *Versions;
+	size_t NumVersions, Size;
+	uint64_t Cost;
+};
+
+typedef struct cache_key_t {
+	char *Key;
+	dataset_t *Dataset;
+	uint64_t *Versions;
+	size_t NumVersions;
+	int64_t Start;
+} cache_key_t;
+
+static stringmap_t CacheEntries[1] = {STRINGMAP_INIT};
+static cache_entry_t *CacheHead = NULL, *CacheTail = NULL;
+static size_t CacheSize = 0, CacheLimit = 0, CacheCount = 0;
+static uint64_t CacheHits = 0, CacheMisses = 0, CacheEvictions = 0;
+static pthread_mutex_t CacheLock[1] = {PTHREAD_MUTEX_INITIALIZER};
+
+static void cache_unlink(cache_entry_t *Entry) {
+	if (Entry->Prev) Entry->Prev->Next = Entry->Next; else CacheHead = Entry->Next;
+	if (Entry->Next) Entry->Next->Prev = Entry->Prev; else CacheTail = Entry->Prev;
+	Entry->Prev = Entry->Next = NULL;
+}
+
+static void cache_push(cache_entry_t *Entry) {
+	Entry->Next = CacheHead;
+	if (CacheHead) CacheHead->Prev = Entry; else CacheTail = Entry;
+	CacheHead = Entry;
+}
+
+static void cache_remove(cache_entry_t *Entry) {
+	cache_unlink(Entry);
+	stringmap_remove(CacheEntries, Entry->Key);
+	CacheSize -= Entry->Size;
+	--CacheCount;
+	json_decref(Entry->Result);
+}
+
+static void cache_evict() {
+	while (CacheSize > CacheLimit && CacheTail) {
+		cache_entry_t *Victim = CacheTail, *Entry = CacheTail;
+		for (int I = 1; I < CACHE_EVICT_SAMPLE && (Entry = Entry->Prev); ++I) {
+			// Cost / Size < Victim->Cost / Victim->Size
+			if ((double)Entry->Cost * Victim->Size < (double)Victim->Cost * Entry->Size) Victim = Entry;
+		}
+		cache_remove(Victim);
+		++CacheEvictions;
+	}
+}
+
+static json_t *cache_lookup(cache_key_t *Key, const char *Method, json_t *Argument, dataset_t *Dataset, column_t *Column) {
+	// Column is the only column read, or NULL if the request may read any column of the dataset
+	Key->Key = NULL;
+	if (!CacheLimit) return NULL;
+	char *Encoded = json_dumps(Argument, JSON_COMPACT | JSON_SORT_KEYS);
+	asprintf(&Key->Key, "%s:%s", Method, Encoded);
+	free(Encoded);
+	Key->Dataset = Dataset;
+	Key->NumVersions = Column ? 2 : 1 + dataset_get_column_count(Dataset);
+	Key->Versions = anew(uint64_t, Key->NumVersions);
+	Key->Versions[0] = dataset_get_version(Dataset);
+	if (Column) {
+		Key->Versions[1] = column_get_version(Column);
+	} else {
+		for (size_t I = 1; I < Key->NumVersions; ++I) Key->Versions[I] = dataset_get_column_version(Dataset, I - 1);
+	}
+	json_t *Result = NULL;
+	pthread_mutex_lock(CacheLock);
+	cache_entry_t *Entry = stringmap_search(CacheEntries, Key->Key);
+	if (Entry) {
+		if (Entry->Dataset == Dataset && Entry->NumVersions == Key->NumVersions && !memcmp(Entry->Versions, Key->Versions, Key->NumVersions * sizeof(uint64_t))) {
+			cache_unlink(Entry);
+			cache_push(Entry);
+			Result = json_deep_copy(Entry->Result);
+		} else {
+			cache_remove(Entry);
+		}
+	}
+	if (Result) ++CacheHits; else ++CacheMisses;
+	pthread_mutex_unlock(CacheLock);
+	if (Result) {
+		free(Key->Key);
+		Key->Key = NULL;
+		return Result;
+	}
+	Key->Start = zclock_usecs();
+	return NULL;
+}
+
+static json_t *cache_store(cache_key_t *Key, json_t *Result) {
+	if (!Key->Key) return Result;
+	if (!Result) {
+		free(Key->Key);
+		return NULL;
+	}
+	char *Encoded = json_dumps(Result, JSON_COMPACT);
+	size_t Size = strlen(Key->Key) + strlen(Encoded) + sizeof(cache_entry_t) + Key->NumVersions * sizeof(uint64_t);
+	free(Encoded);
+	if (json_object_get(Result, "error") || Size > CacheLimit / 4) {
+		free(Key->Key);
+		return Result;
+	}
+	cache_entry_t *Entry = new(cache_entry_t);
+	Entry->Key = GC_strdup(Key->Key);
+	free(Key->Key);
+	Entry->Dataset = Key->Dataset;
+	Entry->Result = json_deep_copy(Result);
+	Entry->Versions = Key->Versions;
+	Entry->NumVersions = Key->NumVersions;
+	Entry->Size = Size;
+	Entry->Cost = zclock_usecs() - Key->Start;
+	pthread_mutex_lock(CacheLock);
+	cache_entry_t *Old = stringmap_search(CacheEntries, Entry->Key);
+	if (Old) cache_remove(Old);
+	stringmap_insert(CacheEntries, Entry->Key, Entry);
+	cache_push(Entry);
+	CacheSize += Size;
+	++CacheCount;
+	cache_evict();
+	pthread_mutex_unlock(CacheLock);
+	return Result;
+}
+
+static json_t *method_column_groups(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex, SnapshotId = -1;
+	if (json_unpack(Argument, "{sisis?i}", "dataset", &DatasetIndex, "column", &ColumnIndex, "snapshot", &SnapshotId)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_view(Request, DatasetIndex, SnapshotId);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	if (column_get_type(Column) != COLUMN_CATEGORY) return json_pack("{ss}", "error", "not a category column");
+	cache_key_t Key[1];
+	json_t *Cached = cache_lookup(Key, "column/groups", Argument, Dataset, Column);
+	if (Cached) return Cached;
+	column_lock_read(Column);
+	size_t NumCodes = column_category_count(Column);
+	uint64_t *Counts = calloc(NumCodes, sizeof(uint64_t));
+	column_category_counts(Column, 0, column_get_length(Column), Counts);
+	json_t *Values = json_array(), *CountsJson = json_array();
+	for (uint32_t I = 0; I < NumCodes; ++I) {
+		if (!Counts[I]) continue;
+		size_t Length;
+		const char *Value = column_category_value(Column, I, &Length);
+		json_array_append_new(Values, json_stringn(Value, Length) ?: json_null());
+		json_array_append_new(CountsJson, json_integer(Counts[I]));
+	}
+	column_unlock(Column);
+	free(Counts);
+	return cache_store(Key, json_pack("{soso}", "values", Values, "counts", CountsJson));
+}
+
+static double json_number_or_nan(json_t *Json) {
+	// null stands for a non-finite value, which must not merge as zero
+	return json_is_number(Json) ? json_number_value(Json) : NAN;
+}
+
+static json_t *method_column_aggregate(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex, NumBuckets = 0, SnapshotId = -1;
+	json_int_t Start = 0, Count = -1;
+	json_t *MinJson = NULL, *MaxJson = NULL;
+	if (json_unpack(Argument, "{sisis?Is?Is?is?os?os?i}", "dataset", &DatasetIndex, "column", &ColumnIndex, "start", &Start, "count", &Count, "buckets", &NumBuckets, "min", &MinJson, "max", &MaxJson, "snapshot", &SnapshotId)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_view(Request, DatasetIndex, SnapshotId);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	if (!column_is_numeric(Column)) return json_pack("{ss}", "error", "not a numeric column");
+	size_t Length = column_get_length(Column);
+	if (Start < 0 || Start > Length) return json_pack("{ss}", "error", "invalid range");
+	if (Count < 0 || Count > Length - Start) Count = Length - Start;
+	if (NumBuckets < 0) return json_pack("{ss}", "error", "invalid bucket count");
+	cache_key_t Key[1];
+	json_t *Cached = cache_lookup(Key, "column/aggregate", Argument, Dataset, Column);
+	if (Cached) return Cached;
+	column_stats_t Stats[1];
+	column_lock_read(Column);
+	column_aggregate(Column, Start, Count, Stats);
+	json_t *Result = json_pack("{sIsososososo}",
+		"count", (json_int_t)Stats->Count,
+		"sum", json_number_or_null(Stats->Sum),
+		"min", json_number_or_null(Stats->Min),
+		"max", json_number_or_null(Stats->Max),
+		"mean", json_number_or_null(Stats->Mean),
+		"variance", json_number_or_null(Stats->Variance)
+	);
+	if (NumBuckets > 0) {
+		double Min = json_is_number(MinJson) ? json_number_value(MinJson) : Stats->Min;
+		double Max = json_is_number(MaxJson) ? json_number_value(MaxJson) : Stats->Max;
+		uint64_t *Buckets = malloc(NumBuckets * sizeof(uint64_t));
+		if (isfinite(Min) && isfinite(Max) && !column_histogram(Column, Start, Count, Min, Max, NumBuckets, Buckets)) {
+			json_t *BucketsJson = json_array();
+			for (int I = 0; I < NumBuckets; ++I) json_array_append_new(BucketsJson, json_integer(Buckets[I]));
+			json_object_set_new(Result, "histogram", json_pack("{sfsfso}", "min", Min, "max", Max, "counts", BucketsJson));
+		}
+		free(Buckets);
+	}
+	column_unlock(Column);
+	return cache_store(Key, Result);
+}
+
+static json_t *method_dataset_query(request_t *Request, json_t *Argument) {
+	int DatasetIndex, SnapshotId = -1;
+	json_t *Where;
+	json_int_t Limit = -1;
+	if (json_unpack(Argument, "{sisos?Is?i}", "dataset", &DatasetIndex, "where", &Where, "limit", &Limit, "snapshot", &SnapshotId)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_view(Request, DatasetIndex, SnapshotId);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	cache_key_t Key[1];
+	json_t *Cached = cache_lookup(Key, "dataset/query", Argument, Dataset, NULL);
+	if (Cached) return Cached;
+	const char *Error;
+	query_t *Query = query_compile(Dataset, Where, &Error);
+	if (!Query) {
+		free(Key->Key);
+		return json_pack("{ss}", "error", Error);
+	}
+	size_t Count, Length;
+	uint64_t *Bitmap = query_run(Query, &Length, &Count);
+	query_free(Query);
+	if (!Bitmap) {
+		free(Key->Key);
+		return json_pack("{ss}", "error", "column is frozen");
+	}
+	if (Limit < 0 || Limit > Count) Limit = Count;
+	json_t *Rows = json_array();
+	size_t Index = query_next(Bitmap, Length, 0);
+	for (json_int_t I = 0; I < Limit; ++I) {
+		json_array_append_new(Rows, json_integer(Index));
+		Index = query_next(Bitmap, Length, Index + 1);
+	}
+	free(Bitmap);
+	return cache_store(Key, json_pack("{sIso}", "count", (json_int_t)Count, "rows", Rows));
+}
+
+static json_t *method_column_index(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex, Drop = 0;
+	if (json_unpack(Argument, "{sisis?b}", "dataset", &DatasetIndex, "column", &ColumnIndex, "drop", &Drop)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_find(DatasetIndex);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	column_type_t Type = column_get_type(Column);
+	if (Type != COLUMN_REAL && Type != COLUMN_STRING) return json_pack("{ss}", "error", "column type cannot be indexed");
+	column_lock_write(Column);
+	int Error = Drop ? column_index_drop(Column) : column_index_create(Column);
+	column_unlock(Column);
+	if (Error) return json_pack("{ss}", "error", Drop ? "column not indexed" : "error creating index");
+	return json_true();
+}
+
+static json_t *method_column_sorted(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex, Descending = 0, SnapshotId = -1;
+	double Min = -INFINITY, Max = INFINITY;
+	json_int_t Offset = 0, Limit = -1;
+	if (json_unpack(Argument, "{sisis?Fs?Fs?Is?Is?bs?i}", "dataset", &DatasetIndex, "column", &ColumnIndex, "min", &Min, "max", &Max, "offset", &Offset, "limit", &Limit, "descending", &Descending, "snapshot", &SnapshotId)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_view(Request, DatasetIndex, SnapshotId);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	if (column_index_type(Column) != INDEX_SORTED) return json_pack("{ss}", "error", "column not indexed");
+	if (Offset < 0) return json_pack("{ss}", "error", "invalid range");
+	column_lock_read(Column);
+	size_t First = column_sorted_lower(Column, Min);
+	size_t Last = column_sorted_upper(Column, Max);
+	size_t Total = Last > First ? Last - First : 0;
+	size_t Count = Offset < Total ? Total - Offset : 0;
+	if (Limit >= 0 && Limit < Count) Count = Limit;
+	// positions are counted from the end of the whole sorted order when descending
+	size_t Position = Descending ? column_sorted_count(Column) - Last + Offset : First + Offset;
+	size_t *Rows = malloc((Count ?: 1) * sizeof(size_t));
+	Count = column_sorted_rows(Column, Position, Count, Descending, Rows);
+	json_t *RowsJson = json_array(), *ValuesJson = json_array();
+	for (size_t I = 0; I < Count; ++I) {
+		json_array_append_new(RowsJson, json_integer(Rows[I]));
+		json_array_append_new(ValuesJson, json_number_or_null(column_real_get(Column, Rows[I])));
+	}
+	column_unlock(Column);
+	free(Rows);
+	return json_pack("{sIsoso}", "count", (json_int_t)Total, "rows", RowsJson, "values", ValuesJson);
+}
+
+static json_t *method_column_lookup(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex, SnapshotId = -1;
+	const char *Value;
+	size_t ValueLength;
+	json_int_t Limit = 1000;
+	if (json_unpack(Argument, "{sisiss%s?Is?i}", "dataset", &DatasetIndex, "column", &ColumnIndex, "value", &Value, &ValueLength, "limit", &Limit, "snapshot", &SnapshotId)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_view(Request, DatasetIndex, SnapshotId);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	column_type_t Type = column_get_type(Column);
+	if (Type != COLUMN_STRING && Type != COLUMN_CATEGORY) return json_pack("{ss}", "error", "not a string column");
+	if (Limit < 0) return json_pack("{ss}", "error", "invalid limit");
+	size_t *Rows = malloc((Limit ?: 1) * sizeof(size_t));
+	column_lock_read(Column);
+	size_t Count = column_string_lookup(Column, Value, ValueLength, Rows, Limit);
+	column_unlock(Column);
+	json_t *RowsJson = json_array();
+	for (size_t I = 0; I < Count && I < Limit; ++I) json_array_append_new(RowsJson, json_integer(Rows[I]));
+	free(Rows);
+	return json_pack("{sIso}", "count", (json_int_t)Count, "rows", RowsJson);
+}
 
-struct dataset_entry_t {
-	dataset_entry_t *Next;
-	dataset_t *Dataset;
-};
+static json_t *method_column_compact(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex;
+	const char *FormatName = "packed";
+	if (json_unpack(Argument, "{sisis?s}", "dataset", &DatasetIndex, "column", &ColumnIndex, "format", &FormatName)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	string_format_t Format;
+	if (!strcmp(FormatName, "packed")) {
+		Format = STRING_PACKED;
+	} else if (!strcmp(FormatName, "linked")) {
+		Format = STRING_LINKED;
+	} else {
+		return json_pack("{ss}", "error", "invalid format");
+	}
+	dataset_t *Dataset = datasets_find(DatasetIndex);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	if (column_get_type(Column) != COLUMN_STRING) return json_pack("{ss}", "error", "not a string column");
+	column_lock_write(Column);
+	int Status = column_compact(Column, Format);
+	column_unlock(Column);
+	if (Status) return json_pack("{ss}", "error", "error compacting column");
+	return json_pack("{ss}", "format", FormatName);
+}
 
-static dataset_entry_t *DatasetEntries = 0;
-static const char *DatasetPath = 0;
+static json_t *method_column_freeze(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex;
+	if (json_unpack(Argument, "{sisi}", "dataset", &DatasetIndex, "column", &ColumnIndex)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	dataset_t *Dataset = datasets_find(DatasetIndex);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	column_lock_write(Column);
+	int Status = column_freeze(Column);
+	column_unlock(Column);
+	if (Status) return json_pack("{ss}", "error", "error freezing column");
+	return json_pack("{sb}", "frozen", 1);
+}
 
-static void datasets_load() {
-	dataset_entry_t **Slot = &DatasetEntries;
-	char DatasetPath[strlen(DatasetPath) + 10];
-	for (int Index = 0; ; ++Index) {
-		struct stat Stat[1];
-		sprintf(DatasetPath, "%s/%d", DatasetPath, Index);
-		if (stat(DatasetPath, Stat)) break;
-		if (!S_ISDIR(Stat->st_mode)) break;
-		dataset_entry_t *Entry = Slot[0] = new(dataset_entry_t);
-		Entry->Dataset = dataset_open(GC_strdup(DatasetPath));
-		Slot = &Entry->Next;
+static json_t *method_column_thaw(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex;
+	if (json_unpack(Argument, "{sisi}", "dataset", &DatasetIndex, "column", &ColumnIndex)) {
+		return json_pack("{ss}", "error", "invalid arguments");
 	}
+	dataset_t *Dataset = datasets_find(DatasetIndex);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	column_lock_write(Column);
+	int Status = column_thaw(Column);
+	column_unlock(Column);
+	if (Status) return json_pack("{ss}", "error", "error thawing column");
+	return json_pack("{sb}", "frozen", 0);
 }
 
-typedef struct client_t {
-	zframe_t *Frame;
-} client_t;
+static json_t *method_column_policy(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex, Access = -1, Prefetch = -1, Lock = -1, HugePages = -1;
+	if (json_unpack(Argument, "{sisis?is?is?bs?b}",
+		"dataset", &DatasetIndex, "column", &ColumnIndex,
+		"access", &Access, "prefetch", &Prefetch, "lock", &Lock, "hugepages", &HugePages
+	)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	if (Access > ACCESS_RANDOM || Prefetch > PREFETCH_POPULATE) return json_pack("{ss}", "error", "invalid policy");
+	dataset_t *Dataset = datasets_find(DatasetIndex);
+	if (!Dataset) return json_pack("{ss}", "error", "invalid dataset");
+	column_t *Column = dataset_column_open(Dataset, ColumnIndex);
+	if (!Column) return json_pack("{ss}", "error", "invalid column");
+	// omitted fields keep their current setting
+	column_policy_t Policy[1];
+	column_lock_write(Column);
+	column_get_policy(Column, Policy);
+	if (Access >= 0) Policy->Access = Access;
+	if (Prefetch >= 0) Policy->Prefetch = Prefetch;
+	if (Lock >= 0) Policy->Lock = Lock;
+	if (HugePages >= 0) Policy->HugePages = HugePages;
+	int Status = column_set_policy(Column, Policy);
+	column_unlock(Column);
+	if (Status) return json_pack("{ss}", "error", "error locking column");
+	return json_pack("{sisisbsb}", "access", Policy->Access, "prefetch", Policy->Prefetch, "lock", Policy->Lock, "hugepages", Policy->HugePages);
+}
 
-static stringmap_t Clients[1] = {STRINGMAP_INIT};
-static stringmap_t Methods[1] = {STRINGMAP_INIT};
+static stringmap_t Globals[1] = {STRINGMAP_INIT};
 
-static void datasets_serve(int Port) {
-	static char HexDigits[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
-	zsock_t *Socket = zsock_new_router(NULL);
-	zsock_bind(Socket, "tcp://*:%d", Port);
+#define FEED_MAX_VALUES 4096
+
+static void feed_send(zsock_t *Feed, const char *Topic, json_t *Record) {
+	char *RecordString = json_dumps(Record, JSON_COMPACT);
+	zmsg_t *RecordMsg = zmsg_new();
+	zmsg_addstr(RecordMsg, Topic);
+	zmsg_addstr(RecordMsg, RecordString);
+	zmsg_send(&RecordMsg, Feed);
+	free(RecordString);
+	json_decref(Record);
+}
+
+static void feed_dataset(zsock_t *Feed, int Index, dataset_entry_t *Entry, dataset_t *Dataset) {
+	char Topic[32];
+	size_t Length = dataset_get_length(Dataset);
+	size_t NumColumns = dataset_get_column_count(Dataset);
+	if (Length != Entry->FeedLength || NumColumns != Entry->FeedColumns) {
+		json_t *Columns = json_array();
+		for (size_t J = Entry->FeedColumns; J < NumColumns; ++J) {
+			json_array_append_new(Columns, json_pack("{sIsssi}", "index", (json_int_t)J, "name", dataset_get_column_name(Dataset, J), "type", dataset_get_column_type(Dataset, J)));
+		}
+		Entry->FeedLength = Length;
+		Entry->FeedColumns = NumColumns;
+		sprintf(Topic, "%d/", Index);
+		feed_send(Feed, Topic, json_pack("{sisIso}", "dataset", Index, "length", (json_int_t)Length, "columns", Columns));
+	}
+	column_t *Column;
+	while ((Column = dataset_take_changed(Dataset))) {
+		column_change_t Changes[COLUMN_MAX_CHANGES];
+		json_t *ChangesJson = json_array();
+		column_lock_read(Column);
+		int NumChanges = column_take_changes(Column, Changes);
+		for (int I = 0; I < NumChanges; ++I) {
+			json_t *Change = json_pack("{sIsI}", "start", (json_int_t)Changes[I].Start, "count", (json_int_t)Changes[I].Count);
+			// large ranges are only announced, subscribers read them back if they need them
+			if (Changes[I].Count <= FEED_MAX_VALUES) {
+				json_object_set_new(Change, "values", column_values_json(Column, Changes[I].Start, Changes[I].Count));
+			}
+			json_array_append_new(ChangesJson, Change);
+		}
+		column_unlock(Column);
+		int ColumnIndex = column_get_index(Column);
+		sprintf(Topic, "%d/%d", Index, ColumnIndex);
+		feed_send(Feed, Topic, json_pack("{sisiso}", "dataset", Index, "column", ColumnIndex, "changes", ChangesJson));
+	}
+}
+
+typedef struct feed_config_t {
+	int Port, Interval;
+} feed_config_t;
+
+static void *datasets_feed(void *Data) {
+	feed_config_t *Config = (feed_config_t *)Data;
+	zsock_t *Feed = zsock_new_pub(NULL);
+	zsock_bind(Feed, "tcp://*:%d", Config->Port);
+	pthread_rwlock_rdlock(DatasetsLock);
+	for (int Index = 0; Index < NumDatasets; ++Index) {
+		dataset_entry_t *Entry = DatasetEntries[Index];
+		dataset_t *Dataset = __atomic_load_n(&Entry->Dataset, __ATOMIC_ACQUIRE);
+		if (!Dataset) continue;
+		Entry->FeedLength = dataset_get_length(Dataset);
+		Entry->FeedColumns = dataset_get_column_count(Dataset);
+	}
+	pthread_rwlock_unlock(DatasetsLock);
+	// changes are coalesced per column between ticks, each changed column is sent as one record
 	for (;;) {
-		zmsg_t *RequestMsg = zmsg_recv(Socket);
-		zmsg_print(RequestMsg);
-		zframe_t *ClientFrame = zmsg_pop(RequestMsg);
-		size_t IdSize = zframe_size(ClientFrame);
-		byte *IdData = zframe_data(ClientFrame);
-		char ClientId[2 * IdSize + 1];
-		char *Id = ClientId;
-		for (int I = 0; I < IdSize; ++I) {
-			Id[2 * I] = HexDigits[IdData[I] & 15];
-			Id[2 * I + 1] = HexDigits[(IdData[I] / 16) & 15];
+		zclock_sleep(Config->Interval);
+		pthread_rwlock_rdlock(DatasetsLock);
+		for (int Index = 0; Index < NumDatasets; ++Index) {
+			dataset_entry_t *Entry = DatasetEntries[Index];
+			dataset_t *Dataset = __atomic_load_n(&Entry->Dataset, __ATOMIC_ACQUIRE);
+			if (Dataset) feed_dataset(Feed, Index, Entry, Dataset);
 		}
-		Id[2 * IdSize] = 0;
-		client_t *Client = stringmap_search(Clients, ClientId);
-		if (!Client) {
-			Client = new(client_t);
-			stringmap_insert(Clients, GC_strdup(ClientId), Client);
-			Client->Frame = zframe_dup(ClientFrame);
+		pthread_rwlock_unlock(DatasetsLock);
+	}
+	return NULL;
+}
+
+static int stats_method(const char *Name, method_t *Method, json_t *Result) {
+	uint64_t Latencies[LATENCY_BUCKETS];
+	uint64_t Count = 0;
+	for (int I = 0; I < LATENCY_BUCKETS; ++I) {
+		Latencies[I] = __atomic_load_n(Method->Latencies + I, __ATOMIC_RELAXED);
+		Count += Latencies[I];
+	}
+	if (!Count) return 0;
+	json_object_set_new(Result, Name, json_pack("{sIsIsIsIsIsIsI}",
+		"count", (json_int_t)Count,
+		"errors", (json_int_t)__atomic_load_n(&Method->Errors, __ATOMIC_RELAXED),
+		"bytes_in", (json_int_t)__atomic_load_n(&Method->BytesIn, __ATOMIC_RELAXED),
+		"bytes_out", (json_int_t)__atomic_load_n(&Method->BytesOut, __ATOMIC_RELAXED),
+		"p50", (json_int_t)method_percentile(Latencies, Count, 0.5),
+		"p99", (json_int_t)method_percentile(Latencies, Count, 0.99),
+		"max", (json_int_t)__atomic_load_n(&Method->MaxLatency, __ATOMIC_RELAXED)
+	));
+	return 0;
+}
+
+static json_t *stats_collect() {
+	json_t *MethodsJson = json_object();
+	stringmap_foreach(Methods, MethodsJson, (void *)stats_method);
+	json_t *DatasetsJson = json_array();
+	pthread_rwlock_rdlock(DatasetsLock);
+	for (int Index = 0; Index < NumDatasets; ++Index) {
+		dataset_t *Dataset = __atomic_load_n(&DatasetEntries[Index]->Dataset, __ATOMIC_ACQUIRE);
+		if (!Dataset) continue;
+		json_t *ColumnsJson = json_array();
+		size_t NumColumns = dataset_get_column_count(Dataset);
+		for (size_t J = 0; J < NumColumns; ++J) {
+			column_counters_t Counters[1];
+			dataset_get_column_counters(Dataset, J, Counters);
+			if (!Counters->Reads && !Counters->Writes && !Counters->Remaps && !Counters->Syncs) continue;
+			json_array_append_new(ColumnsJson, json_pack("{sIsIsIsIsI}",
+				"index", (json_int_t)J,
+				"reads", (json_int_t)Counters->Reads,
+				"writes", (json_int_t)Counters->Writes,
+				"remaps", (json_int_t)Counters->Remaps,
+				"syncs", (json_int_t)Counters->Syncs
+			));
 		}
-		zframe_t *RequestFrame = zmsg_pop(RequestMsg);
-		json_error_t Error;
-		json_t *Request = json_loadb(zframe_data(RequestFrame), zframe_size(RequestFrame), 0, &Error);
-		if (!Request) {
-			fprintf(stderr, "Error: %s:%d: %s\n", Error.source, Error.line, Error.text);
+		json_array_append_new(DatasetsJson, json_pack("{siso}", "index", Index, "columns", ColumnsJson));
+	}
+	pthread_rwlock_unlock(DatasetsLock);
+	pthread_mutex_lock(CacheLock);
+	json_t *CacheJson = json_pack("{sIsIsIsIsIsI}",
+		"hits", (json_int_t)CacheHits,
+		"misses", (json_int_t)CacheMisses,
+		"evictions", (json_int_t)CacheEvictions,
+		"entries", (json_int_t)CacheCount,
+		"size", (json_int_t)CacheSize,
+		"limit", (json_int_t)CacheLimit
+	);
+	pthread_mutex_unlock(CacheLock);
+	return json_pack("{sIsososo}", "uptime", (json_int_t)(zclock_usecs() - StartTime), "methods", MethodsJson, "datasets", DatasetsJson, "cache", CacheJson);
+}
+
+static json_t *method_server_stats(request_t *Request, json_t *Argument) {
+	return stats_collect();
+}
+
+static void *stats_dumper(void *Data) {
+	int Interval = (intptr_t)Data;
+	for (;;) {
+		zclock_sleep(Interval);
+		json_t *Stats = stats_collect();
+		json_dumpf(Stats, stderr, JSON_COMPACT);
+		fputc('\n', stderr);
+		json_decref(Stats);
+	}
+	return NULL;
+}
+
+/*
+a coordinator (-P or -n) serves partitioned datasets from shard servers,
+each an ordinary data-server with its own directory. Dataset I is made of
+dataset I on every shard, its rows being the rows of shard 0 followed by
+those of shard 1 and so on. Creates split the rows evenly and appends always
+go to the last shard, so row numbers never move. Imports take either one
+file, which is split at row boundaries into a file per shard next to it, or
+"files" with one file per shard. A create or import that fails on any shard
+is dropped from the shards where it succeeded so their indices stay in step.
+The coordinator only keeps the length of every part, read methods are fanned
+out to the shards holding the requested rows and their results merged.
+
+-n N starts N local shards under <path>/shards/<i> on the ports after the
+coordinator's own, each bound to its share of the CPUs so that its memory
+stays on the nearest NUMA node. -P lists the addresses of shards started
+separately, which can be on other machines.
+*/
+
+#define SHARD_TIMEOUT 30000
+
+typedef struct shard_range_t {
+	size_t Base, Start, Count;
+	int Used;
+} shard_range_t;
+
+static const char **ShardAddresses = NULL;
+static int NumShards = 0;
+static __thread zsock_t **ShardSockets = NULL;
+// part lengths of each partitioned dataset, only changed by the coordinator
+static size_t **Partitions = NULL;
+static int NumPartitions = 0, MaxPartitions = 0;
+static pthread_rwlock_t PartitionsLock[1] = {PTHREAD_RWLOCK_INITIALIZER};
+// creates and appends must reach every shard in the same order
+static pthread_mutex_t CoordinatorLock[1] = {PTHREAD_MUTEX_INITIALIZER};
+
+static zsock_t *shard_socket(int Index) {
+	// sockets are per thread since zmq sockets cannot be shared
+	if (!ShardSockets) ShardSockets = calloc(NumShards, sizeof(zsock_t *));
+	if (!ShardSockets[Index]) {
+		ShardSockets[Index] = zsock_new_dealer(ShardAddresses[Index]);
+		zsock_set_rcvtimeo(ShardSockets[Index], SHARD_TIMEOUT);
+	}
+	return ShardSockets[Index];
+}
+
+static void shards_call(const char *Method, json_t **Arguments, json_t **Results, zmsg_t **Parts) {
+	// every request is sent before any response is read so the shards work in parallel
+	for (int I = 0; I < NumShards; ++I) {
+		if (!Arguments[I]) continue;
+		json_t *Request = json_pack("[isO]", I, Method, Arguments[I]);
+		char *RequestString = json_dumps(Request, JSON_COMPACT);
+		zstr_send(shard_socket(I), RequestString);
+		free(RequestString);
+		json_decref(Request);
+	}
+	for (int I = 0; I < NumShards; ++I) {
+		Results[I] = NULL;
+		if (Parts) Parts[I] = NULL;
+		if (!Arguments[I]) continue;
+		json_decref(Arguments[I]);
+		zmsg_t *ResponseMsg = zmsg_recv(shard_socket(I));
+		if (!ResponseMsg) {
+			// a fresh socket drops any late response to the lost request
+			zsock_destroy(ShardSockets + I);
+			Results[I] = json_pack("{ss}", "error", "shard unavailable");
 			continue;
 		}
-		int Index;
-		const char *Method;
-		json_t *Argument;
-		if (json_unpack(Request, "[iso]", &Index, &Method, &Argument)) {
-			fprintf(stderr, "Error: invalid request\n");
-			continue;
+		char *ResponseString = zmsg_popstr(ResponseMsg);
+		json_t *Response = ResponseString ? json_loads(ResponseString, 0, NULL) : NULL;
+		free(ResponseString);
+		json_t *Result = json_array_get(Response, 1);
+		Results[I] = Result ? json_incref(Result) : json_pack("{ss}", "error", "invalid shard response");
+		json_decref(Response);
+		if (Parts) {
+			Parts[I] = ResponseMsg;
+		} else {
+			zmsg_destroy(&ResponseMsg);
 		}
-		printf("Method = %s\n", Method);
-		json_t *(*MethodFn)(client_t *, json_t *) = stringmap_search(Methods, Method);
-		if (!MethodFn) {
-			fprintf(stderr, "Error: unknown method %s\n", Method);
-			continue;
+	}
+}
+
+static void shards_free(json_t **Results, zmsg_t **Parts) {
+	for (int I = 0; I < NumShards; ++I) {
+		if (Results[I]) json_decref(Results[I]);
+		if (Parts && Parts[I]) zmsg_destroy(Parts + I);
+	}
+}
+
+static json_t *shards_error(json_t **Results) {
+	for (int I = 0; I < NumShards; ++I) {
+		json_t *Result = Results[I];
+		if (json_is_object(Result) && json_object_get(Result, "error")) return json_deep_copy(Result);
+	}
+	return NULL;
+}
+
+static int partition_lengths(int Index, size_t *Lengths) {
+	int Status = -1;
+	pthread_rwlock_rdlock(PartitionsLock);
+	if (Index >= 0 && Index < NumPartitions && Partitions[Index]) {
+		memcpy(Lengths, Partitions[Index], NumShards * sizeof(size_t));
+		Status = 0;
+	}
+	pthread_rwlock_unlock(PartitionsLock);
+	return Status;
+}
+
+static void partition_store(int Index, const size_t *Lengths) {
+	pthread_rwlock_wrlock(PartitionsLock);
+	if (Index >= MaxPartitions) {
+		int Max = MaxPartitions ? 2 * MaxPartitions : 16;
+		while (Max <= Index) Max *= 2;
+		size_t **New = anew(size_t *, Max);
+		if (NumPartitions) memcpy(New, Partitions, NumPartitions * sizeof(size_t *));
+		Partitions = New;
+		MaxPartitions = Max;
+	}
+	if (!Partitions[Index]) Partitions[Index] = anew(size_t, NumShards);
+	memcpy(Partitions[Index], Lengths, NumShards * sizeof(size_t));
+	if (NumPartitions <= Index) NumPartitions = Index + 1;
+	pthread_rwlock_unlock(PartitionsLock);
+}
+
+static size_t partition_split(const size_t *Lengths, size_t Start, size_t Count, shard_range_t *Ranges) {
+	// returns the total length, an empty range still goes to shard 0 so that its arguments are checked
+	size_t Base = 0, End = Start + Count;
+	for (int I = 0; I < NumShards; ++I) {
+		size_t First = Start > Base ? Start : Base;
+		size_t Last = End < Base + Lengths[I] ? End : Base + Lengths[I];
+		Ranges[I].Base = Base;
+		Ranges[I].Start = First < Last ? First - Base : 0;
+		Ranges[I].Count = First < Last ? Last - First : 0;
+		Ranges[I].Used = First < Last;
+		Base += Lengths[I];
+	}
+	if (!Count) Ranges[0].Used = 1;
+	return Base;
+}
+
+static size_t partition_total(const size_t *Lengths) {
+	size_t Total = 0;
+	for (int I = 0; I < NumShards; ++I) Total += Lengths[I];
+	return Total;
+}
+
+static json_t *partition_info(json_t *Info, const size_t *Lengths) {
+	json_t *Result = json_deep_copy(Info);
+	json_t *LengthsJson = json_array();
+	for (int I = 0; I < NumShards; ++I) json_array_append_new(LengthsJson, json_integer(Lengths[I]));
+	json_object_set_new(Result, "length", json_integer(partition_total(Lengths)));
+	json_object_del(Result, "capacity");
+	json_object_set_new(Result, "shards", LengthsJson);
+	return Result;
+}
+
+static void partitions_load() {
+	json_t *Arguments[NumShards], *Results[NumShards];
+	for (;;) {
+		for (int I = 0; I < NumShards; ++I) Arguments[I] = json_object();
+		shards_call("dataset/list", Arguments, Results, NULL);
+		json_t *Error = shards_error(Results);
+		if (!Error) break;
+		fprintf(stderr, "Error: waiting for shards: %s\n", json_string_value(json_object_get(Error, "error")));
+		json_decref(Error);
+		shards_free(Results, NULL);
+	}
+	size_t Count = json_array_size(Results[0]);
+	for (int I = 1; I < NumShards; ++I) {
+		if (json_array_size(Results[I]) != Count) {
+			fprintf(stderr, "Error: shard %d has %zu datasets instead of %zu\n", I, json_array_size(Results[I]), Count);
+			exit(1);
 		}
-		json_t *Result = MethodFn(Client, Argument);
-		zmsg_t *ResponseMsg = zmsg_new();
-		zmsg_append(ResponseMsg, &ClientFrame);
-		json_t *Response = json_pack("[io]", Index, Result);
-		zmsg_addstr(ResponseMsg, json_dumps(Response, JSON_COMPACT));
-		zmsg_print(ResponseMsg);
-		zmsg_send(&ResponseMsg, Socket);
 	}
+	for (size_t J = 0; J < Count; ++J) {
+		size_t Lengths[NumShards];
+		int Index = json_integer_value(json_object_get(json_array_get(Results[0], J), "index"));
+		for (int I = 0; I < NumShards; ++I) {
+			json_t *Entry = json_array_get(Results[I], J);
+			if (json_integer_value(json_object_get(Entry, "index")) != Index) {
+				fprintf(stderr, "Error: shard %d does not match shard 0\n", I);
+				exit(1);
+			}
+			Lengths[I] = json_integer_value(json_object_get(json_object_get(Entry, "info"), "length"));
+		}
+		partition_store(Index, Lengths);
+	}
+	shards_free(Results, NULL);
+}
+
+static json_t *shards_forward(const char *Method, json_t *Argument) {
+	// methods about names and columns are answered by shard 0 alone
+	json_t *Arguments[NumShards], *Results[NumShards];
+	for (int I = 0; I < NumShards; ++I) Arguments[I] = NULL;
+	Arguments[0] = json_incref(Argument);
+	shards_call(Method, Arguments, Results, NULL);
+	json_t *Result = Results[0];
+	Results[0] = NULL;
+	shards_free(Results, NULL);
+	return Result;
+}
+
+static json_t *shards_broadcast(const char *Method, json_t *Argument) {
+	json_t *Arguments[NumShards], *Results[NumShards];
+	for (int I = 0; I < NumShards; ++I) Arguments[I] = json_incref(Argument);
+	shards_call(Method, Arguments, Results, NULL);
+	json_t *Result = shards_error(Results);
+	if (!Result) {
+		Result = Results[0];
+		Results[0] = NULL;
+	}
+	shards_free(Results, NULL);
+	return Result;
+}
+
+static json_t *coordinator_dataset_find(request_t *Request, json_t *Argument) {
+	return shards_forward("dataset/find", Argument);
+}
+
+static json_t *coordinator_column_find(request_t *Request, json_t *Argument) {
+	return shards_forward("column/find", Argument);
+}
+
+#define COORDINATOR_BROADCAST(NAME, METHOD) \
+static json_t *coordinator_ ## NAME(request_t *Request, json_t *Argument) { \
+	return shards_broadcast(METHOD, Argument); \
+}
+
+COORDINATOR_BROADCAST(dataset_flush, "dataset/flush")
+COORDINATOR_BROADCAST(column_index, "column/index")
+COORDINATOR_BROADCAST(column_compact, "column/compact")
+COORDINATOR_BROADCAST(column_freeze, "column/freeze")
+COORDINATOR_BROADCAST(column_thaw, "column/thaw")
+COORDINATOR_BROADCAST(column_policy, "column/policy")
+
+static json_t *coordinator_unsupported(request_t *Request, json_t *Argument) {
+	return json_pack("{ss}", "error", "not supported on partitioned datasets");
 }
 
-static json_t *method_dataset_list(client_t *Client, json_t *Argument) {
+static json_t *coordinator_dataset_list(request_t *Request, json_t *Argument) {
+	json_t *List = shards_forward("dataset/list", Argument);
+	if (!json_is_array(List)) return List;
 	json_t *Result = json_array();
-	int Index = 0;
-	for (dataset_entry_t *Entry = DatasetEntries; Entry; Entry = Entry->Next) {
-		json_array_append(Result, json_pack("{sisO}", "index", Index, "info", dataset_get_info(Entry->Dataset)));
-		++Index;
+	size_t Lengths[NumShards];
+	for (size_t J = 0; J < json_array_size(List); ++J) {
+		json_t *Entry = json_array_get(List, J);
+		int Index = json_integer_value(json_object_get(Entry, "index"));
+		if (partition_lengths(Index, Lengths)) continue;
+		json_array_append_new(Result, json_pack("{siso}", "index", Index, "info", partition_info(json_object_get(Entry, "info"), Lengths)));
 	}
+	json_decref(List);
 	return Result;
 }
 
-static json_t *method_dataset_create(client_t *Client, json_t *Argument) {
+static void coordinator_rollback(json_t **Results) {
+	// a dataset created on only some shards is dropped again, a shard that timed out may still hold one
+	json_t *Arguments[NumShards], *Drops[NumShards];
+	for (int I = 0; I < NumShards; ++I) {
+		json_t *Index = json_object_get(Results[I], "index");
+		Arguments[I] = json_is_integer(Index) ? json_pack("{sI}", "dataset", json_integer_value(Index)) : NULL;
+	}
+	shards_call("dataset/drop", Arguments, Drops, NULL);
+	for (int I = 0; I < NumShards; ++I) {
+		json_t *Error = json_object_get(Drops[I], "error");
+		if (Error) fprintf(stderr, "Error: dropping dataset on shard %s: %s\n", ShardAddresses[I], json_string_value(Error));
+	}
+	shards_free(Drops, NULL);
+}
+
+static json_t *coordinator_dataset_create(request_t *Request, json_t *Argument) {
 	const char *Name;
 	int Length;
 	if (json_unpack(Argument, "{sssi}", "name", &Name, "length", &Length)) {
 		return json_pack("{ss}", "error", "invalid arguments");
 	}
-	dataset_entry_t **Slot = &DatasetEntries;
-	int Index = 0;
-	while (Slot[0]) {
-		Slot = &Slot[0]->Next;
-		++Index;
+	if (Length < 0) return json_pack("{ss}", "error", "invalid length");
+	json_t *Arguments[NumShards], *Results[NumShards];
+	size_t Lengths[NumShards];
+	for (int I = 0; I < NumShards; ++I) {
+		Lengths[I] = Length / NumShards + (I < Length % NumShards);
+		Arguments[I] = json_pack("{sssi}", "name", Name, "length", (int)Lengths[I]);
 	}
-	char *Path;
-	asprintf(&Path, "%s/%d", DatasetPath, Index);
-	dataset_entry_t *Entry = Slot[0] = new(dataset_entry_t);
-	Entry->Dataset = dataset_create(Path, Name, Length);
-	return json_pack("{sisO}", "index", Index, "info", dataset_get_info(Entry->Dataset));
+	pthread_mutex_lock(CoordinatorLock);
+	shards_call("dataset/create", Arguments, Results, NULL);
+	json_t *Result = shards_error(Results);
+	if (!Result) {
+		int Index = json_integer_value(json_object_get(Results[0], "index"));
+		for (int I = 1; I < NumShards; ++I) {
+			if (json_integer_value(json_object_get(Results[I], "index")) != Index) {
+				Result = json_pack("{ss}", "error", "shards out of step");
+				break;
+			}
+		}
+		if (!Result) {
+			partition_store(Index, Lengths);
+			Result = json_pack("{siso}", "index", Index, "info", partition_info(json_object_get(Results[0], "info"), Lengths));
+		}
+	}
+	if (json_object_get(Result, "error")) coordinator_rollback(Results);
+	pthread_mutex_unlock(CoordinatorLock);
+	shards_free(Results, NULL);
+	return Result;
 }
 
-static stringmap_t Globals[1] = {STRINGMAP_INIT};
+static int coordinator_split(const char *FileName, char **PartNames) {
+	// rows end at newlines outside quotes, an escaped quote inside a field toggles twice
+	int Fd = open(FileName, O_RDONLY);
+	if (Fd < 0) return -1;
+	struct stat Stat[1];
+	if (fstat(Fd, Stat) || !Stat->st_size) {
+		close(Fd);
+		return -1;
+	}
+	size_t Size = Stat->st_size;
+	const char *Start = mmap(NULL, Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+	close(Fd);
+	if (Start == MAP_FAILED) return -1;
+	size_t HeaderEnd = 0, Rows = 0;
+	int Quoted = 0;
+	for (size_t I = 0; I < Size; ++I) {
+		if (Start[I] == '"') {
+			Quoted = !Quoted;
+		} else if (Start[I] == '\n' && !Quoted) {
+			if (HeaderEnd) ++Rows; else HeaderEnd = I + 1;
+		}
+	}
+	if (!HeaderEnd) {
+		munmap((void *)Start, Size);
+		return -1;
+	}
+	if (Start[Size - 1] != '\n' && Size > HeaderEnd) ++Rows;
+	// part I ends after the first Ends[I] rows
+	size_t Ends[NumShards], Bounds[NumShards + 1], Row = 0;
+	for (int I = 0; I < NumShards; ++I) Ends[I] = (I ? Ends[I - 1] : 0) + Rows / NumShards + (I < Rows % NumShards);
+	int Part = 0;
+	Bounds[0] = HeaderEnd;
+	while (Part < NumShards - 1 && !Ends[Part]) Bounds[++Part] = HeaderEnd;
+	Quoted = 0;
+	for (size_t I = HeaderEnd; I < Size && Part < NumShards - 1; ++I) {
+		if (Start[I] == '"') {
+			Quoted = !Quoted;
+		} else if (Start[I] == '\n' && !Quoted) {
+			++Row;
+			while (Part < NumShards - 1 && Row >= Ends[Part]) Bounds[++Part] = I + 1;
+		}
+	}
+	while (Part < NumShards) Bounds[++Part] = Size;
+	int Status = 0;
+	for (int I = 0; I < NumShards && !Status; ++I) {
+		asprintf(&PartNames[I], "%s.%d", FileName, I);
+		FILE *File = fopen(PartNames[I], "w");
+		if (!File) {
+			Status = -1;
+			break;
+		}
+		fwrite(Start, 1, HeaderEnd, File);
+		fwrite(Start + Bounds[I], 1, Bounds[I + 1] - Bounds[I], File);
+		if (ferror(File)) Status = -1;
+		if (fclose(File)) Status = -1;
+	}
+	munmap((void *)Start, Size);
+	return Status;
+}
+
+static void coordinator_split_free(char **PartNames) {
+	for (int I = 0; I < NumShards; ++I) {
+		if (!PartNames[I]) continue;
+		unlink(PartNames[I]);
+		free(PartNames[I]);
+	}
+}
+
+static json_t *coordinator_dataset_import(request_t *Request, json_t *Argument) {
+	// each shard imports its own part of the rows from a separate file
+	const char *Name, *FileName = NULL;
+	json_t *Files = NULL, *TypesJson = NULL;
+	if (json_unpack(Argument, "{sss?ss?os?o}", "name", &Name, "file", &FileName, "files", &Files, "types", &TypesJson) || !FileName == !Files) {
+		return json_pack("{ss}", "error", "invalid arguments, expected a file or one file per shard");
+	}
+	char *PartNames[NumShards];
+	for (int I = 0; I < NumShards; ++I) PartNames[I] = NULL;
+	if (FileName) {
+		if (coordinator_split(FileName, PartNames)) {
+			coordinator_split_free(PartNames);
+			return json_pack("{ss}", "error", "error splitting file");
+		}
+		Files = json_array();
+		for (int I = 0; I < NumShards; ++I) json_array_append_new(Files, json_string(PartNames[I]));
+	} else if (!json_is_array(Files) || json_array_size(Files) != NumShards) {
+		return json_pack("{ss}", "error", "expected one file per shard");
+	}
+	json_t *Arguments[NumShards], *Results[NumShards];
+	for (int I = 0; I < NumShards; ++I) {
+		Arguments[I] = json_pack("{sssO}", "name", Name, "file", json_array_get(Files, I));
+		if (TypesJson) json_object_set(Arguments[I], "types", TypesJson);
+	}
+	pthread_mutex_lock(CoordinatorLock);
+	shards_call("dataset/import", Arguments, Results, NULL);
+	json_t *Result = shards_error(Results);
+	if (!Result) {
+		size_t Lengths[NumShards];
+		int Index = json_integer_value(json_object_get(Results[0], "index"));
+		for (int I = 0; I < NumShards; ++I) {
+			json_t *Info = json_object_get(Results[I], "info");
+			Lengths[I] = json_integer_value(json_object_get(Info, "length"));
+			if (json_integer_value(json_object_get(Results[I], "index")) != Index || !json_equal(json_object_get(Info, "columns"), json_object_get(json_object_get(Results[0], "info"), "columns"))) {
+				Result = json_pack("{ss}", "error", "shards out of step");
+				break;
+			}
+		}
+		if (!Result) {
+			partition_store(Index, Lengths);
+			Result = json_pack("{siso}", "index", Index, "info", partition_info(json_object_get(Results[0], "info"), Lengths));
+		}
+	}
+	if (json_object_get(Result, "error")) coordinator_rollback(Results);
+	pthread_mutex_unlock(CoordinatorLock);
+	shards_free(Results, NULL);
+	if (FileName) {
+		coordinator_split_free(PartNames);
+		json_decref(Files);
+	}
+	return Result;
+}
+
+static json_t *coordinator_dataset_append(request_t *Request, json_t *Argument) {
+	int DatasetIndex;
+	if (json_unpack(Argument, "{si}", "dataset", &DatasetIndex)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	json_t *Arguments[NumShards], *Results[NumShards];
+	size_t Lengths[NumShards];
+	int Last = NumShards - 1;
+	for (int I = 0; I < NumShards; ++I) Arguments[I] = NULL;
+	Arguments[Last] = json_incref(Argument);
+	pthread_mutex_lock(CoordinatorLock);
+	if (partition_lengths(DatasetIndex, Lengths)) {
+		pthread_mutex_unlock(CoordinatorLock);
+		json_decref(Arguments[Last]);
+		return json_pack("{ss}", "error", "invalid dataset");
+	}
+	shards_call("dataset/append", Arguments, Results, NULL);
+	json_t *Result = shards_error(Results);
+	if (!Result) {
+		json_int_t Start = json_integer_value(json_object_get(Results[Last], "start"));
+		json_int_t Count = json_integer_value(json_object_get(Results[Last], "count"));
+		size_t Base = partition_total(Lengths) - Lengths[Last];
+		Lengths[Last] = Start + Count;
+		partition_store(DatasetIndex, Lengths);
+		Result = json_pack("{sIsI}", "start", (json_int_t)(Base + Start), "count", Count);
+	}
+	pthread_mutex_unlock(CoordinatorLock);
+	shards_free(Results, NULL);
+	return Result;
+}
+
+static json_t *coordinator_read_binary(request_t *Request, json_int_t Start, json_t **Results, zmsg_t **Parts) {
+	json_t *First = NULL;
+	size_t Rows = 0;
+	for (int I = 0; I < NumShards; ++I) {
+		if (!Results[I]) continue;
+		if (!First) First = Results[I];
+		Rows += json_integer_value(json_object_get(Results[I], "count"));
+	}
+	int Type = json_integer_value(json_object_get(First, "type"));
+	size_t Width = json_integer_value(json_object_get(First, "width"));
+	if (Width) {
+		char *Values = malloc(Rows * Width + 1);
+		size_t Size = 0;
+		for (int I = 0; I < NumShards; ++I) {
+			zframe_t *Frame = Parts[I] ? zmsg_first(Parts[I]) : NULL;
+			if (!Frame) continue;
+			memcpy(Values + Size, zframe_data(Frame), zframe_size(Frame));
+			Size += zframe_size(Frame);
+		}
+		request_attach(Request, Values, Size, request_free, NULL);
+	} else {
+		// string offsets are rebased onto the merged bytes
+		uint64_t *Offsets = malloc((Rows + 1) * sizeof(uint64_t));
+		size_t Total = 0;
+		for (int I = 0; I < NumShards; ++I) {
+			if (!Parts[I] || !zmsg_first(Parts[I])) continue;
+			zframe_t *Frame = zmsg_next(Parts[I]);
+			if (Frame) Total += zframe_size(Frame);
+		}
+		char *Bytes = malloc(Total + 1);
+		size_t Row = 0, Base = 0;
+		for (int I = 0; I < NumShards; ++I) {
+			zframe_t *OffsetsFrame = Parts[I] ? zmsg_first(Parts[I]) : NULL;
+			zframe_t *BytesFrame = OffsetsFrame ? zmsg_next(Parts[I]) : NULL;
+			if (!BytesFrame) continue;
+			const uint64_t *ShardOffsets = (const uint64_t *)zframe_data(OffsetsFrame);
+			size_t Count = zframe_size(OffsetsFrame) / sizeof(uint64_t) - 1;
+			for (size_t J = 0; J < Count; ++J) Offsets[Row + J] = Base + ShardOffsets[J];
+			memcpy(Bytes + Base, zframe_data(BytesFrame), zframe_size(BytesFrame));
+			Base += zframe_size(BytesFrame);
+			Row += Count;
+		}
+		Offsets[Row] = Base;
+		request_attach(Request, Offsets, (Rows + 1) * sizeof(uint64_t), request_free, NULL);
+		request_attach(Request, Bytes, Base, request_free, NULL);
+	}
+	return json_pack("{sIsIsisisi}", "start", Start, "count", (json_int_t)Rows, "type", Type, "width", (int)Width, "frames", Request->NumParts);
+}
+
+static json_t *coordinator_column_read(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex, Binary = 0;
+	json_int_t Start = 0, Count = -1;
+	if (json_unpack(Argument, "{sisis?Is?Is?b}", "dataset", &DatasetIndex, "column", &ColumnIndex, "start", &Start, "count", &Count, "binary", &Binary)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	size_t Lengths[NumShards];
+	if (partition_lengths(DatasetIndex, Lengths)) return json_pack("{ss}", "error", "invalid dataset");
+	size_t Length = partition_total(Lengths);
+	if (Start < 0 || Start > Length) return json_pack("{ss}", "error", "invalid range");
+	if (Count < 0 || Count > Length - Start) Count = Length - Start;
+	shard_range_t Ranges[NumShards];
+	partition_split(Lengths, Start, Count, Ranges);
+	json_t *Arguments[NumShards], *Results[NumShards];
+	zmsg_t *Parts[NumShards];
+	for (int I = 0; I < NumShards; ++I) {
+		Arguments[I] = Ranges[I].Used ? json_pack("{sisisIsIsb}",
+			"dataset", DatasetIndex, "column", ColumnIndex,
+			"start", (json_int_t)Ranges[I].Start, "count", (json_int_t)Ranges[I].Count, "binary", Binary
+		) : NULL;
+	}
+	shards_call("column/read", Arguments, Results, Parts);
+	json_t *Result = shards_error(Results);
+	if (!Result) {
+		if (Binary) {
+			Result = coordinator_read_binary(Request, Start, Results, Parts);
+		} else {
+			json_t *Values = json_array();
+			for (int I = 0; I < NumShards; ++I) {
+				if (Results[I]) json_array_extend(Values, json_object_get(Results[I], "values"));
+			}
+			Result = json_pack("{sIso}", "start", Start, "values", Values);
+		}
+	}
+	shards_free(Results, Parts);
+	return Result;
+}
+
+static json_t *coordinator_column_write(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex;
+	json_int_t Start = 0;
+	json_t *Values;
+	if (json_unpack(Argument, "{sisis?Iso}", "dataset", &DatasetIndex, "column", &ColumnIndex, "start", &Start, "values", &Values)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	if (!json_is_array(Values)) return json_pack("{ss}", "error", "invalid arguments");
+	size_t Lengths[NumShards];
+	if (partition_lengths(DatasetIndex, Lengths)) return json_pack("{ss}", "error", "invalid dataset");
+	size_t Length = partition_total(Lengths);
+	size_t Count = json_array_size(Values);
+	if (Start < 0 || Start > Length || Count > Length - Start) return json_pack("{ss}", "error", "invalid range");
+	shard_range_t Ranges[NumShards];
+	partition_split(Lengths, Start, Count, Ranges);
+	json_t *Arguments[NumShards], *Results[NumShards];
+	for (int I = 0; I < NumShards; ++I) {
+		Arguments[I] = NULL;
+		if (!Ranges[I].Used) continue;
+		json_t *Slice = json_array();
+		size_t Offset = Ranges[I].Base + Ranges[I].Start - Start;
+		for (size_t J = 0; J < Ranges[I].Count; ++J) json_array_append(Slice, json_array_get(Values, Offset + J));
+		Arguments[I] = json_pack("{sisisIso}", "dataset", DatasetIndex, "column", ColumnIndex, "start", (json_int_t)Ranges[I].Start, "values", Slice);
+	}
+	shards_call("column/write", Arguments, Results, NULL);
+	json_t *Result = shards_error(Results);
+	if (!Result) Result = json_pack("{sIsI}", "start", Start, "count", (json_int_t)Count);
+	shards_free(Results, NULL);
+	return Result;
+}
+
+static json_t *coordinator_histogram(int DatasetIndex, int ColumnIndex, shard_range_t *Ranges, int NumBuckets, double Min, double Max) {
+	json_t *Arguments[NumShards], *Results[NumShards];
+	for (int I = 0; I < NumShards; ++I) {
+		Arguments[I] = Ranges[I].Used ? json_pack("{sisisIsIsisfsf}",
+			"dataset", DatasetIndex, "column", ColumnIndex,
+			"start", (json_int_t)Ranges[I].Start, "count", (json_int_t)Ranges[I].Count,
+			"buckets", NumBuckets, "min", Min, "max", Max
+		) : NULL;
+	}
+	shards_call("column/aggregate", Arguments, Results, NULL);
+	uint64_t *Buckets = calloc(NumBuckets, sizeof(uint64_t));
+	json_t *Result = NULL;
+	for (int I = 0; I < NumShards; ++I) {
+		if (!Results[I]) continue;
+		json_t *Counts = json_object_get(json_object_get(Results[I], "histogram"), "counts");
+		if (json_array_size(Counts) != NumBuckets) goto done;
+		for (int J = 0; J < NumBuckets; ++J) Buckets[J] += json_integer_value(json_array_get(Counts, J));
+	}
+	json_t *BucketsJson = json_array();
+	for (int J = 0; J < NumBuckets; ++J) json_array_append_new(BucketsJson, json_integer(Buckets[J]));
+	Result = json_pack("{sfsfso}", "min", Min, "max", Max, "counts", BucketsJson);
+done:
+	free(Buckets);
+	shards_free(Results, NULL);
+	return Result;
+}
+
+static json_t *coordinator_column_aggregate(request_t *Request, json_t *Argument) {
+	int DatasetIndex, ColumnIndex, NumBuckets = 0;
+	json_int_t Start = 0, Count = -1;
+	json_t *MinJson = NULL, *MaxJson = NULL;
+	if (json_unpack(Argument, "{sisis?Is?Is?is?os?o}", "dataset", &DatasetIndex, "column", &ColumnIndex, "start", &Start, "count", &Count, "buckets", &NumBuckets, "min", &MinJson, "max", &MaxJson)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	size_t Lengths[NumShards];
+	if (partition_lengths(DatasetIndex, Lengths)) return json_pack("{ss}", "error", "invalid dataset");
+	size_t Length = partition_total(Lengths);
+	if (Start < 0 || Start > Length) return json_pack("{ss}", "error", "invalid range");
+	if (Count < 0 || Count > Length - Start) Count = Length - Start;
+	if (NumBuckets < 0) return json_pack("{ss}", "error", "invalid bucket count");
+	shard_range_t Ranges[NumShards];
+	partition_split(Lengths, Start, Count, Ranges);
+	json_t *Arguments[NumShards], *Results[NumShards];
+	for (int I = 0; I < NumShards; ++I) {
+		Arguments[I] = Ranges[I].Used ? json_pack("{sisisIsI}",
+			"dataset", DatasetIndex, "column", ColumnIndex,
+			"start", (json_int_t)Ranges[I].Start, "count", (json_int_t)Ranges[I].Count
+		) : NULL;
+	}
+	shards_call("column/aggregate", Arguments, Results, NULL);
+	json_t *Result = shards_error(Results);
+	if (Result) {
+		shards_free(Results, NULL);
+		return Result;
+	}
+	// the parts are combined with the same pairwise variance update as blocks within a shard
+	size_t Total = 0;
+	double Sum = 0, Min = INFINITY, Max = -INFINITY, Mean = 0, M2 = 0;
+	for (int I = 0; I < NumShards; ++I) {
+		if (!Results[I]) continue;
+		size_t ShardTotal = json_integer_value(json_object_get(Results[I], "count"));
+		if (!ShardTotal) continue;
+		double ShardMean = json_number_or_nan(json_object_get(Results[I], "mean"));
+		double ShardM2 = json_number_or_nan(json_object_get(Results[I], "variance")) * ShardTotal;
+		double Delta = ShardMean - Mean;
+		size_t Combined = Total + ShardTotal;
+		M2 += ShardM2 + Delta * Delta * ((double)Total * ShardTotal / Combined);
+		Mean += Delta * ShardTotal / Combined;
+		Total = Combined;
+		Sum += json_number_or_nan(json_object_get(Results[I], "sum"));
+		double ShardMin = json_number_or_nan(json_object_get(Results[I], "min"));
+		double ShardMax = json_number_or_nan(json_object_get(Results[I], "max"));
+		if (Min > ShardMin) Min = ShardMin;
+		if (Max < ShardMax) Max = ShardMax;
+	}
+	shards_free(Results, NULL);
+	Result = json_pack("{sIsososososo}",
+		"count", (json_int_t)Total,
+		"sum", json_number_or_null(Sum),
+		"min", json_number_or_null(Total ? Min : NAN),
+		"max", json_number_or_null(Total ? Max : NAN),
+		"mean", json_number_or_null(Total ? Mean : NAN),
+		"variance", json_number_or_null(Total ? M2 / Total : NAN)
+	);
+	if (NumBuckets > 0) {
+		// every shard must bucket over the same range, so it is fixed from the merged stats first
+		double HistogramMin = json_is_number(MinJson) ? json_number_value(MinJson) : Total ? Min : NAN;
+		double HistogramMax = json_is_number(MaxJson) ? json_number_value(MaxJson) : Total ? Max : NAN;
+		if (isfinite(HistogramMin) && isfinite(HistogramMax) && HistogramMax > HistogramMin) {
+			json_t *Histogram = coordinator_histogram(DatasetIndex, ColumnIndex, Ranges, NumBuckets, HistogramMin, HistogramMax);
+			if (Histogram) json_object_set_new(Result, "histogram", Histogram);
+		}
+	}
+	return Result;
+}
+
+static json_t *coordinator_rows(const char *Method, json_t *Argument, json_int_t Limit) {
+	// row numbers from each shard are offset by the rows of the shards before it
+	int DatasetIndex;
+	if (json_unpack(Argument, "{si}", "dataset", &DatasetIndex)) {
+		return json_pack("{ss}", "error", "invalid arguments");
+	}
+	size_t Lengths[NumShards];
+	if (partition_lengths(DatasetIndex, Lengths)) return json_pack("{ss}", "error", "invalid dataset");
+	json_t *Arguments[NumShards], *Results[NumShards];
+	for (int I = 0; I < NumShards; ++I) Arguments[I] = json_incref(Argument);
+	shards_call(Method, Arguments, Results, NULL);
+	json_t *Result = shards_error(Results);
+	if (!Result) {
+		json_int_t Count = 0;
+		size_t Base = 0;
+		json_t *Rows = json_array();
+		for (int I = 0; I < NumShards; ++I) {
+			Count += json_integer_value(json_object_get(Results[I], "count"));
+			json_t *ShardRows = json_object_get(Results[I], "rows");
+			for (size_t J = 0; J < json_array_size(ShardRows); ++J) {
+				if (Limit >= 0 && json_array_size(Rows) >= Limit) break;
+				json_array_append_new(Rows, json_integer(Base + json_integer_value(json_array_get(ShardRows, J))));
+			}
+			Base += Lengths[I];
+		}
+		Result = json_pack("{sIso}", "count", Count, "rows", Rows);
+	}
+	shards_free(Results, NULL);
+	return Result;
+}
+
+static json_t *coordinator_dataset_query(request_t *Request, json_t *Argument) {
+	json_int_t Limit = -1;
+	if (json_unpack(Argument, "{s?I}", "limit", &Limit)) return json_pack("{ss}", "error", "invalid arguments");
+	return coordinator_rows("dataset/query", Argument, Limit);
+}
+
+static json_t *coordinator_column_lookup(request_t *Request, json_t *Argument) {
+	json_int_t Limit = 1000;
+	if (json_unpack(Argument, "{s?I}", "limit", &Limit)) return json_pack("{ss}", "error", "invalid arguments");
+	return coordinator_rows("column/lookup", Argument, Limit);
+}
+
+static json_t *coordinator_column_groups(request_t *Request, json_t *Argument) {
+	json_t *Arguments[NumShards], *Results[NumShards];
+	for (int I = 0; I < NumShards; ++I) Arguments[I] = json_incref(Argument);
+	shards_call("column/groups", Arguments, Results, NULL);
+	json_t *Result = shards_error(Results);
+	if (!Result) {
+		// groups keep the order in which they are first seen
+		json_t *Positions = json_object(), *Values = json_array(), *Counts = json_array();
+		for (int I = 0; I < NumShards; ++I) {
+			json_t *ShardValues = json_object_get(Results[I], "values");
+			json_t *ShardCounts = json_object_get(Results[I], "counts");
+			for (size_t J = 0; J < json_array_size(ShardValues); ++J) {
+				json_t *Value = json_array_get(ShardValues, J);
+				json_int_t Count = json_integer_value(json_array_get(ShardCounts, J));
+				json_t *Position = json_is_string(Value) ? json_object_get(Positions, json_string_value(Value)) : NULL;
+				if (Position) {
+					size_t K = json_integer_value(Position);
+					json_array_set_new(Counts, K, json_integer(json_integer_value(json_array_get(Counts, K)) + Count));
+				} else {
+					if (json_is_string(Value)) json_object_set_new(Positions, json_string_value(Value), json_integer(json_array_size(Values)));
+					json_array_append(Values, Value);
+					json_array_append_new(Counts, json_integer(Count));
+				}
+			}
+		}
+		json_decref(Positions);
+		Result = json_pack("{soso}", "values", Values, "counts", Counts);
+	}
+	shards_free(Results, NULL);
+	return Result;
+}
+
+static json_t *coordinator_server_stats(request_t *Request, json_t *Argument) {
+	json_t *Arguments[NumShards], *Results[NumShards];
+	for (int I = 0; I < NumShards; ++I) Arguments[I] = json_incref(Argument);
+	shards_call("server/stats", Arguments, Results, NULL);
+	json_t *Result = stats_collect();
+	json_t *ShardsJson = json_array();
+	for (int I = 0; I < NumShards; ++I) {
+		json_array_append_new(ShardsJson, json_pack("{ssso}", "address", ShardAddresses[I], "stats", Results[I]));
+		Results[I] = NULL;
+	}
+	json_object_set_new(Result, "shards", ShardsJson);
+	return Result;
+}
+
+static void shards_parse(const char *List) {
+	// a comma separated list of shard addresses
+	int Count = 1;
+	for (const char *P = List; *P; ++P) if (*P == ',') ++Count;
+	ShardAddresses = anew(const char *, Count);
+	char *Copy = GC_strdup(List), *Next;
+	for (char *Address = strtok_r(Copy, ",", &Next); Address; Address = strtok_r(NULL, ",", &Next)) {
+		ShardAddresses[NumShards++] = Address;
+	}
+}
+
+static void shards_spawn(int Count, int Port, int Threads, const char *SyncOption) {
+	char *ShardsPath;
+	asprintf(&ShardsPath, "%s/shards", DatasetPath);
+	mkdir(ShardsPath, 0777);
+	long NumCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+	ShardAddresses = anew(const char *, Count);
+	for (int I = 0; I < Count; ++I) {
+		// arguments are prepared before forking, the child only execs
+		char *Path, *PortString, *ThreadsString;
+		asprintf(&Path, "%s/%d", ShardsPath, I);
+		asprintf(&PortString, "%d", Port + 1 + I);
+		asprintf(&ThreadsString, "%d", Threads);
+		mkdir(Path, 0777);
+		char *Args[] = {"data-server", "-p", PortString, "-t", ThreadsString, "-s", (char *)SyncOption, Path, NULL};
+		cpu_set_t CPUs[1];
+		CPU_ZERO(CPUs);
+		for (long J = I * NumCPUs / Count; J < (I + 1) * NumCPUs / Count; ++J) CPU_SET(J, CPUs);
+		if (NumCPUs < Count) CPU_SET(I % NumCPUs, CPUs);
+		pid_t Pid = fork();
+		if (Pid < 0) {
+			fprintf(stderr, "Error: error starting shard %d\n", I);
+			exit(1);
+		}
+		if (!Pid) {
+			// shards exit with the coordinator
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			sched_setaffinity(0, sizeof(cpu_set_t), CPUs);
+			execv("/proc/self/exe", Args);
+			_exit(1);
+		}
+		asprintf((char **)(ShardAddresses + I), "tcp://127.0.0.1:%d", Port + 1 + I);
+		free(Path);
+		free(PortString);
+		free(ThreadsString);
+	}
+	NumShards = Count;
+	free(ShardsPath);
+}
+
+static void coordinator_serve(int Port, int Threads) {
+	method_register("dataset/list", coordinator_dataset_list, 0);
+	method_register("dataset/find", coordinator_dataset_find, 0);
+	method_register("dataset/create", coordinator_dataset_create, 0);
+	method_register("dataset/import", coordinator_dataset_import, 0);
+	method_register("dataset/flush", coordinator_dataset_flush, 0);
+	method_register("dataset/append", coordinator_dataset_append, 0);
+	method_register("dataset/query", coordinator_dataset_query, 0);
+	method_register("column/find", coordinator_column_find, 0);
+	method_register("column/read", coordinator_column_read, 0);
+	method_register("column/write", coordinator_column_write, 0);
+	method_register("column/compact", coordinator_column_compact, 0);
+	method_register("column/freeze", coordinator_column_freeze, 0);
+	method_register("column/thaw", coordinator_column_thaw, 0);
+	method_register("column/policy", coordinator_column_policy, 0);
+	method_register("column/groups", coordinator_column_groups, 0);
+	method_register("column/aggregate", coordinator_column_aggregate, 0);
+	method_register("column/index", coordinator_column_index, 0);
+	method_register("column/sorted", coordinator_unsupported, 0);
+	method_register("column/lookup", coordinator_column_lookup, 0);
+	method_register("dataset/snapshot", coordinator_unsupported, 0);
+	method_register("dataset/release", coordinator_unsupported, 0);
+	method_register("server/stats", coordinator_server_stats, 0);
+	partitions_load();
+	datasets_serve(Port, Threads);
+}
 
 static ml_value_t *global_get(void *Data, const char *Name) {
 	return stringmap_search(Globals, Name) ?: MLNil;
@@ -164,7 +2895,14 @@ int main(int Argc, char **Argv) {
 	stringmap_insert(Globals, "error", ml_function(0, error));
 	dataset_init(Globals);
 
-	int Port = 9001;
+	int Port = 9001, Threads = 1;
+	sync_mode_t SyncMode = SYNC_WRITE;
+	int SyncInterval = 1000, SyncWrites = 0;
+	feed_config_t FeedConfig[1] = {{0, 100}};
+	int StatsInterval = 0;
+	int WalEnabled = 0, WalCheckpointInterval = 60000;
+	int SpawnShards = 0;
+	const char *SyncOption = "write";
 	for (int I = 1; I < Argc; ++I) {
 		if (Argv[I][0] == '-') {
 			if (Argv[I][1] == 'p') {
@@ -173,16 +2911,135 @@ int main(int Argc, char **Argv) {
 				} else {
 					Port = atoi(Argv[++I]);
 				}
+			} else if (Argv[I][1] == 't') {
+				if (Argv[I][2]) {
+					Threads = atoi(Argv[I] + 2);
+				} else {
+					Threads = atoi(Argv[++I]);
+				}
+			} else if (Argv[I][1] == 'v') {
+				Verbose = 1;
+			} else if (Argv[I][1] == 'd') {
+				if (Argv[I][2]) {
+					StatsInterval = atoi(Argv[I] + 2);
+				} else {
+					StatsInterval = atoi(Argv[++I]);
+				}
+			} else if (Argv[I][1] == 'f') {
+				const char *Feed = Argv[I][2] ? Argv[I] + 2 : Argv[++I];
+				sscanf(Feed, "%d:%d", &FeedConfig->Port, &FeedConfig->Interval);
+			} else if (Argv[I][1] == 'w') {
+				const char *Wal = Argv[I][2] ? Argv[I] + 2 : Argv[++I];
+				WalEnabled = 1;
+				sscanf(Wal, "%d:%d", &WalSyncInterval, &WalCheckpointInterval);
+			} else if (Argv[I][1] == 'c') {
+				// result cache size in megabytes
+				CacheLimit = (size_t)atoi(Argv[I][2] ? Argv[I] + 2 : Argv[++I]) << 20;
+			} else if (Argv[I][1] == 'r') {
+				Leader = Argv[I][2] ? Argv[I] + 2 : Argv[++I];
+			} else if (Argv[I][1] == 'P') {
+				shards_parse(Argv[I][2] ? Argv[I] + 2 : Argv[++I]);
+			} else if (Argv[I][1] == 'n') {
+				SpawnShards = atoi(Argv[I][2] ? Argv[I] + 2 : Argv[++I]);
+			} else if (Argv[I][1] == 's') {
+				const char *Mode = SyncOption = Argv[I][2] ? Argv[I] + 2 : Argv[++I];
+				if (!strcmp(Mode, "write")) {
+					SyncMode = SYNC_WRITE;
+				} else if (!strncmp(Mode, "periodic", 8)) {
+					SyncMode = SYNC_PERIODIC;
+					sscanf(Mode + 8, ":%d:%d", &SyncInterval, &SyncWrites);
+				} else if (!strcmp(Mode, "manual")) {
+					SyncMode = SYNC_MANUAL;
+				} else {
+					fprintf(stderr, "Error: unknown sync mode %s\n", Mode);
+					exit(1);
+				}
 			}
 		} else {
 			DatasetPath = Argv[I];
 		}
 	}
-	if (DatasetPath) {
-		stringmap_insert(Methods, "dataset/list", method_dataset_list);
-		stringmap_insert(Methods, "dataset/create", method_dataset_create);
+	dataset_set_sync_mode(SyncMode, SyncInterval, SyncWrites);
+	StartTime = zclock_usecs();
+	if (SpawnShards > 0) {
+		if (!DatasetPath) {
+			fprintf(stderr, "Error: local shards need a dataset path\n");
+			exit(1);
+		}
+		shards_spawn(SpawnShards, Port, Threads, SyncOption);
+	}
+	if (NumShards) {
+		coordinator_serve(Port, Threads);
+	} else if (DatasetPath) {
+		method_register("dataset/list", method_dataset_list, 0);
+		method_register("dataset/find", method_dataset_find, 0);
+		method_register("dataset/create", method_dataset_create, 1);
+		method_register("dataset/import", method_dataset_import, 1);
+		method_register("dataset/drop", method_dataset_drop, 1);
+		method_register("dataset/flush", method_dataset_flush, 0);
+		method_register("dataset/append", method_dataset_append, 1);
+		method_register("dataset/query", method_dataset_query, 0);
+		method_register("column/find", method_column_find, 0);
+		method_register("column/read", method_column_read, 0);
+		method_register("column/write", method_column_write, 1);
+		method_register("column/compact", method_column_compact, 1);
+		method_register("column/freeze", method_column_freeze, 1);
+		method_register("column/thaw", method_column_thaw, 1);
+		method_register("column/policy", method_column_policy, 1);
+		method_register("column/groups", method_column_groups, 0);
+		method_register("column/aggregate", method_column_aggregate, 0);
+		method_register("column/index", method_column_index, 1);
+		method_register("column/sorted", method_column_sorted, 0);
+		method_register("column/lookup", method_column_lookup, 0);
+		method_register("dataset/snapshot", method_dataset_snapshot, 0);
+		method_register("dataset/release", method_dataset_release, 0);
+		method_register("server/stats", method_server_stats, 0);
+		method_register("wal/read", method_wal_read, 0);
+		// blocked before any thread starts, so only the closer receives them
+		static sigset_t Signals[1];
+		sigemptyset(Signals);
+		sigaddset(Signals, SIGINT);
+		sigaddset(Signals, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, Signals, NULL);
+		pthread_t Closer;
+		pthread_create(&Closer, NULL, datasets_closer, Signals);
+		pthread_detach(Closer);
 		datasets_load();
-		datasets_serve(Port);
+		snapshots_clear();
+		if (WalEnabled || Leader) {
+			wal_recover();
+			if (WalSyncInterval) {
+				pthread_t Thread;
+				pthread_create(&Thread, NULL, wal_syncer, NULL);
+				pthread_detach(Thread);
+			}
+			pthread_t Thread;
+			pthread_create(&Thread, NULL, wal_checkpointer, (void *)(intptr_t)WalCheckpointInterval);
+			pthread_detach(Thread);
+		}
+		if (Leader) {
+			pthread_t Thread;
+			pthread_create(&Thread, NULL, wal_follow, NULL);
+			pthread_detach(Thread);
+		}
+		if (SyncMode != SYNC_MANUAL) {
+			// in write mode values are only scheduled for writing, syncing them here lets zone maps be marked clean
+			pthread_t Thread;
+			pthread_create(&Thread, NULL, datasets_flusher, (void *)(intptr_t)SyncInterval);
+			pthread_detach(Thread);
+		}
+		if (StatsInterval) {
+			pthread_t Thread;
+			pthread_create(&Thread, NULL, stats_dumper, (void *)(intptr_t)StatsInterval);
+			pthread_detach(Thread);
+		}
+		if (FeedConfig->Port) {
+			dataset_set_change_feed(1);
+			pthread_t Thread;
+			pthread_create(&Thread, NULL, datasets_feed, FeedConfig);
+			pthread_detach(Thread);
+		}
+		datasets_serve(Port, Threads);
 	}
 
 	ml_console(global_get, Globals);
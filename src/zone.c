@@ -0,0 +1,222 @@
+#include "dataset.h"
+#include "dataset_private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+zone maps are kept exact for NaN (empty string) counts and conservative for
+bounds. Writes widen the bounds of their zone with the new value, and count
+the zone as loose when the value they replace may have been a bound. Loose
+zones are rescanned at the start of their next write, before any old value
+is read or replaced, so the scan always sees the values the bounds describe.
+*/
+
+static inline size_t zone_count(size_t Length) {
+	return (Length + ZONE_SIZE - 1) / ZONE_SIZE;
+}
+
+static void zone_clear(zone_t *Zone, column_type_t Type) {
+	if (Type == COLUMN_REAL) {
+		Zone->Min = INFINITY;
+		Zone->Max = -INFINITY;
+	} else {
+		Zone->MinPrefix = UINT64_MAX;
+		Zone->MaxPrefix = 0;
+	}
+	Zone->Nulls = 0;
+	Zone->MinLength = UINT32_MAX;
+	Zone->MaxLength = 0;
+	Zone->Loose = 0;
+}
+
+static inline void zone_add_real(zone_t *Zone, double Value) {
+	if (Value != Value) {
+		++Zone->Nulls;
+		return;
+	}
+	if (Zone->Min > Value) Zone->Min = Value;
+	if (Zone->Max < Value) Zone->Max = Value;
+}
+
+static inline void zone_add_string(zone_t *Zone, size_t Length, uint64_t Prefix) {
+	if (!Length) ++Zone->Nulls;
+	if (Zone->MinLength > Length) Zone->MinLength = Length;
+	if (Zone->MaxLength < Length) Zone->MaxLength = Length;
+	if (Zone->MinPrefix > Prefix) Zone->MinPrefix = Prefix;
+	if (Zone->MaxPrefix < Prefix) Zone->MaxPrefix = Prefix;
+}
+
+static uint64_t zone_row_prefix(column_t *Column, size_t Row, size_t *Length) {
+	if (Column->Format == STRING_PACKED) {
+		packed_entry_t *Entry = Column->Packed->Entries + Row;
+		*Length = Entry->Length;
+		return Entry->Length ? zone_prefix(Column->Heap + Entry->Offset, Entry->Length) : 0;
+	}
+	string_entry_t *Entry = Column->Strings->Entries + Row;
+	*Length = Entry->Length;
+	if (!Entry->Length) return 0;
+	// the first 8 bytes always live in the first node
+	string_node_t *Node = (string_node_t *)(Column->Strings->Entries + Column->Dataset->Length) + Entry->Link;
+	return zone_prefix(Entry->Length > 16 ? Node->Small : Node->Large, Entry->Length);
+}
+
+static void zone_rebuild(column_t *Column, size_t Index) {
+	zone_t *Zone = Column->Zones->Entries + Index;
+	size_t Start = Index * ZONE_SIZE, End = Start + ZONE_SIZE;
+	if (End > Column->Dataset->Length) End = Column->Dataset->Length;
+	zone_clear(Zone, Column->DataType);
+	if (Column->DataType == COLUMN_REAL) {
+		for (size_t I = Start; I < End; ++I) zone_add_real(Zone, Column->Reals[I]);
+	} else {
+		for (size_t I = Start; I < End; ++I) {
+			size_t Length;
+			uint64_t Prefix = zone_row_prefix(Column, I, &Length);
+			zone_add_string(Zone, Length, Prefix);
+		}
+	}
+}
+
+static void column_zones_file(column_t *Column, char *FileName) {
+	sprintf(FileName, "%s/%d.zones", Column->Dataset->Path, (int)Column->Index);
+}
+
+int column_zones_open(column_t *Column) {
+	if (Column->Zones || Column->Frozen) return 0;
+	if (Column->DataType != COLUMN_REAL && Column->DataType != COLUMN_STRING) return 0;
+	char FileName[strlen(Column->Dataset->Path) + 32];
+	column_zones_file(Column, FileName);
+	size_t NumZones = zone_count(Column->Dataset->Length);
+	size_t ZonesSize = sizeof(zone_header_t) + NumZones * sizeof(zone_t);
+	int Fd = open(FileName, O_RDWR | O_CREAT, 0777);
+	if (Fd < 0) return -1;
+	struct stat Stat[1];
+	int Stale = fstat(Fd, Stat) || Stat->st_size != ZonesSize;
+	if (Stale && ftruncate(Fd, ZonesSize)) {
+		close(Fd);
+		return -1;
+	}
+	void *Map = mmap(NULL, ZonesSize, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+	if (Map == MAP_FAILED) {
+		close(Fd);
+		return -1;
+	}
+	Column->Zones = Map;
+	Column->ZonesSize = ZonesSize;
+	Column->ZonesFd = Fd;
+	zone_header_t *Header = &Column->Zones->Header;
+	if (Stale || !Header->Clean || Header->ZoneSize != ZONE_SIZE || Header->NumZones != NumZones) {
+		Header->Clean = 0;
+		Header->NumZones = NumZones;
+		Header->ZoneSize = ZONE_SIZE;
+		for (size_t I = 0; I < NumZones; ++I) zone_rebuild(Column, I);
+		column_zones_sync(Column);
+	}
+	return 0;
+}
+
+static void zone_unclean(column_t *Column) {
+	// the first write after a sync invalidates the file before anything changes
+	zone_header_t *Header = &Column->Zones->Header;
+	if (!Header->Clean) return;
+	Header->Clean = 0;
+	msync(Column->Zones, sizeof(zone_header_t), MS_SYNC);
+}
+
+void column_zones_sync(column_t *Column) {
+	// called with writes excluded, the map describes the values as mapped which may not be written out yet
+	if (!Column->Zones || Column->Zones->Header.Clean) return;
+	fdatasync(Column->Fd);
+	if (Column->Heap) fdatasync(Column->HeapFd);
+	msync(Column->Zones, Column->ZonesSize, MS_SYNC);
+	Column->Zones->Header.Clean = 1;
+	msync(Column->Zones, sizeof(zone_header_t), MS_SYNC);
+}
+
+void column_zones_close(column_t *Column) {
+	if (!Column->Zones) return;
+	column_zones_sync(Column);
+	munmap(Column->Zones, Column->ZonesSize);
+	close(Column->ZonesFd);
+	Column->Zones = NULL;
+	Column->ZonesSize = 0;
+}
+
+int column_zones_append(column_t *Column, size_t Start, size_t Count) {
+	if (!Column->Zones) return 0;
+	zone_unclean(Column);
+	size_t OldZones = Column->Zones->Header.NumZones;
+	size_t NumZones = zone_count(Start + Count);
+	if (NumZones > OldZones) {
+		size_t ZonesSize = sizeof(zone_header_t) + NumZones * sizeof(zone_t);
+		void *Map = MAP_FAILED;
+		if (!ftruncate(Column->ZonesFd, ZonesSize)) {
+			Map = mremap(Column->Zones, Column->ZonesSize, ZonesSize, MREMAP_MAYMOVE);
+		}
+		if (Map == MAP_FAILED) {
+			// without a zone for every row the map cannot be used at all
+			munmap(Column->Zones, Column->ZonesSize);
+			close(Column->ZonesFd);
+			Column->Zones = NULL;
+			Column->ZonesSize = 0;
+			return -1;
+		}
+		Column->Zones = Map;
+		Column->ZonesSize = ZonesSize;
+		for (size_t I = OldZones; I < NumZones; ++I) zone_clear(Column->Zones->Entries + I, Column->DataType);
+		Column->Zones->Header.NumZones = NumZones;
+	}
+	zone_t *Zones = Column->Zones->Entries;
+	if (Column->DataType == COLUMN_REAL) {
+		for (size_t I = Start; I < Start + Count; ++I) zone_add_real(Zones + I / ZONE_SIZE, Column->Reals[I]);
+	} else {
+		for (size_t I = Start; I < Start + Count; ++I) {
+			size_t Length;
+			uint64_t Prefix = zone_row_prefix(Column, I, &Length);
+			zone_add_string(Zones + I / ZONE_SIZE, Length, Prefix);
+		}
+	}
+	return 0;
+}
+
+void zones_real_update(column_t *Column, size_t Start, size_t Count, const double *Values) {
+	// called with the old values still in place
+	if (!Column->Zones || !Count) return;
+	zone_unclean(Column);
+	zone_t *Zones = Column->Zones->Entries;
+	// rescan loose zones before any bound changes, a rescan part way through would see a mix of old and new values
+	for (size_t Index = Start / ZONE_SIZE; Index <= (Start + Count - 1) / ZONE_SIZE; ++Index) {
+		if (Zones[Index].Loose > ZONE_REBUILD) zone_rebuild(Column, Index);
+	}
+	for (size_t I = 0; I < Count; ++I) {
+		size_t Row = Start + I;
+		zone_t *Zone = Zones + Row / ZONE_SIZE;
+		double Old = Column->Reals[Row], Value = Values[I];
+		if (Old != Old) {
+			--Zone->Nulls;
+		} else if ((Old == Zone->Min || Old == Zone->Max) && Old != Value) {
+			++Zone->Loose;
+		}
+		zone_add_real(Zone, Value);
+	}
+}
+
+void zones_string_update(column_t *Column, size_t Row, const char *Value, size_t Length) {
+	// called with the old value still in place
+	if (!Column->Zones) return;
+	zone_unclean(Column);
+	zone_t *Zone = Column->Zones->Entries + Row / ZONE_SIZE;
+	if (Zone->Loose > ZONE_REBUILD) zone_rebuild(Column, Row / ZONE_SIZE);
+	size_t OldLength;
+	uint64_t OldPrefix = zone_row_prefix(Column, Row, &OldLength);
+	if (!OldLength) --Zone->Nulls;
+	if (OldLength == Zone->MinLength || OldLength == Zone->MaxLength || OldPrefix == Zone->MinPrefix || OldPrefix == Zone->MaxPrefix) {
+		++Zone->Loose;
+	}
+	zone_add_string(Zone, Length, zone_prefix(Value, Length));
+}